@@ -0,0 +1,582 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+// Drives one of the plugins against an in-process MockServer and reports
+// throughput and latency.  Run with --help for the options.
+
+#include "Bench.hh"
+#include "MockServer.hh"
+
+#include <XrdOss/XrdOss.hh>
+#include <XrdOuc/XrdOucEnv.hh>
+#include <XrdOuc/XrdOucIOVec.hh>
+#include <XrdSys/XrdSysLogger.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct ThreadResult {
+	uint64_t ops{0};
+	uint64_t errors{0};
+	uint64_t bytes{0};
+	uint64_t mismatches{0};
+	std::vector<uint64_t> latency_ns;
+};
+
+void usage(const char *prog, bool chooseBackend) {
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	if (chooseBackend) {
+		fprintf(stderr,
+				"  --backend s3|http         which plugin --plugin is (s3)\n"
+				"  --plugin PATH             the plugin library to load\n");
+	}
+	fprintf(stderr,
+			"  --op read|readv|write|stat\n"
+			"                            operation to benchmark (read)\n"
+			"  --pattern sequential|random\n"
+			"                            read offsets (sequential)\n"
+			"  --threads N               concurrent threads (4)\n"
+			"  --objects N               objects in the mock backend (4)\n"
+			"  --object-size BYTES       size of each object (64M)\n"
+			"  --block-size BYTES        bytes per read or write (1M)\n"
+			"  --readv-segments N        segments per readv (8)\n"
+			"  --duration SECONDS        how long to run (10)\n"
+			"  --ops N                   stop each thread after N ops\n"
+			"  --tls                     serve the mock backend over HTTPS\n"
+			"  --unix-socket             reach the mock backend over a Unix\n"
+			"                            domain socket (plain HTTP)\n"
+			"  --http2                   negotiate HTTP/2 and multiplex\n"
+			"                            requests on shared connections\n"
+			"  --no-sign                 send unsigned S3 requests\n"
+			"  --presign SECONDS         read S3 objects through pre-signed\n"
+			"                            URLs valid this long\n"
+			"  --verify                  check the contents of every read\n"
+			"  --seed N                  seed for offsets and faults (1)\n"
+			"  --faults SPEC             make the mock backend misbehave; see\n"
+			"                            FaultProfile in MockServer.hh\n"
+			"  --max-p99-ms MS           fail if the p99 latency exceeds MS\n"
+			"  --max-error-rate RATE     fail if more than RATE of the ops\n"
+			"                            fail (0)\n"
+			"  --stats                   print the plugin's statistics\n"
+			"  --access-log FILE         have the plugin record an access log\n"
+			"  --json                    print the report as JSON\n"
+			"Sizes take a K, M or G suffix (powers of 1024).\n");
+}
+
+bool parseSize(const char *str, size_t &size) {
+	char *end;
+	unsigned long long value = strtoull(str, &end, 10);
+	if (end == str) {
+		return false;
+	}
+	switch (*end) {
+	case 'k':
+	case 'K':
+		value <<= 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		value <<= 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		value <<= 30;
+		end++;
+		break;
+	}
+	size = value;
+	return *end == '\0';
+}
+
+bool parseArgs(int argc, char *argv[], bool chooseBackend,
+			   BenchOptions &opts) {
+	for (int idx = 1; idx < argc; idx++) {
+		std::string arg = argv[idx];
+		const char *value = idx + 1 < argc ? argv[idx + 1] : nullptr;
+		bool needsValue = true;
+		size_t size;
+		if (arg == "--tls") {
+			opts.tls = true;
+			needsValue = false;
+		} else if (arg == "--unix-socket") {
+			opts.unix_socket = true;
+			needsValue = false;
+		} else if (arg == "--http2") {
+			opts.http2 = true;
+			needsValue = false;
+		} else if (arg == "--no-sign") {
+			opts.sign = false;
+			needsValue = false;
+		} else if (arg == "--verify") {
+			opts.verify = true;
+			needsValue = false;
+		} else if (arg == "--json") {
+			opts.json = true;
+			needsValue = false;
+		} else if (arg == "--stats") {
+			opts.stats = true;
+			needsValue = false;
+		} else if (!value) {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		} else if (chooseBackend && arg == "--backend") {
+			opts.backend = value;
+		} else if (chooseBackend && arg == "--plugin") {
+			opts.plugin = value;
+		} else if (arg == "--access-log") {
+			opts.access_log = value;
+		} else if (arg == "--op") {
+			opts.op = value;
+		} else if (arg == "--pattern") {
+			opts.pattern = value;
+		} else if (arg == "--threads") {
+			opts.threads = atoi(value);
+		} else if (arg == "--objects") {
+			opts.objects = atoi(value);
+		} else if (arg == "--object-size" && parseSize(value, size)) {
+			opts.object_size = size;
+		} else if (arg == "--block-size" && parseSize(value, size)) {
+			opts.block_size = size;
+		} else if (arg == "--readv-segments") {
+			opts.readv_segments = atoi(value);
+		} else if (arg == "--duration") {
+			opts.duration = atof(value);
+		} else if (arg == "--ops") {
+			opts.max_ops = strtoull(value, nullptr, 10);
+		} else if (arg == "--presign") {
+			opts.presign = atoi(value);
+		} else if (arg == "--seed") {
+			opts.seed = strtoull(value, nullptr, 10);
+		} else if (arg == "--faults") {
+			opts.faults = value;
+		} else if (arg == "--max-p99-ms") {
+			opts.max_p99_ms = atof(value);
+		} else if (arg == "--max-error-rate") {
+			opts.max_error_rate = atof(value);
+		} else {
+			fprintf(stderr, "Invalid argument: %s\n", arg.c_str());
+			return false;
+		}
+		if (needsValue) {
+			idx++;
+		}
+	}
+	if (opts.backend != "s3" && opts.backend != "http") {
+		fprintf(stderr, "Unknown backend: %s\n", opts.backend.c_str());
+		return false;
+	}
+	if (chooseBackend && opts.plugin.empty()) {
+		fprintf(stderr, "--plugin is required\n");
+		return false;
+	}
+	if (opts.op != "read" && opts.op != "readv" && opts.op != "write" &&
+		opts.op != "stat") {
+		fprintf(stderr, "Unknown operation: %s\n", opts.op.c_str());
+		return false;
+	}
+	if (opts.pattern != "sequential" && opts.pattern != "random") {
+		fprintf(stderr, "Unknown access pattern: %s\n", opts.pattern.c_str());
+		return false;
+	}
+	if (!opts.threads || !opts.objects || !opts.block_size ||
+		!opts.object_size || !opts.readv_segments ||
+		opts.readv_segments > opts.block_size || opts.duration <= 0) {
+		fprintf(stderr, "Thread, object and size counts must be positive\n");
+		return false;
+	}
+	return true;
+}
+
+// The contents of object `obj` at byte `pos`; 251 is prime, so misplaced
+// reads are caught whatever the block size.
+inline char objectByte(unsigned obj, uint64_t pos) {
+	return static_cast<char>((pos + obj * 7) % 251);
+}
+
+std::string objectKey(unsigned obj) { return "obj-" + std::to_string(obj); }
+
+bool checkBytes(const char *data, unsigned obj, uint64_t offset,
+				size_t length) {
+	for (size_t idx = 0; idx < length; idx++) {
+		if (data[idx] != objectByte(obj, offset + idx)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Split a readv of `length` bytes into segments spread over the object, the
+// first at `offset`.
+std::vector<XrdOucIOVec> readvSegments(const BenchOptions &opts,
+									   uint64_t offset, size_t length,
+									   char *buffer) {
+	size_t segment = length / opts.readv_segments;
+	uint64_t stride = opts.object_size / opts.readv_segments;
+	std::vector<XrdOucIOVec> iov(opts.readv_segments);
+	for (unsigned idx = 0; idx < opts.readv_segments; idx++) {
+		iov[idx].offset =
+			(offset + idx * stride) % (opts.object_size - segment + 1);
+		iov[idx].size = idx + 1 == opts.readv_segments
+							? length - segment * idx
+							: segment;
+		iov[idx].info = 0;
+		iov[idx].data = buffer + segment * idx;
+	}
+	return iov;
+}
+
+void runThread(XrdOss &fs, const BenchOptions &opts, unsigned thread,
+			   std::chrono::steady_clock::time_point deadline,
+			   ThreadResult &result) {
+	XrdOucEnv env;
+	std::mt19937_64 rng(opts.seed + thread);
+	std::vector<char> buffer(opts.block_size);
+	if (opts.op == "write") {
+		for (size_t idx = 0; idx < buffer.size(); idx++) {
+			buffer[idx] = objectByte(thread, idx);
+		}
+	}
+
+	// Files are opened once per thread, as xrootd does for a client that
+	// keeps a file open; the opens are not part of the measurement.
+	std::vector<std::unique_ptr<XrdOssDF>> files(opts.objects);
+	unsigned current = thread % opts.objects;
+	uint64_t offset = 0;
+	size_t blocks = (opts.object_size + opts.block_size - 1) / opts.block_size;
+
+	while (std::chrono::steady_clock::now() < deadline &&
+		   (!opts.max_ops || result.ops < opts.max_ops)) {
+		if (opts.pattern == "random") {
+			current = rng() % opts.objects;
+			offset = (rng() % blocks) * opts.block_size;
+		} else if (offset >= opts.object_size) {
+			current = (current + 1) % opts.objects;
+			offset = 0;
+		}
+		std::string path =
+			std::string(g_bench_prefix) + "/" +
+			(opts.op == "write"
+				 ? "upload-" + std::to_string(thread) + "-" +
+					   std::to_string(current)
+				 : objectKey(current));
+
+		auto &file = files[current];
+		if (!file && opts.op != "stat") {
+			file.reset(fs.newFile("bench"));
+			int flags = opts.op == "write" ? O_CREAT | O_WRONLY : 0;
+			if (file->Open(path.c_str(), flags, 0600, env) != 0) {
+				result.ops++;
+				result.errors++;
+				file.reset();
+				continue;
+			}
+		}
+
+		size_t length = std::min<uint64_t>(opts.block_size,
+										   opts.object_size - offset);
+		auto start = std::chrono::steady_clock::now();
+		bool ok;
+		std::vector<XrdOucIOVec> iov;
+		if (opts.op == "read") {
+			ssize_t rv = file->Read(buffer.data(), offset, length);
+			ok = rv == static_cast<ssize_t>(length);
+		} else if (opts.op == "readv") {
+			iov = readvSegments(opts, offset, length, buffer.data());
+			ssize_t rv = file->ReadV(iov.data(), iov.size());
+			ok = rv == static_cast<ssize_t>(length);
+		} else if (opts.op == "write") {
+			ok = file->Write(buffer.data(), 0, length) == 0;
+		} else {
+			struct stat st;
+			ok = fs.Stat(path.c_str(), &st, 0, &env) == 0 &&
+				 static_cast<size_t>(st.st_size) == opts.object_size;
+			length = 0;
+		}
+		result.latency_ns.push_back(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start)
+				.count());
+		result.ops++;
+		if (!ok) {
+			result.errors++;
+		} else {
+			result.bytes += length;
+			if (opts.verify && opts.op == "read" &&
+				!checkBytes(buffer.data(), current, offset, length)) {
+				result.mismatches++;
+			}
+			if (opts.verify && opts.op == "readv") {
+				for (const auto &seg : iov) {
+					if (!checkBytes(seg.data, current, seg.offset, seg.size)) {
+						result.mismatches++;
+						break;
+					}
+				}
+			}
+		}
+		offset += length ? length : opts.block_size;
+	}
+
+	for (auto &file : files) {
+		if (file) {
+			file->Close();
+		}
+	}
+}
+
+double cpuSeconds() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		   (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+} // namespace
+
+double benchPercentileMs(const std::vector<uint64_t> &sorted, double q) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t idx = std::min(sorted.size() - 1,
+						  static_cast<size_t>(q * (sorted.size() - 1) + 0.5));
+	return sorted[idx] / 1e6;
+}
+
+int benchMain(int argc, char *argv[], const char *backend) {
+	BenchOptions opts;
+	bool chooseBackend = backend == nullptr;
+	for (int idx = 1; idx < argc; idx++) {
+		if (!strcmp(argv[idx], "--help") || !strcmp(argv[idx], "-h")) {
+			usage(argv[0], chooseBackend);
+			return 0;
+		}
+	}
+	if (backend) {
+		opts.backend = backend;
+	}
+	if (!parseArgs(argc, argv, chooseBackend, opts)) {
+		usage(argv[0], chooseBackend);
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	MockServer server;
+	std::string err;
+	FaultProfile faults;
+	if (!FaultProfile::parse(opts.faults, faults, err)) {
+		fprintf(stderr, "Invalid --faults: %s\n", err.c_str());
+		return 2;
+	}
+	if (!server.Start(opts.tls, err)) {
+		fprintf(stderr, "Failed to start the mock server: %s\n", err.c_str());
+		return 1;
+	}
+	if (opts.tls) {
+		setenv("X509_CERT_FILE", server.caFile().c_str(), 1);
+	}
+	if (opts.op != "write") {
+		for (unsigned obj = 0; obj < opts.objects; obj++) {
+			std::string data(opts.object_size, '\0');
+			for (size_t idx = 0; idx < data.size(); idx++) {
+				data[idx] = objectByte(obj, idx);
+			}
+			server.putObject(benchBackendPath(opts.backend, objectKey(obj)),
+							 std::move(data));
+		}
+	}
+
+	char dir[] = "/tmp/xrdhttp-bench-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	if (opts.unix_socket && !server.ListenUnix(benchUnixSocket(dir), err)) {
+		fprintf(stderr, "Failed to start the mock server: %s\n", err.c_str());
+		return 1;
+	}
+	std::string cfgfile = std::string(dir) + "/bench.cfg";
+	{
+		std::ofstream cfg(cfgfile);
+		if (!benchWriteConfig(cfg, server.url(), dir, opts)) {
+			fprintf(stderr, "Failed to write the plugin configuration\n");
+			return 1;
+		}
+	}
+
+	// Populating the objects above is not subject to the faults.
+	server.setFaults(faults, opts.seed);
+
+	XrdSysLogger logger;
+	std::unique_ptr<XrdOss> fs = benchCreateFileSystem(&logger, cfgfile, opts);
+	if (!fs) {
+		return 1;
+	}
+
+	std::vector<ThreadResult> results(opts.threads);
+	std::vector<std::thread> threads;
+	uint64_t requestsBefore = server.requests();
+	uint64_t connectionsBefore = server.connections();
+	double cpuBefore = cpuSeconds();
+	double mockCpuBefore = server.cpuSeconds();
+	auto start = std::chrono::steady_clock::now();
+	auto deadline =
+		start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(opts.duration));
+	for (unsigned thread = 0; thread < opts.threads; thread++) {
+		threads.emplace_back(runThread, std::ref(*fs), std::cref(opts), thread,
+							 deadline, std::ref(results[thread]));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	double elapsed = std::chrono::duration<double>(
+						 std::chrono::steady_clock::now() - start)
+						 .count();
+	double cpu = cpuSeconds() - cpuBefore;
+	uint64_t requests = server.requests() - requestsBefore;
+	uint64_t connections = server.connections() - connectionsBefore;
+
+	ThreadResult total;
+	for (auto &result : results) {
+		total.ops += result.ops;
+		total.errors += result.errors;
+		total.bytes += result.bytes;
+		total.mismatches += result.mismatches;
+		total.latency_ns.insert(total.latency_ns.end(),
+								result.latency_ns.begin(),
+								result.latency_ns.end());
+	}
+	std::sort(total.latency_ns.begin(), total.latency_ns.end());
+	double opsPerSec = total.ops / elapsed;
+	double gbPerSec = total.bytes / elapsed / 1e9;
+	double p50 = benchPercentileMs(total.latency_ns, 0.5);
+	double p90 = benchPercentileMs(total.latency_ns, 0.9);
+	double p99 = benchPercentileMs(total.latency_ns, 0.99);
+	double p999 = benchPercentileMs(total.latency_ns, 0.999);
+	double max = benchPercentileMs(total.latency_ns, 1);
+	double errorRate = total.ops ? double(total.errors) / total.ops : 0;
+	uint64_t injected = server.faultsInjected();
+
+	std::string stats;
+	if (opts.stats) {
+		int len = fs->Stats(nullptr, 0);
+		if (len > 0) {
+			stats.resize(len + 1);
+			len = fs->Stats(&stats[0], stats.size());
+			stats.resize(len > 0 ? len : 0);
+		}
+	}
+	fs.reset();
+	// Once stopped, the server has counted the CPU time of every connection
+	// and the rest of the process time belongs to the plugin and the
+	// benchmark threads.
+	server.Stop();
+	double mockCpu = server.cpuSeconds() - mockCpuBefore;
+	double pluginCpu = cpu > mockCpu ? cpu - mockCpu : 0;
+	double nsPerByte = total.bytes ? pluginCpu * 1e9 / total.bytes : 0;
+
+	if (opts.json) {
+		printf("{\"backend\":\"%s\",\"tls\":%s,\"op\":\"%s\","
+			   "\"pattern\":\"%s\",\"threads\":%u,\"objects\":%u,"
+			   "\"object_size\":%zu,\"block_size\":%zu,\"ops\":%" PRIu64
+			   ",\"errors\":%" PRIu64 ",\"mismatches\":%" PRIu64
+			   ",\"bytes\":%" PRIu64 ",\"seconds\":%.3f,\"ops_per_sec\":%.1f,"
+			   "\"gb_per_sec\":%.4f,\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,"
+			   "\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},\"cpu_seconds\":%.3f,"
+			   "\"mock_cpu_seconds\":%.3f,\"plugin_cpu_seconds\":%.3f,"
+			   "\"plugin_ns_per_byte\":%.3f,"
+			   "\"requests\":%" PRIu64 ",\"connections\":%" PRIu64
+			   ",\"faults_injected\":%" PRIu64 "}\n",
+			   opts.backend.c_str(), opts.tls ? "true" : "false",
+			   opts.op.c_str(), opts.pattern.c_str(), opts.threads,
+			   opts.objects, opts.object_size, opts.block_size, total.ops,
+			   total.errors, total.mismatches, total.bytes, elapsed, opsPerSec,
+			   gbPerSec, p50, p90, p99, p999, max, cpu, mockCpu, pluginCpu,
+			   nsPerByte, requests, connections, injected);
+	} else {
+		printf("backend      %s over %s%s\n", opts.backend.c_str(),
+			   opts.tls ? "https" : "http",
+			   opts.sign && opts.backend == "s3" ? ", signed" : "");
+		printf("workload     %s/%s, %u threads, %u x %zu byte objects, "
+			   "%zu byte blocks\n",
+			   opts.op.c_str(), opts.pattern.c_str(), opts.threads,
+			   opts.objects, opts.object_size, opts.block_size);
+		printf("ops          %" PRIu64 " in %.2f s, %" PRIu64 " errors",
+			   total.ops, elapsed, total.errors);
+		if (opts.verify) {
+			printf(", %" PRIu64 " bad reads", total.mismatches);
+		}
+		printf("\nthroughput   %.1f ops/s, %.3f GB/s\n", opsPerSec, gbPerSec);
+		printf("latency ms   p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  "
+			   "max %.3f\n",
+			   p50, p90, p99, p999, max);
+		printf("cpu          %.2f s, of which %.2f s in the mock server",
+			   cpu, mockCpu);
+		if (total.bytes) {
+			printf("; plugin %.2f ns/byte", nsPerByte);
+		}
+		printf("\nbackend      %" PRIu64 " requests on %" PRIu64
+			   " connections",
+			   requests, connections);
+		if (!opts.faults.empty()) {
+			printf(", %" PRIu64 " faults injected (%s)", injected,
+				   opts.faults.c_str());
+		}
+		printf("\n");
+	}
+	if (!stats.empty()) {
+		printf("%s\n", stats.c_str());
+	}
+
+	bool failed = total.mismatches > 0;
+	if (errorRate > opts.max_error_rate) {
+		fprintf(stderr, "FAIL: error rate %.4f exceeds %.4f\n", errorRate,
+				opts.max_error_rate);
+		failed = true;
+	}
+	if (opts.max_p99_ms >= 0 && p99 > opts.max_p99_ms) {
+		fprintf(stderr, "FAIL: p99 latency %.3f ms exceeds %.3f ms\n", p99,
+				opts.max_p99_ms);
+		failed = true;
+	}
+
+	unlink(cfgfile.c_str());
+	unlink((std::string(dir) + "/access_key").c_str());
+	unlink((std::string(dir) + "/secret_key").c_str());
+	unlink(benchUnixSocket(dir).c_str());
+	rmdir(dir);
+	return failed ? 1 : 0;
+}
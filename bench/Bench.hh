@@ -0,0 +1,92 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class XrdOss;
+class XrdSysLogger;
+
+struct BenchOptions {
+	std::string backend{"s3"};		   // s3 or http
+	std::string plugin;				   // plugin library, for plugin-harness
+	std::string op{"read"};			   // read, readv, write or stat
+	std::string pattern{"sequential"}; // sequential or random
+	unsigned threads{4};
+	unsigned objects{4};
+	size_t object_size{64 << 20};
+	size_t block_size{1 << 20};
+	unsigned readv_segments{8};	// a readv of block_size is split this way
+	double duration{10};	// seconds
+	uint64_t max_ops{0};	// per thread; 0 means no limit
+	bool tls{false};
+	bool unix_socket{false}; // reach the mock backend over a Unix socket
+	bool http2{false};		 // negotiate HTTP/2 and share connections
+	bool sign{true};		// S3 only: sign requests with dummy credentials
+	unsigned presign{0};	// S3 only: s3.presign_validity in seconds
+	bool verify{false};		// check the contents of every read
+	bool json{false};
+	uint64_t seed{1};
+	std::string faults;		// a FaultProfile specification
+	// Fail the run if these are exceeded; negative disables the p99 check.
+	double max_p99_ms{-1};
+	double max_error_rate{0};
+	bool stats{false};		// print the plugin's Stats() at the end
+	std::string access_log; // have the plugin record an access log here
+};
+
+// Every benchmark exports the backend under this path.
+const char g_bench_prefix[] = "/bench";
+
+// The path on the mock server that `backend` reads for the object the
+// plugin sees as g_bench_prefix + "/" + key.
+std::string benchBackendPath(const std::string &backend,
+							 const std::string &key);
+
+// The Unix domain socket the mock backend listens on, with unix_socket,
+// for a benchmark whose scratch directory is `dir`.
+std::string benchUnixSocket(const std::string &dir);
+
+// Write a configuration for the plugin opts.backend that exports the server
+// at `url` under g_bench_prefix.  `dir` is a scratch directory for any
+// other files the configuration needs.
+bool benchWriteConfig(std::ostream &cfg, const std::string &url,
+					  const std::string &dir, const BenchOptions &opts);
+
+// Instantiate the plugin from the configuration file, or return null after
+// printing why not.  Each binary implements this differently: s3-bench and
+// http-bench construct the plugin they are linked with (only one, since the
+// two plugins define the same XRootD entry points), while plugin-harness
+// and trace-replay load opts.plugin as xrootd would.
+std::unique_ptr<XrdOss> benchCreateFileSystem(XrdSysLogger *logger,
+											  const std::string &cfgfile,
+											  const BenchOptions &opts);
+
+// The `q` quantile of the sorted nanosecond latencies, in milliseconds.
+double benchPercentileMs(const std::vector<uint64_t> &sorted, double q);
+
+// The body of main() shared by the benchmark binaries.  A binary tied to
+// one plugin passes its name as `backend`; otherwise the plugin is chosen
+// with --backend and --plugin.
+int benchMain(int argc, char *argv[], const char *backend);
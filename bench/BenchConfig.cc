@@ -0,0 +1,108 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "Bench.hh"
+
+#include <fstream>
+
+namespace {
+
+// The S3 bucket, and the directory standing in for the HTTP origin.
+const char g_bucket[] = "bench";
+const char g_origin_dir[] = "/origin";
+
+bool writeFile(const std::string &path, const std::string &contents) {
+	std::ofstream out(path);
+	out << contents;
+	return out.good();
+}
+
+bool writeS3Config(std::ostream &cfg, const std::string &url,
+				   const std::string &dir, const BenchOptions &opts) {
+	cfg << "s3.trace warning error\n";
+	if (!opts.access_log.empty()) {
+		cfg << "s3.access_log " << opts.access_log << "\n";
+	}
+	if (opts.presign) {
+		cfg << "s3.presign_validity " << opts.presign << "s\n";
+	}
+	cfg << "s3.begin\n"
+		<< "s3.path_name " << g_bench_prefix << "\n"
+		<< "s3.bucket_name " << g_bucket << "\n"
+		<< "s3.service_name s3.example.com\n"
+		<< "s3.region us-east-1\n"
+		<< "s3.service_url " << url << "\n";
+	if (opts.unix_socket) {
+		cfg << "s3.unix_socket " << benchUnixSocket(dir) << "\n";
+	}
+	if (opts.http2) {
+		cfg << "s3.http2 on\n";
+	}
+	if (opts.sign) {
+		std::string access = dir + "/access_key";
+		std::string secret = dir + "/secret_key";
+		if (!writeFile(access, "AKIDEXAMPLE") ||
+			!writeFile(secret, "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY")) {
+			return false;
+		}
+		cfg << "s3.access_key_file " << access << "\n"
+			<< "s3.secret_key_file " << secret << "\n";
+	}
+	cfg << "s3.end\n"
+		<< "s3.url_style path\n";
+	return cfg.good();
+}
+
+bool writeHTTPConfig(std::ostream &cfg, const std::string &url,
+					 const std::string &dir, const BenchOptions &opts) {
+	cfg << "httpserver.trace warning error\n";
+	if (!opts.access_log.empty()) {
+		cfg << "httpserver.access_log " << opts.access_log << "\n";
+	}
+	cfg << "httpserver.url_base " << url << g_origin_dir << "\n"
+		<< "httpserver.storage_prefix " << g_bench_prefix << "\n";
+	if (opts.unix_socket) {
+		cfg << "httpserver.unix_socket " << benchUnixSocket(dir) << "\n";
+	}
+	if (opts.http2) {
+		cfg << "httpserver.http2 on\n";
+	}
+	return cfg.good();
+}
+
+} // namespace
+
+std::string benchBackendPath(const std::string &backend,
+							 const std::string &key) {
+	if (backend == "s3") {
+		return std::string("/") + g_bucket + "/" + key;
+	}
+	return std::string(g_origin_dir) + "/" + key;
+}
+
+std::string benchUnixSocket(const std::string &dir) {
+	return dir + "/backend.sock";
+}
+
+bool benchWriteConfig(std::ostream &cfg, const std::string &url,
+					  const std::string &dir, const BenchOptions &opts) {
+	if (opts.backend == "s3") {
+		return writeS3Config(cfg, url, dir, opts);
+	}
+	return writeHTTPConfig(cfg, url, dir, opts);
+}
@@ -0,0 +1,1272 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "MockServer.hh"
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// Requests with headers larger than this are rejected.
+const size_t g_max_header_size = 64 * 1024;
+
+const char *statusReason(int status) {
+	switch (status) {
+	case 100:
+		return "Continue";
+	case 200:
+		return "OK";
+	case 204:
+		return "No Content";
+	case 206:
+		return "Partial Content";
+	case 400:
+		return "Bad Request";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 416:
+		return "Range Not Satisfiable";
+	case 500:
+		return "Internal Server Error";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return "Unknown";
+	}
+}
+
+std::string toLower(std::string str) {
+	std::transform(str.begin(), str.end(), str.begin(),
+				   [](unsigned char c) { return std::tolower(c); });
+	return str;
+}
+
+std::string percentDecode(const std::string &str) {
+	std::string result;
+	result.reserve(str.size());
+	for (size_t idx = 0; idx < str.size(); idx++) {
+		if (str[idx] == '%' && idx + 2 < str.size() &&
+			isxdigit(static_cast<unsigned char>(str[idx + 1])) &&
+			isxdigit(static_cast<unsigned char>(str[idx + 2]))) {
+			result += static_cast<char>(
+				std::stoi(str.substr(idx + 1, 2), nullptr, 16));
+			idx += 2;
+		} else {
+			result += str[idx];
+		}
+	}
+	return result;
+}
+
+std::string xmlEscape(const std::string &str) {
+	std::string result;
+	result.reserve(str.size());
+	for (char c : str) {
+		switch (c) {
+		case '&':
+			result += "&amp;";
+			break;
+		case '<':
+			result += "&lt;";
+			break;
+		case '>':
+			result += "&gt;";
+			break;
+		case '"':
+			result += "&quot;";
+			break;
+		default:
+			result += c;
+		}
+	}
+	return result;
+}
+
+std::string httpDate(time_t when) {
+	struct tm tm;
+	gmtime_r(&when, &tm);
+	char buf[64];
+	strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+std::string isoDate(time_t when) {
+	struct tm tm;
+	gmtime_r(&when, &tm);
+	char buf[64];
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+	return buf;
+}
+
+// Not MD5, as S3 uses, but stable and cheap.
+std::string makeETag(const std::string &data) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : data) {
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\"%016llx\"",
+			 static_cast<unsigned long long>(hash));
+	return buf;
+}
+
+// Parse a single "bytes=first-last" range against an object of `size`
+// bytes.  Returns false if the range cannot be satisfied.
+bool parseRange(const std::string &header, size_t size, size_t &offset,
+				size_t &length) {
+	if (header.compare(0, 6, "bytes=") != 0 ||
+		header.find(',') != std::string::npos) {
+		return false;
+	}
+	auto dash = header.find('-', 6);
+	if (dash == std::string::npos) {
+		return false;
+	}
+	std::string first = header.substr(6, dash - 6);
+	std::string last = header.substr(dash + 1);
+	try {
+		if (first.empty()) {
+			// Suffix range: the last N bytes.
+			size_t count = std::stoull(last);
+			if (count == 0 || size == 0) {
+				return false;
+			}
+			count = std::min(count, size);
+			offset = size - count;
+			length = count;
+			return true;
+		}
+		size_t start = std::stoull(first);
+		size_t end = last.empty() ? size - 1 : std::stoull(last);
+		if (start >= size || end < start) {
+			return false;
+		}
+		end = std::min(end, size - 1);
+		offset = start;
+		length = end - start + 1;
+		return true;
+	} catch (...) {
+		return false;
+	}
+}
+
+// Split a path-style "/bucket/key" into its bucket and key.
+void splitPath(const std::string &path, std::string &bucket,
+			   std::string &key) {
+	auto slash = path.find('/', 1);
+	bucket = path.substr(1, slash == std::string::npos ? slash : slash - 1);
+	key = slash == std::string::npos ? "" : path.substr(slash + 1);
+}
+
+} // namespace
+
+bool FaultProfile::parse(const std::string &spec, FaultProfile &profile,
+						 std::string &err) {
+	static const std::map<std::string, std::string> presets = {
+		{"none", ""},
+		{"lognormal", "latency=5:0.5"},
+		{"longtail", "latency=2:0.3,tail=0.02:200"},
+		{"throttle", "limit=0.1"},
+		{"slowdown", "slowdown=0.05"},
+		{"flaky", "reset=0.02,truncate=0.02"},
+		{"stall", "stall=0.02:300"},
+	};
+
+	std::istringstream items(spec);
+	std::string item;
+	while (std::getline(items, item, ',')) {
+		if (item.empty()) {
+			continue;
+		}
+		auto preset = presets.find(item);
+		if (preset != presets.end()) {
+			if (!preset->second.empty() &&
+				!parse(preset->second, profile, err)) {
+				return false;
+			}
+			continue;
+		}
+
+		auto eq = item.find('=');
+		std::string name = item.substr(0, eq);
+		double first = 0, second = 0;
+		int count = 0;
+		if (eq != std::string::npos) {
+			char *end;
+			const char *value = item.c_str() + eq + 1;
+			first = strtod(value, &end);
+			count = end != value;
+			if (count && *end == ':') {
+				value = end + 1;
+				second = strtod(value, &end);
+				count += end != value;
+			}
+			if (*end != '\0') {
+				count = 0;
+			}
+		}
+
+		bool pair = name == "latency" || name == "tail" || name == "stall";
+		if (count != (pair ? 2 : 1) || first < 0 || second < 0) {
+			err = "invalid fault setting '" + item + "'";
+			return false;
+		}
+		if (name == "latency") {
+			profile.latency_median_ms = first;
+			profile.latency_sigma = second;
+		} else if (name == "tail") {
+			profile.tail_rate = first;
+			profile.tail_ms = second;
+		} else if (name == "stall") {
+			profile.stall_rate = first;
+			profile.stall_ms = second;
+		} else if (name == "slowdown") {
+			profile.slowdown_rate = first;
+		} else if (name == "limit") {
+			profile.request_limit_rate = first;
+		} else if (name == "reset") {
+			profile.reset_rate = first;
+		} else if (name == "truncate") {
+			profile.truncate_rate = first;
+		} else {
+			err = "unknown fault '" + item + "'";
+			return false;
+		}
+	}
+	return true;
+}
+
+// A plain or TLS socket.
+class MockServer::Connection {
+  public:
+	Connection(int fd, SSL *ssl) : m_fd(fd), m_ssl(ssl) {}
+	~Connection() {
+		if (m_ssl) {
+			SSL_shutdown(m_ssl);
+			SSL_free(m_ssl);
+		}
+	}
+
+	ssize_t read(char *buf, size_t len) {
+		if (m_ssl) {
+			int rv = SSL_read(m_ssl, buf, static_cast<int>(len));
+			return rv > 0 ? rv : -1;
+		}
+		ssize_t rv;
+		do {
+			rv = recv(m_fd, buf, len, 0);
+		} while (rv < 0 && errno == EINTR);
+		return rv > 0 ? rv : -1;
+	}
+
+	bool write(const char *buf, size_t len) {
+		while (len) {
+			ssize_t rv;
+			if (m_ssl) {
+				rv = SSL_write(m_ssl, buf, static_cast<int>(std::min(
+											   len, size_t(1) << 30)));
+				if (rv <= 0) {
+					return false;
+				}
+			} else {
+				rv = send(m_fd, buf, len, MSG_NOSIGNAL);
+				if (rv < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+			}
+			buf += rv;
+			len -= rv;
+		}
+		return true;
+	}
+
+	// Make the close that follows send a TCP reset instead of a FIN, and
+	// skip the TLS close_notify.
+	void abort() {
+		struct linger lin = {1, 0};
+		setsockopt(m_fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		if (m_ssl) {
+			SSL_set_quiet_shutdown(m_ssl, 1);
+		}
+	}
+
+  private:
+	int m_fd;
+	SSL *m_ssl;
+};
+
+MockServer::~MockServer() {
+	Stop();
+	if (m_ssl_ctx) {
+		SSL_CTX_free(m_ssl_ctx);
+	}
+	if (!m_ca_file.empty()) {
+		unlink(m_ca_file.c_str());
+	}
+}
+
+bool MockServer::Start(bool tls, std::string &err) {
+	if (tls && !setupTLS(err)) {
+		return false;
+	}
+
+	m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listen_fd < 0) {
+		err = std::string("socket: ") + strerror(errno);
+		return false;
+	}
+	int one = 1;
+	setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t len = sizeof(addr);
+	if (bind(m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+			 sizeof(addr)) != 0 ||
+		listen(m_listen_fd, 1024) != 0 ||
+		getsockname(m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+					&len) != 0) {
+		err = std::string("listen on loopback: ") + strerror(errno);
+		close(m_listen_fd);
+		m_listen_fd = -1;
+		return false;
+	}
+	m_port = ntohs(addr.sin_port);
+	m_acceptor = std::thread(&MockServer::acceptLoop, this, m_listen_fd,
+							 m_ssl_ctx != nullptr);
+	return true;
+}
+
+bool MockServer::ListenUnix(const std::string &path, std::string &err) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		err = "Unix socket path too long: " + path;
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	m_unix_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_unix_fd < 0) {
+		err = std::string("socket: ") + strerror(errno);
+		return false;
+	}
+	unlink(path.c_str());
+	if (bind(m_unix_fd, reinterpret_cast<struct sockaddr *>(&addr),
+			 sizeof(addr)) != 0 ||
+		listen(m_unix_fd, 1024) != 0) {
+		err = "listen on " + path + ": " + strerror(errno);
+		close(m_unix_fd);
+		m_unix_fd = -1;
+		return false;
+	}
+	m_unix_path = path;
+	m_unix_acceptor =
+		std::thread(&MockServer::acceptLoop, this, m_unix_fd, false);
+	return true;
+}
+
+void MockServer::Stop() {
+	if (m_listen_fd < 0) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_conn_mutex);
+		m_stopping = true;
+	}
+	shutdown(m_listen_fd, SHUT_RDWR);
+	if (m_acceptor.joinable()) {
+		m_acceptor.join();
+	}
+	close(m_listen_fd);
+	m_listen_fd = -1;
+	if (m_unix_fd >= 0) {
+		shutdown(m_unix_fd, SHUT_RDWR);
+		if (m_unix_acceptor.joinable()) {
+			m_unix_acceptor.join();
+		}
+		close(m_unix_fd);
+		m_unix_fd = -1;
+		unlink(m_unix_path.c_str());
+	}
+
+	std::unique_lock<std::mutex> lock(m_conn_mutex);
+	for (int fd : m_conn_fds) {
+		shutdown(fd, SHUT_RDWR);
+	}
+	m_conn_cv.wait(lock, [this] { return m_active == 0; });
+}
+
+std::string MockServer::url() const {
+	return std::string(m_ssl_ctx ? "https" : "http") +
+		   "://127.0.0.1:" + std::to_string(m_port);
+}
+
+void MockServer::putObject(const std::string &path, std::string data) {
+	auto obj = std::make_shared<Object>();
+	obj->etag = makeETag(data);
+	obj->data = std::move(data);
+	obj->mtime = time(nullptr);
+	std::unique_lock<std::shared_mutex> lock(m_objects_mutex);
+	m_objects[path] = std::move(obj);
+}
+
+void MockServer::setCredentials(const Credentials &credentials) {
+	std::lock_guard<std::mutex> lock(m_credentials_mutex);
+	m_credentials = credentials;
+	m_have_credentials = true;
+}
+
+std::string MockServer::lastSecurityToken() const {
+	std::lock_guard<std::mutex> lock(m_credentials_mutex);
+	return m_last_token;
+}
+
+std::string MockServer::lastHost() const {
+	std::lock_guard<std::mutex> lock(m_credentials_mutex);
+	return m_last_host;
+}
+
+void MockServer::setBucketRegion(const std::string &bucket,
+								 const std::string &region) {
+	std::lock_guard<std::mutex> lock(m_regions_mutex);
+	m_bucket_regions[bucket] = region;
+}
+
+bool MockServer::getObject(const std::string &path, std::string &data) const {
+	std::shared_lock<std::shared_mutex> lock(m_objects_mutex);
+	auto iter = m_objects.find(path);
+	if (iter == m_objects.end()) {
+		return false;
+	}
+	data = iter->second->data;
+	return true;
+}
+
+bool MockServer::setupTLS(std::string &err) {
+	EVP_PKEY *pkey = nullptr;
+	EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <=
+			0 ||
+		EVP_PKEY_keygen(kctx, &pkey) <= 0) {
+		EVP_PKEY_CTX_free(kctx);
+		err = "failed to generate a TLS key";
+		return false;
+	}
+	EVP_PKEY_CTX_free(kctx);
+
+	// A single certificate that is its own CA, so clients only need to
+	// trust this one file.
+	X509 *cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), time(nullptr));
+	X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 7 * 86400);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME *name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(
+		name, "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char *>("xrootd-s3-http mock CA"), -1,
+		-1, 0);
+	X509_set_issuer_name(cert, name);
+
+	X509V3_CTX v3ctx;
+	X509V3_set_ctx_nodb(&v3ctx);
+	X509V3_set_ctx(&v3ctx, cert, cert, nullptr, nullptr, 0);
+	const std::pair<int, const char *> extensions[] = {
+		{NID_basic_constraints, "critical,CA:TRUE"},
+		{NID_key_usage, "critical,keyCertSign,digitalSignature"},
+		{NID_subject_key_identifier, "hash"},
+		{NID_subject_alt_name, "IP:127.0.0.1,DNS:localhost"},
+	};
+	bool ok = true;
+	for (const auto &ext : extensions) {
+		X509_EXTENSION *x = X509V3_EXT_conf_nid(
+			nullptr, &v3ctx, ext.first, const_cast<char *>(ext.second));
+		ok = ok && x && X509_add_ext(cert, x, -1);
+		X509_EXTENSION_free(x);
+	}
+	ok = ok && X509_sign(cert, pkey, EVP_sha256()) > 0;
+
+	char ca_file[] = "/tmp/xrdhttp-mock-ca-XXXXXX";
+	int fd = ok ? mkstemp(ca_file) : -1;
+	FILE *fp = fd >= 0 ? fdopen(fd, "w") : nullptr;
+	if (fp) {
+		m_ca_file = ca_file;
+		ok = PEM_write_X509(fp, cert) == 1;
+		ok = (fclose(fp) == 0) && ok;
+	} else {
+		if (fd >= 0) {
+			close(fd);
+			unlink(ca_file);
+		}
+		ok = false;
+	}
+
+	if (ok) {
+		m_ssl_ctx = SSL_CTX_new(TLS_server_method());
+		ok = m_ssl_ctx && SSL_CTX_use_certificate(m_ssl_ctx, cert) == 1 &&
+			 SSL_CTX_use_PrivateKey(m_ssl_ctx, pkey) == 1;
+	}
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+	if (!ok) {
+		unsigned long code = ERR_get_error();
+		err = "failed to set up TLS";
+		if (code) {
+			char buf[256];
+			ERR_error_string_n(code, buf, sizeof(buf));
+			err += std::string(": ") + buf;
+		}
+		return false;
+	}
+	return true;
+}
+
+void MockServer::acceptLoop(int listenFd, bool tls) {
+	while (true) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_conn_mutex);
+		if (m_stopping) {
+			close(fd);
+			return;
+		}
+		m_conn_fds.insert(fd);
+		m_active++;
+		uint64_t id = m_connections.fetch_add(1, std::memory_order_relaxed);
+		std::thread(&MockServer::serveConnection, this, fd, id, tls).detach();
+	}
+}
+
+void MockServer::serveConnection(int fd, uint64_t id, bool tls) {
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	SSL *ssl = nullptr;
+	bool ok = true;
+	if (tls) {
+		ssl = SSL_new(m_ssl_ctx);
+		ok = ssl && SSL_set_fd(ssl, fd) == 1 && SSL_accept(ssl) == 1;
+	}
+	if (ok) {
+		Connection conn(fd, ssl);
+		std::mt19937_64 rng;
+		{
+			std::lock_guard<std::mutex> lock(m_faults_mutex);
+			rng.seed(m_fault_seed * 1000003 + id);
+		}
+		std::string buffer;
+		bool keepAlive = true;
+		while (keepAlive) {
+			Request req;
+			if (!readRequest(conn, buffer, req, keepAlive)) {
+				break;
+			}
+			m_requests.fetch_add(1, std::memory_order_relaxed);
+			Response resp = handle(req);
+			injectFaults(rng, resp);
+			if (!sendResponse(conn, req, resp, keepAlive)) {
+				break;
+			}
+		}
+	} else if (ssl) {
+		SSL_free(ssl);
+	}
+
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		m_cpu_ns.fetch_add(ts.tv_sec * 1000000000ull + ts.tv_nsec,
+						   std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(m_conn_mutex);
+	m_conn_fds.erase(fd);
+	close(fd);
+	if (--m_active == 0) {
+		m_conn_cv.notify_all();
+	}
+}
+
+bool MockServer::readRequest(Connection &conn, std::string &buffer,
+							 Request &req, bool &keepAlive) {
+	char chunk[64 * 1024];
+	size_t end;
+	while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+		if (buffer.size() > g_max_header_size) {
+			return false;
+		}
+		ssize_t rv = conn.read(chunk, sizeof(chunk));
+		if (rv <= 0) {
+			return false;
+		}
+		buffer.append(chunk, rv);
+	}
+
+	std::istringstream lines(buffer.substr(0, end));
+	buffer.erase(0, end + 4);
+	std::string line;
+	std::getline(lines, line);
+	std::string target, version;
+	{
+		std::istringstream first(line);
+		first >> req.method >> target >> version;
+	}
+	if (req.method.empty() || target.empty()) {
+		return false;
+	}
+	while (std::getline(lines, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		auto colon = line.find(':');
+		if (colon == std::string::npos) {
+			continue;
+		}
+		std::string value = line.substr(colon + 1);
+		value.erase(0, value.find_first_not_of(" \t"));
+		req.headers[toLower(line.substr(0, colon))] = value;
+	}
+	keepAlive = version == "HTTP/1.1" &&
+				toLower(req.headers["connection"]) != "close";
+
+	auto qmark = target.find('?');
+	req.path = percentDecode(target.substr(0, qmark));
+	if (qmark != std::string::npos) {
+		std::istringstream query(target.substr(qmark + 1));
+		std::string param;
+		while (std::getline(query, param, '&')) {
+			auto eq = param.find('=');
+			req.query[percentDecode(param.substr(0, eq))] =
+				eq == std::string::npos ? ""
+										: percentDecode(param.substr(eq + 1));
+		}
+	}
+
+	if (toLower(req.headers["expect"]) == "100-continue") {
+		static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+		if (!conn.write(cont, sizeof(cont) - 1)) {
+			return false;
+		}
+	}
+
+	if (toLower(req.headers["transfer-encoding"]) == "chunked") {
+		while (true) {
+			size_t eol;
+			while ((eol = buffer.find("\r\n")) == std::string::npos) {
+				ssize_t rv = conn.read(chunk, sizeof(chunk));
+				if (rv <= 0) {
+					return false;
+				}
+				buffer.append(chunk, rv);
+			}
+			size_t size = strtoull(buffer.c_str(), nullptr, 16);
+			buffer.erase(0, eol + 2);
+			while (buffer.size() < size + 2) {
+				ssize_t rv = conn.read(chunk, sizeof(chunk));
+				if (rv <= 0) {
+					return false;
+				}
+				buffer.append(chunk, rv);
+			}
+			req.body.append(buffer, 0, size);
+			buffer.erase(0, size + 2);
+			if (size == 0) {
+				return true;
+			}
+		}
+	}
+
+	auto iter = req.headers.find("content-length");
+	size_t length =
+		iter == req.headers.end() ? 0 : strtoull(iter->second.c_str(), 0, 10);
+	req.body.reserve(length);
+	size_t take = std::min(length, buffer.size());
+	req.body.assign(buffer, 0, take);
+	buffer.erase(0, take);
+	while (req.body.size() < length) {
+		ssize_t rv = conn.read(
+			chunk, std::min(sizeof(chunk), length - req.body.size()));
+		if (rv <= 0) {
+			return false;
+		}
+		req.body.append(chunk, rv);
+	}
+	return true;
+}
+
+bool MockServer::sendResponse(Connection &conn, const Request &req,
+							  const Response &resp, bool keepAlive) {
+	size_t length = resp.object ? resp.length : resp.body.size();
+	std::string head = "HTTP/1.1 " + std::to_string(resp.status) + " " +
+					   statusReason(resp.status) + "\r\n";
+	for (const auto &header : resp.headers) {
+		head += header.first + ": " + header.second + "\r\n";
+	}
+	head += "Content-Length: " + std::to_string(length) + "\r\n";
+	if (!keepAlive) {
+		head += "Connection: close\r\n";
+	}
+	head += "\r\n";
+
+	bool ok = conn.write(head.data(), head.size());
+	if (!ok || resp.headers_only || req.method == "HEAD") {
+		return ok;
+	}
+
+	const char *body =
+		resp.object ? resp.object->data.data() + resp.offset : resp.body.data();
+	size_t sent = resp.fault == BodyFault::None ? length : length / 2;
+	ok = conn.write(body, sent);
+	switch (resp.fault) {
+	case BodyFault::None:
+		break;
+	case BodyFault::Reset:
+		conn.abort();
+		return false;
+	case BodyFault::Truncate:
+		return false;
+	case BodyFault::Stall:
+		std::this_thread::sleep_for(resp.stall);
+		ok = ok && conn.write(body + sent, length - sent);
+		sent = length;
+		break;
+	}
+	if (ok) {
+		m_bytes_sent.fetch_add(sent, std::memory_order_relaxed);
+	}
+	return ok;
+}
+
+void MockServer::setFaults(const FaultProfile &faults, uint64_t seed) {
+	std::lock_guard<std::mutex> lock(m_faults_mutex);
+	m_faults = faults;
+	m_fault_seed = seed;
+}
+
+void MockServer::injectFaults(std::mt19937_64 &rng, Response &resp) {
+	FaultProfile faults;
+	{
+		std::lock_guard<std::mutex> lock(m_faults_mutex);
+		faults = m_faults;
+	}
+	std::uniform_real_distribution<double> uniform(0, 1);
+
+	double delay = 0;
+	if (faults.latency_median_ms > 0) {
+		std::lognormal_distribution<double> lognormal(
+			std::log(faults.latency_median_ms), faults.latency_sigma);
+		delay += lognormal(rng);
+	}
+	if (faults.tail_rate > 0 && uniform(rng) < faults.tail_rate) {
+		delay += faults.tail_ms;
+		m_faults_injected.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (delay > 0) {
+		std::this_thread::sleep_for(
+			std::chrono::duration<double, std::milli>(delay));
+	}
+
+	// One draw decides between the mutually exclusive faults.
+	double draw = uniform(rng);
+	bool hasBody = !resp.headers_only &&
+				   (resp.object ? resp.length : resp.body.size()) > 0;
+	auto pick = [&](double rate) {
+		if (draw < rate) {
+			m_faults_injected.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		draw -= rate;
+		return false;
+	};
+	if (pick(faults.slowdown_rate)) {
+		resp = errorResponse(503, "SlowDown", "Please reduce your request rate.");
+	} else if (pick(faults.request_limit_rate)) {
+		resp = errorResponse(503, "RequestLimitExceeded",
+							 "Request limit exceeded.");
+	} else if (hasBody && pick(faults.reset_rate)) {
+		resp.fault = BodyFault::Reset;
+	} else if (hasBody && pick(faults.truncate_rate)) {
+		resp.fault = BodyFault::Truncate;
+	} else if (hasBody && pick(faults.stall_rate)) {
+		resp.fault = BodyFault::Stall;
+		resp.stall = std::chrono::milliseconds(
+			static_cast<int64_t>(faults.stall_ms));
+	}
+}
+
+MockServer::Response MockServer::errorResponse(int status, const char *code,
+											   const std::string &message) {
+	Response resp;
+	resp.status = status;
+	resp.headers.emplace_back("Content-Type", "application/xml");
+	resp.body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Error><Code>" +
+				std::string(code) + "</Code><Message>" + xmlEscape(message) +
+				"</Message></Error>";
+	return resp;
+}
+
+MockServer::Response MockServer::handle(const Request &req) {
+	{
+		std::lock_guard<std::mutex> lock(m_credentials_mutex);
+		auto token = req.headers.find("x-amz-security-token");
+		if (token != req.headers.end()) {
+			m_last_token = token->second;
+		}
+		auto host = req.headers.find("host");
+		m_last_host = host == req.headers.end() ? "" : host->second;
+	}
+	if (req.path == "/sts" || req.path == "/credentials") {
+		std::lock_guard<std::mutex> lock(m_credentials_mutex);
+		if (m_have_credentials) {
+			return handleCredentials(req);
+		}
+	}
+	if (signsAuthorization(req)) {
+		return errorResponse(403, "SignatureDoesNotMatch",
+							 "The request signature we calculated does not "
+							 "match the signature you provided");
+	}
+	Response wrongRegion;
+	if (!checkRegion(req, wrongRegion)) {
+		return wrongRegion;
+	}
+
+	bool hasUploadId = req.query.count("uploadId") > 0;
+	if (req.method == "GET" || req.method == "HEAD") {
+		if (req.method == "GET" && req.query.count("list-type")) {
+			return handleList(req);
+		}
+		return handleGet(req, req.method == "HEAD");
+	} else if (req.method == "PUT") {
+		if (hasUploadId && req.query.count("partNumber")) {
+			return handleUploadPart(req);
+		}
+		return handlePut(req);
+	} else if (req.method == "POST") {
+		if (req.query.count("uploads")) {
+			return handleCreateUpload(req);
+		} else if (hasUploadId) {
+			return handleCompleteUpload(req);
+		}
+	} else if (req.method == "DELETE") {
+		if (hasUploadId) {
+			return handleAbortUpload(req);
+		}
+		std::unique_lock<std::shared_mutex> lock(m_objects_mutex);
+		m_objects.erase(req.path);
+		Response resp;
+		resp.status = 204;
+		return resp;
+	}
+	return errorResponse(405, "MethodNotAllowed",
+						 "The specified method is not allowed");
+}
+
+// Whether the request's Authorization header lists itself among the signed
+// headers.  S3 computes the signature over the header it receives, so such
+// a signature can never match.
+bool MockServer::signsAuthorization(const Request &req) {
+	auto auth = req.headers.find("authorization");
+	if (auth == req.headers.end()) {
+		return false;
+	}
+	auto pos = auth->second.find("SignedHeaders=");
+	if (pos == std::string::npos) {
+		return false;
+	}
+	std::string signedHeaders = auth->second.substr(pos + 14);
+	signedHeaders = signedHeaders.substr(0, signedHeaders.find(','));
+	std::istringstream names(signedHeaders);
+	std::string name;
+	while (std::getline(names, name, ';')) {
+		if (name == "authorization") {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns false, setting `resp` to S3's answer, if the request is signed for
+// a region other than that of its bucket.  The region is the third field
+// of the credential, in the Authorization header or the query string of a
+// pre-signed URL.
+bool MockServer::checkRegion(const Request &req, Response &resp) {
+	std::string bucket = req.path.substr(1, req.path.find('/', 1) - 1);
+	std::string region;
+	{
+		std::lock_guard<std::mutex> lock(m_regions_mutex);
+		auto iter = m_bucket_regions.find(bucket);
+		if (iter == m_bucket_regions.end()) {
+			return true;
+		}
+		region = iter->second;
+	}
+	std::string credential;
+	auto auth = req.headers.find("authorization");
+	if (auth != req.headers.end()) {
+		auto pos = auth->second.find("Credential=");
+		if (pos != std::string::npos) {
+			credential = auth->second.substr(pos + 11);
+		}
+	} else if (req.query.count("X-Amz-Credential")) {
+		credential = req.query.at("X-Amz-Credential");
+	} else {
+		return true;
+	}
+	// KEY/DATE/REGION/SERVICE/aws4_request
+	std::istringstream fields(credential);
+	std::string field;
+	for (int idx = 0; idx < 3; idx++) {
+		std::getline(fields, field, '/');
+	}
+	if (field == region) {
+		return true;
+	}
+	m_wrong_region.fetch_add(1, std::memory_order_relaxed);
+	resp = errorResponse(400, "AuthorizationHeaderMalformed",
+						 "The authorization header is malformed; the region '" +
+							 field + "' is wrong; expecting '" + region + "'");
+	resp.headers.emplace_back("x-amz-bucket-region", region);
+	return false;
+}
+
+// Called with m_credentials_mutex held.
+MockServer::Response MockServer::handleCredentials(const Request &req) {
+	m_credential_requests.fetch_add(1, std::memory_order_relaxed);
+	std::string expiration =
+		isoDate(time(nullptr) + m_credentials.lifetime.count());
+	Response resp;
+	if (req.path == "/credentials") {
+		if (req.method != "GET") {
+			return errorResponse(405, "MethodNotAllowed",
+								 "The specified method is not allowed");
+		}
+		resp.headers.emplace_back("Content-Type", "application/json");
+		resp.body = "{\"AccessKeyId\": \"" + m_credentials.access_key +
+					"\", \"SecretAccessKey\": \"" +
+					m_credentials.secret_key + "\", \"Token\": \"" +
+					m_credentials.token + "\", \"Expiration\": \"" +
+					expiration + "\"}";
+		return resp;
+	}
+
+	// STS takes its parameters as a form.
+	std::map<std::string, std::string> form;
+	std::istringstream body(req.body);
+	std::string param;
+	while (std::getline(body, param, '&')) {
+		auto eq = param.find('=');
+		form[percentDecode(param.substr(0, eq))] =
+			eq == std::string::npos ? "" : percentDecode(param.substr(eq + 1));
+	}
+	if (req.method != "POST" ||
+		form["Action"] != "AssumeRoleWithWebIdentity" ||
+		form["RoleArn"].empty() || form["WebIdentityToken"].empty()) {
+		return errorResponse(400, "InvalidParameterValue",
+							 "Expected an AssumeRoleWithWebIdentity request");
+	}
+	resp.headers.emplace_back("Content-Type", "text/xml");
+	resp.body =
+		"<AssumeRoleWithWebIdentityResponse "
+		"xmlns=\"https://sts.amazonaws.com/doc/2011-06-15/\">"
+		"<AssumeRoleWithWebIdentityResult><Credentials>"
+		"<SessionToken>" +
+		xmlEscape(m_credentials.token) +
+		"</SessionToken><SecretAccessKey>" +
+		xmlEscape(m_credentials.secret_key) +
+		"</SecretAccessKey><Expiration>" + expiration +
+		"</Expiration><AccessKeyId>" + xmlEscape(m_credentials.access_key) +
+		"</AccessKeyId></Credentials></AssumeRoleWithWebIdentityResult>"
+		"</AssumeRoleWithWebIdentityResponse>";
+	return resp;
+}
+
+MockServer::Response MockServer::handleGet(const Request &req, bool headOnly) {
+	std::shared_ptr<const Object> obj;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_objects_mutex);
+		auto iter = m_objects.find(req.path);
+		if (iter != m_objects.end()) {
+			obj = iter->second;
+		}
+	}
+	if (!obj) {
+		Response resp =
+			errorResponse(404, "NoSuchKey", "The specified key does not exist.");
+		resp.headers_only = headOnly;
+		return resp;
+	}
+
+	Response resp;
+	resp.headers.emplace_back("Last-Modified", httpDate(obj->mtime));
+	resp.headers.emplace_back("ETag", obj->etag);
+	resp.headers.emplace_back("Accept-Ranges", "bytes");
+	resp.headers.emplace_back("Content-Type", "application/octet-stream");
+	resp.object = obj;
+	resp.offset = 0;
+	resp.length = obj->data.size();
+	resp.headers_only = headOnly;
+
+	auto range = req.headers.find("range");
+	if (range != req.headers.end()) {
+		size_t offset, length;
+		if (!parseRange(range->second, obj->data.size(), offset, length)) {
+			Response err = errorResponse(
+				416, "InvalidRange", "The requested range is not satisfiable");
+			err.headers.emplace_back("Content-Range",
+									 "bytes */" +
+										 std::to_string(obj->data.size()));
+			err.headers_only = headOnly;
+			return err;
+		}
+		resp.status = 206;
+		resp.offset = offset;
+		resp.length = length;
+		resp.headers.emplace_back(
+			"Content-Range", "bytes " + std::to_string(offset) + "-" +
+								 std::to_string(offset + length - 1) + "/" +
+								 std::to_string(obj->data.size()));
+	}
+	return resp;
+}
+
+MockServer::Response MockServer::handlePut(const Request &req) {
+	// Like S3, a PUT replaces the whole object; any Range header is ignored.
+	std::string etag = makeETag(req.body);
+	putObject(req.path, req.body);
+	Response resp;
+	resp.headers.emplace_back("ETag", etag);
+	return resp;
+}
+
+MockServer::Response MockServer::handleList(const Request &req) {
+	std::string bucket = req.path;
+	while (bucket.size() > 1 && bucket.back() == '/') {
+		bucket.pop_back();
+	}
+	auto param = [&](const char *name) {
+		auto iter = req.query.find(name);
+		return iter == req.query.end() ? std::string() : iter->second;
+	};
+	std::string prefix = param("prefix");
+	std::string delimiter = param("delimiter");
+	std::string after = param("continuation-token");
+	if (after.empty()) {
+		after = param("start-after");
+	}
+	size_t maxKeys = 1000;
+	if (!param("max-keys").empty()) {
+		maxKeys = strtoull(param("max-keys").c_str(), nullptr, 10);
+	}
+
+	std::string base = bucket + "/";
+	std::string start = base + prefix;
+	std::ostringstream contents;
+	std::vector<std::string> commonPrefixes;
+	size_t count = 0;
+	bool truncated = false;
+	std::string lastKey;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_objects_mutex);
+		auto iter = after.empty() ? m_objects.lower_bound(start)
+								  : m_objects.upper_bound(base + after);
+		for (; iter != m_objects.end(); ++iter) {
+			if (iter->first.compare(0, start.size(), start) != 0) {
+				break;
+			}
+			std::string key = iter->first.substr(base.size());
+			if (count == maxKeys) {
+				truncated = true;
+				break;
+			}
+			if (!delimiter.empty()) {
+				auto pos = key.find(delimiter, prefix.size());
+				if (pos != std::string::npos) {
+					std::string common = key.substr(0, pos + delimiter.size());
+					if (commonPrefixes.empty() ||
+						commonPrefixes.back() != common) {
+						commonPrefixes.push_back(common);
+						count++;
+					}
+					lastKey = key;
+					continue;
+				}
+			}
+			const Object &obj = *iter->second;
+			contents << "<Contents><Key>" << xmlEscape(key)
+					 << "</Key><LastModified>" << isoDate(obj.mtime)
+					 << "</LastModified><ETag>" << xmlEscape(obj.etag)
+					 << "</ETag><Size>" << obj.data.size()
+					 << "</Size><StorageClass>STANDARD</StorageClass>"
+						"</Contents>";
+			lastKey = key;
+			count++;
+		}
+	}
+
+	std::ostringstream body;
+	body << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		 << "<ListBucketResult "
+			"xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\"><Name>"
+		 << xmlEscape(bucket.substr(1)) << "</Name><Prefix>"
+		 << xmlEscape(prefix) << "</Prefix><KeyCount>" << count
+		 << "</KeyCount><MaxKeys>" << maxKeys << "</MaxKeys>";
+	if (!delimiter.empty()) {
+		body << "<Delimiter>" << xmlEscape(delimiter) << "</Delimiter>";
+	}
+	body << "<IsTruncated>" << (truncated ? "true" : "false")
+		 << "</IsTruncated>";
+	if (truncated) {
+		body << "<NextContinuationToken>" << xmlEscape(lastKey)
+			 << "</NextContinuationToken>";
+	}
+	body << contents.str();
+	for (const auto &common : commonPrefixes) {
+		body << "<CommonPrefixes><Prefix>" << xmlEscape(common)
+			 << "</Prefix></CommonPrefixes>";
+	}
+	body << "</ListBucketResult>";
+
+	Response resp;
+	resp.headers.emplace_back("Content-Type", "application/xml");
+	resp.body = body.str();
+	return resp;
+}
+
+MockServer::Response MockServer::handleCreateUpload(const Request &req) {
+	std::string id;
+	{
+		std::lock_guard<std::mutex> lock(m_uploads_mutex);
+		id = "upload-" + std::to_string(++m_next_upload);
+		m_uploads[id].path = req.path;
+	}
+	std::string bucket, key;
+	splitPath(req.path, bucket, key);
+
+	Response resp;
+	resp.headers.emplace_back("Content-Type", "application/xml");
+	resp.body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+				"<InitiateMultipartUploadResult><Bucket>" +
+				xmlEscape(bucket) + "</Bucket><Key>" + xmlEscape(key) +
+				"</Key><UploadId>" + id +
+				"</UploadId></InitiateMultipartUploadResult>";
+	return resp;
+}
+
+MockServer::Response MockServer::handleUploadPart(const Request &req) {
+	int part = atoi(req.query.at("partNumber").c_str());
+	if (part < 1 || part > 10000) {
+		return errorResponse(400, "InvalidArgument",
+							 "Part number must be between 1 and 10000");
+	}
+	std::lock_guard<std::mutex> lock(m_uploads_mutex);
+	auto iter = m_uploads.find(req.query.at("uploadId"));
+	if (iter == m_uploads.end() || iter->second.path != req.path) {
+		return errorResponse(404, "NoSuchUpload",
+							 "The specified upload does not exist.");
+	}
+	iter->second.parts[part] = req.body;
+	Response resp;
+	resp.headers.emplace_back("ETag", makeETag(req.body));
+	return resp;
+}
+
+MockServer::Response MockServer::handleCompleteUpload(const Request &req) {
+	Upload upload;
+	{
+		std::lock_guard<std::mutex> lock(m_uploads_mutex);
+		auto iter = m_uploads.find(req.query.at("uploadId"));
+		if (iter == m_uploads.end() || iter->second.path != req.path) {
+			return errorResponse(404, "NoSuchUpload",
+								 "The specified upload does not exist.");
+		}
+		upload = std::move(iter->second);
+		m_uploads.erase(iter);
+	}
+
+	// Assemble the parts listed in the request body, in the order given.
+	std::string data;
+	size_t pos = 0;
+	static const std::string open = "<PartNumber>";
+	while ((pos = req.body.find(open, pos)) != std::string::npos) {
+		pos += open.size();
+		int part = atoi(req.body.c_str() + pos);
+		auto iter = upload.parts.find(part);
+		if (iter == upload.parts.end()) {
+			return errorResponse(400, "InvalidPart",
+								 "One or more of the specified parts could "
+								 "not be found.");
+		}
+		data += iter->second;
+	}
+	std::string etag = makeETag(data);
+	putObject(req.path, std::move(data));
+	std::string bucket, key;
+	splitPath(req.path, bucket, key);
+
+	Response resp;
+	resp.headers.emplace_back("Content-Type", "application/xml");
+	resp.body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+				"<CompleteMultipartUploadResult><Bucket>" +
+				xmlEscape(bucket) + "</Bucket><Key>" + xmlEscape(key) +
+				"</Key><ETag>" + xmlEscape(etag) +
+				"</ETag></CompleteMultipartUploadResult>";
+	return resp;
+}
+
+MockServer::Response MockServer::handleAbortUpload(const Request &req) {
+	std::lock_guard<std::mutex> lock(m_uploads_mutex);
+	m_uploads.erase(req.query.at("uploadId"));
+	Response resp;
+	resp.status = 204;
+	return resp;
+}
@@ -0,0 +1,269 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+// Misbehaviour a MockServer injects on purpose, to measure how the plugin
+// copes with a slow or failing backend.  Rates are per-request
+// probabilities.  At most one of the error and body faults applies to any
+// request; the body faults only affect responses that have a body.
+struct FaultProfile {
+	// Delay before every response, drawn from a lognormal distribution
+	// with this median and shape; 0 disables it.
+	double latency_median_ms{0};
+	double latency_sigma{0};
+	// With probability tail_rate, a further tail_ms of delay.
+	double tail_rate{0};
+	double tail_ms{0};
+
+	double slowdown_rate{0};	  // 503 with an S3 SlowDown error
+	double request_limit_rate{0}; // 503 with RequestLimitExceeded
+	double reset_rate{0};		  // reset the connection mid-body
+	double truncate_rate{0};	  // close the connection mid-body
+	double stall_rate{0};		  // pause for stall_ms mid-body
+	double stall_ms{0};
+
+	// Parse a comma-separated list of presets and settings, e.g.
+	// "longtail,slowdown=0.01".  The presets are none, lognormal, longtail,
+	// throttle, slowdown, flaky and stall; the settings are
+	// latency=MEDIAN_MS:SIGMA, tail=RATE:MS, slowdown=RATE, limit=RATE,
+	// reset=RATE, truncate=RATE and stall=RATE:MS.
+	static bool parse(const std::string &spec, FaultProfile &profile,
+					  std::string &err);
+};
+
+// An in-memory S3 / plain HTTP server for benchmarks and tests.  It listens
+// on an ephemeral port on the loopback interface only, and optionally on a
+// Unix domain socket as well, and serves a flat
+// object store keyed by URL path, so "/bucket/key" is both the path-style S3
+// URL of `key` in `bucket` and a plain HTTP URL.  It understands:
+//
+//   GET (with or without a single Range), HEAD, PUT and DELETE of objects;
+//   ListObjectsV2 (GET /bucket?list-type=2, with prefix, delimiter,
+//     max-keys, start-after and continuation-token);
+//   multipart uploads (POST ?uploads, PUT ?partNumber=N&uploadId=U,
+//     POST ?uploadId=U, DELETE ?uploadId=U);
+//   stand-ins for credential services once setCredentials() is called: STS
+//     AssumeRoleWithWebIdentity (POST /sts) and a container metadata
+//     endpoint (GET /credentials).
+//
+// Request signatures are not checked, beyond rejecting an Authorization
+// header that signs itself, but the region they are for is when
+// setBucketRegion() has placed a bucket in a region.  Each connection is
+// served by its own thread and HTTP/1.1 keep-alive is honoured.  Writes to a peer that has gone
+// away can raise SIGPIPE, so users should ignore that signal.
+class MockServer {
+  public:
+	MockServer() {}
+	~MockServer();
+
+	MockServer(const MockServer &) = delete;
+	MockServer &operator=(const MockServer &) = delete;
+
+	// Start listening.  With `tls`, a self-signed CA certificate for
+	// 127.0.0.1 and localhost is generated and written to caFile(), which
+	// clients must trust (for this plugin, via X509_CERT_FILE).  Returns
+	// false and sets `err` on failure.
+	bool Start(bool tls, std::string &err);
+	void Stop();
+
+	// Also accept plain HTTP (never TLS) connections on a Unix domain
+	// socket created at `path`, which Stop() removes.  Call after Start().
+	bool ListenUnix(const std::string &path, std::string &err);
+
+	// Base URL of the server, e.g. "https://127.0.0.1:40123".
+	std::string url() const;
+	const std::string &caFile() const { return m_ca_file; }
+
+	// Inject `faults` into all later responses.  The random choices are
+	// seeded from `seed` and the connection number, so a run with the same
+	// connection pattern sees the same faults.
+	void setFaults(const FaultProfile &faults, uint64_t seed = 1);
+
+	void putObject(const std::string &path, std::string data);
+	bool getObject(const std::string &path, std::string &data) const;
+
+	// The temporary credentials the credential stand-ins hand out, each
+	// set expiring `lifetime` after it is requested.
+	struct Credentials {
+		std::string access_key;
+		std::string secret_key;
+		std::string token;
+		std::chrono::seconds lifetime{3600};
+	};
+	void setCredentials(const Credentials &credentials);
+	uint64_t credentialRequests() const {
+		return m_credential_requests.load(std::memory_order_relaxed);
+	}
+	// The X-Amz-Security-Token header of the latest request that had one.
+	std::string lastSecurityToken() const;
+	// The Host header of the latest request.
+	std::string lastHost() const;
+
+	// Refuse signed requests for objects under /`bucket`/ unless they are
+	// signed for `region`, the way S3 does: with a 400 whose
+	// x-amz-bucket-region header names the right region.
+	void setBucketRegion(const std::string &bucket, const std::string &region);
+	uint64_t wrongRegionRequests() const {
+		return m_wrong_region.load(std::memory_order_relaxed);
+	}
+
+	uint64_t requests() const {
+		return m_requests.load(std::memory_order_relaxed);
+	}
+	uint64_t bytesSent() const {
+		return m_bytes_sent.load(std::memory_order_relaxed);
+	}
+	uint64_t connections() const {
+		return m_connections.load(std::memory_order_relaxed);
+	}
+	uint64_t faultsInjected() const {
+		return m_faults_injected.load(std::memory_order_relaxed);
+	}
+	// CPU time used by connections that have closed; call after Stop() to
+	// cover them all.
+	double cpuSeconds() const {
+		return m_cpu_ns.load(std::memory_order_relaxed) / 1e9;
+	}
+
+  private:
+	struct Object {
+		std::string data;
+		std::string etag;
+		time_t mtime;
+	};
+
+	struct Request {
+		std::string method;
+		std::string path;
+		std::map<std::string, std::string> query;
+		// Header names are lower-cased.
+		std::map<std::string, std::string> headers;
+		std::string body;
+	};
+
+	enum class BodyFault { None, Reset, Truncate, Stall };
+
+	struct Response {
+		int status{200};
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::string body;
+		// For object reads: send `length` bytes of `object` at `offset`
+		// instead of `body`, without copying them.
+		std::shared_ptr<const Object> object;
+		size_t offset{0};
+		size_t length{0};
+		// Send the headers only, as for HEAD.
+		bool headers_only{false};
+		// Misbehave halfway through sending the body.
+		BodyFault fault{BodyFault::None};
+		std::chrono::milliseconds stall{0};
+	};
+
+	class Connection;
+
+	void acceptLoop(int listenFd, bool tls);
+	void serveConnection(int fd, uint64_t id, bool tls);
+	bool readRequest(Connection &conn, std::string &buffer, Request &req,
+					 bool &keepAlive);
+	bool sendResponse(Connection &conn, const Request &req,
+					  const Response &resp, bool keepAlive);
+
+	Response handle(const Request &req);
+	void injectFaults(std::mt19937_64 &rng, Response &resp);
+	Response handleGet(const Request &req, bool headOnly);
+	Response handlePut(const Request &req);
+	Response handleList(const Request &req);
+	Response handleCreateUpload(const Request &req);
+	Response handleUploadPart(const Request &req);
+	Response handleCompleteUpload(const Request &req);
+	Response handleAbortUpload(const Request &req);
+	Response handleCredentials(const Request &req);
+	static bool signsAuthorization(const Request &req);
+	bool checkRegion(const Request &req, Response &resp);
+	static Response errorResponse(int status, const char *code,
+								  const std::string &message);
+
+	bool setupTLS(std::string &err);
+
+	int m_listen_fd{-1};
+	int m_port{0};
+	SSL_CTX *m_ssl_ctx{nullptr};
+	std::string m_ca_file;
+
+	mutable std::shared_mutex m_objects_mutex;
+	std::map<std::string, std::shared_ptr<const Object>> m_objects;
+
+	struct Upload {
+		std::string path;
+		std::map<int, std::string> parts;
+	};
+	std::mutex m_uploads_mutex;
+	std::map<std::string, Upload> m_uploads;
+	uint64_t m_next_upload{0};
+
+	mutable std::mutex m_credentials_mutex;
+	bool m_have_credentials{false};
+	Credentials m_credentials;
+	std::string m_last_token;
+	std::string m_last_host;
+	std::atomic<uint64_t> m_credential_requests{0};
+
+	mutable std::mutex m_regions_mutex;
+	std::map<std::string, std::string> m_bucket_regions;
+	std::atomic<uint64_t> m_wrong_region{0};
+
+	std::atomic<uint64_t> m_requests{0};
+	std::atomic<uint64_t> m_bytes_sent{0};
+	std::atomic<uint64_t> m_connections{0};
+	std::atomic<uint64_t> m_faults_injected{0};
+	std::atomic<uint64_t> m_cpu_ns{0};
+
+	std::mutex m_faults_mutex;
+	FaultProfile m_faults;
+	uint64_t m_fault_seed{1};
+
+	// Connection threads are detached; Stop() shuts down their sockets and
+	// waits for m_active to drop to zero.
+	std::thread m_acceptor;
+	int m_unix_fd{-1};
+	std::string m_unix_path;
+	std::thread m_unix_acceptor;
+	std::mutex m_conn_mutex;
+	std::condition_variable m_conn_cv;
+	std::set<int> m_conn_fds;
+	unsigned m_active{0};
+	bool m_stopping{false};
+};
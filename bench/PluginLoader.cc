@@ -0,0 +1,62 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "Bench.hh"
+
+#include <XrdOss/XrdOss.hh>
+#include <XrdOuc/XrdOucEnv.hh>
+
+#include <cstdio>
+
+#include <dlfcn.h>
+
+namespace {
+
+typedef XrdOss *(*GetStorageSystem2)(XrdOss *, XrdSysLogger *, const char *,
+									 const char *, XrdOucEnv *);
+
+} // namespace
+
+// Load the plugin the way xrootd does: through the exported
+// XrdOssGetStorageSystem2 of the built shared library, so the benchmark
+// covers exactly what ships.  The library stays loaded until exit.
+std::unique_ptr<XrdOss> benchCreateFileSystem(XrdSysLogger *logger,
+											  const std::string &cfgfile,
+											  const BenchOptions &opts) {
+	void *handle = dlopen(opts.plugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		fprintf(stderr, "Failed to load %s: %s\n", opts.plugin.c_str(),
+				dlerror());
+		return nullptr;
+	}
+	auto getStorageSystem = reinterpret_cast<GetStorageSystem2>(
+		dlsym(handle, "XrdOssGetStorageSystem2"));
+	if (!getStorageSystem) {
+		fprintf(stderr, "%s does not export XrdOssGetStorageSystem2\n",
+				opts.plugin.c_str());
+		return nullptr;
+	}
+	static XrdOucEnv env;
+	XrdOss *fs = getStorageSystem(nullptr, logger, cfgfile.c_str(), nullptr,
+								  &env);
+	if (!fs) {
+		fprintf(stderr, "%s failed to initialize from %s\n",
+				opts.plugin.c_str(), cfgfile.c_str());
+	}
+	return std::unique_ptr<XrdOss>(fs);
+}
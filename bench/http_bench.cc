@@ -0,0 +1,37 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "Bench.hh"
+#include "../src/HTTPFileSystem.hh"
+
+#include <cstdio>
+#include <stdexcept>
+
+std::unique_ptr<XrdOss> benchCreateFileSystem(XrdSysLogger *logger,
+											  const std::string &cfgfile,
+											  const BenchOptions &opts) {
+	try {
+		return std::unique_ptr<XrdOss>(
+			new HTTPFileSystem(logger, cfgfile.c_str(), nullptr));
+	} catch (std::runtime_error &exc) {
+		fprintf(stderr, "%s\n", exc.what());
+		return nullptr;
+	}
+}
+
+int main(int argc, char *argv[]) { return benchMain(argc, argv, "http"); }
@@ -0,0 +1,300 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+// Microbenchmarks for the CPU spent on each request before it reaches the
+// network: encoding, signing and path lookup.  Keep the inputs close to what
+// production requests look like so the numbers can serve as baselines.
+
+#include "../src/AWSv4-impl.hh"
+#include "../src/S3Commands.hh"
+#include "../src/S3File.hh"
+#include "../src/S3FileSystem.hh"
+#include "../src/stl_string_utils.hh"
+
+#include <XrdSys/XrdSysError.hh>
+#include <XrdSys/XrdSysLogger.hh>
+
+#include <benchmark/benchmark.h>
+#include <openssl/evp.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+// An object key of roughly `length` bytes in the shape of a physics data
+// path: several directories, digits, dashes and a dotted suffix.
+std::string objectKey(size_t length) {
+	std::string key = "data/run2024B/";
+	while (key.size() + 24 < length) {
+		key += "dataset-" + std::to_string(key.size()) + "/";
+	}
+	key += "file_000123-v2.root";
+	return key;
+}
+
+// As above, plus characters that must be percent-encoded.
+std::string awkwardKey(size_t length) {
+	std::string key = objectKey(length);
+	for (size_t idx = 5; idx < key.size(); idx += 11) {
+		key[idx] = idx % 2 ? ' ' : '+';
+	}
+	return key;
+}
+
+// A scratch directory with credential files, removed at exit.
+class Scratch {
+  public:
+	Scratch() {
+		char dir[] = "/tmp/xrdhttp-microbench-XXXXXX";
+		if (!mkdtemp(dir)) {
+			perror("mkdtemp");
+			abort();
+		}
+		m_dir = dir;
+		m_access_key = write("access_key", "AKIDEXAMPLE");
+		m_secret_key =
+			write("secret_key", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY");
+	}
+	~Scratch() {
+		for (const auto &file : m_files) {
+			unlink(file.c_str());
+		}
+		rmdir(m_dir.c_str());
+	}
+
+	std::string write(const std::string &name, const std::string &contents) {
+		std::string path = m_dir + "/" + name;
+		std::ofstream(path) << contents;
+		m_files.push_back(path);
+		return path;
+	}
+
+	const std::string &accessKey() const { return m_access_key; }
+	const std::string &secretKey() const { return m_secret_key; }
+
+  private:
+	std::string m_dir;
+	std::string m_access_key;
+	std::string m_secret_key;
+	std::vector<std::string> m_files;
+};
+
+Scratch &scratch() {
+	static Scratch dir;
+	return dir;
+}
+
+XrdSysError &log() {
+	static XrdSysLogger logger;
+	static XrdSysError err(&logger, "microbench_");
+	return err;
+}
+
+// A download request that can be signed repeatedly, the way a retried
+// request is.
+class SigningRequest : public AmazonS3Download {
+  public:
+	SigningRequest(const std::string &key, int extraHeaders)
+		: AmazonS3Download("https://s3.us-east-1.example.com",
+						   scratch().accessKey(), scratch().secretKey(),
+						   "bucket", key, "path", log()) {
+		httpVerb = "GET";
+		m_uri = canonicalURI;
+		if (extraHeaders > 0) {
+			headers["Range"] = "bytes=1048576-2097151";
+		}
+		if (extraHeaders > 1) {
+			headers["Content-Type"] = "binary/octet-stream";
+		}
+		if (extraHeaders > 2) {
+			headers["User-Agent"] = "xrootd-s3-http/0.1  (linux)";
+		}
+		if (extraHeaders > 3) {
+			headers["X-Amz-Security-Token"] = std::string(400, 'T');
+		}
+	}
+
+	bool sign(std::string &authorization) {
+		// Signing encodes canonicalURI in place.
+		canonicalURI = m_uri;
+		return createV4Signature("", authorization);
+	}
+
+  private:
+	std::string m_uri;
+};
+
+void BM_PathEncode(benchmark::State &state) {
+	std::string key = "/bucket/" + objectKey(state.range(0));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(AWSv4Impl::pathEncode(key));
+	}
+	state.SetBytesProcessed(state.iterations() * key.size());
+}
+BENCHMARK(BM_PathEncode)->Arg(32)->Arg(128)->Arg(512);
+
+void BM_AmazonURLEncode(benchmark::State &state) {
+	std::string key = awkwardKey(state.range(0));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(AWSv4Impl::amazonURLEncode(key));
+	}
+	state.SetBytesProcessed(state.iterations() * key.size());
+}
+BENCHMARK(BM_AmazonURLEncode)->Arg(32)->Arg(128)->Arg(512);
+
+void BM_LowercaseHex(benchmark::State &state) {
+	unsigned char digest[32];
+	for (unsigned idx = 0; idx < sizeof(digest); idx++) {
+		digest[idx] = idx * 37;
+	}
+	std::string hex;
+	for (auto _ : state) {
+		AWSv4Impl::convertMessageDigestToLowercaseHex(digest, sizeof(digest),
+													  hex);
+		benchmark::DoNotOptimize(hex);
+	}
+}
+BENCHMARK(BM_LowercaseHex);
+
+void BM_CanonicalizeQueryString(benchmark::State &state) {
+	// A ListObjectsV2 page request.
+	std::map<std::string, std::string> query{
+		{"list-type", "2"},
+		{"prefix", objectKey(64)},
+		{"delimiter", "/"},
+		{"continuation-token", std::string(120, 'c')},
+	};
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(AWSv4Impl::canonicalizeQueryString(query));
+	}
+}
+BENCHMARK(BM_CanonicalizeQueryString);
+
+void BM_Sha256(benchmark::State &state) {
+	std::string payload(state.range(0), 'p');
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int length;
+	for (auto _ : state) {
+		AWSv4Impl::doSha256(payload, digest, &length);
+		benchmark::DoNotOptimize(digest);
+	}
+	state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_Sha256)->Arg(0)->Arg(512)->Arg(64 << 10);
+
+// The whole of SigV4 for a GET: reading the credentials, canonicalizing the
+// headers, two SHA-256s and the HMAC chain.  Arguments are the key length
+// and how many headers beyond Host and X-Amz-Date are signed.
+void BM_CreateV4Signature(benchmark::State &state) {
+	SigningRequest req(objectKey(state.range(0)), state.range(1));
+	std::string authorization;
+	for (auto _ : state) {
+		if (!req.sign(authorization)) {
+			state.SkipWithError("signing failed");
+			break;
+		}
+		benchmark::DoNotOptimize(authorization);
+	}
+}
+BENCHMARK(BM_CreateV4Signature)
+	->ArgNames({"key", "headers"})
+	->Args({32, 0})
+	->Args({128, 2})
+	->Args({128, 4})
+	->Args({512, 4});
+
+// A filesystem with `exports` exports, /export0/data and so on; kept for the
+// life of the process since the benchmark runs several times.
+S3FileSystem *exportingFileSystem(int exports, std::string &err) {
+	// Declared first so it outlives the filesystems.
+	static XrdSysLogger logger;
+	static std::map<int, std::unique_ptr<S3FileSystem>> filesystems;
+	auto &fs = filesystems[exports];
+	if (fs) {
+		return fs.get();
+	}
+	std::string config;
+	for (int idx = 0; idx < exports; idx++) {
+		std::string name = std::to_string(idx);
+		config += "s3.begin\n"
+				  "s3.path_name /export" +
+				  name +
+				  "/data\n"
+				  "s3.bucket_name bucket" +
+				  name +
+				  "\n"
+				  "s3.service_name s3.example.com\n"
+				  "s3.region us-east-1\n"
+				  "s3.service_url https://s3.us-east-1.example.com\n"
+				  "s3.end\n";
+	}
+	config += "s3.url_style path\n";
+	std::string cfgfile =
+		scratch().write("exports_" + std::to_string(exports) + ".cfg", config);
+	try {
+		fs.reset(new S3FileSystem(&logger, cfgfile.c_str(), nullptr));
+	} catch (std::exception &exc) {
+		err = exc.what();
+	}
+	return fs.get();
+}
+
+// Looking up the export for a path among `range(0)` configured exports.
+void BM_ParsePath(benchmark::State &state) {
+	std::string err;
+	S3FileSystem *fs = exportingFileSystem(state.range(0), err);
+	if (!fs) {
+		state.SkipWithError(err.c_str());
+		return;
+	}
+
+	// The last export configured, so a linear search would be worst case.
+	std::string path = "/export" + std::to_string(state.range(0) - 1) +
+					   "/data/" + objectKey(96);
+	const S3AccessInfo *info = nullptr;
+	std::string_view object;
+	for (auto _ : state) {
+		int rv = parse_path(*fs, path.c_str(), info, object);
+		benchmark::DoNotOptimize(rv);
+		benchmark::DoNotOptimize(object);
+	}
+}
+BENCHMARK(BM_ParsePath)->Arg(1)->Arg(16)->Arg(128);
+
+// formatstr as the request paths use it, e.g. for a Range header.
+void BM_Formatstr(benchmark::State &state) {
+	std::string range;
+	for (auto _ : state) {
+		formatstr(range, "bytes=%lld-%lld", 1073741824ll, 1077936127ll);
+		benchmark::DoNotOptimize(range);
+	}
+}
+BENCHMARK(BM_Formatstr);
+
+} // namespace
+
+BENCHMARK_MAIN();
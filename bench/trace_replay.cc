@@ -0,0 +1,612 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+// Replays an access log (see src/AccessLog.hh) against one of the plugins,
+// either backed by an in-process MockServer holding objects shaped like the
+// ones in the trace, or configured for a real endpoint.  Each thread in the
+// trace gets a replay thread that issues that thread's operations in order,
+// at the recorded times scaled by --speed.
+
+#include "../src/AccessLog.hh"
+#include "Bench.hh"
+#include "MockServer.hh"
+
+#include <XrdOss/XrdOss.hh>
+#include <XrdOuc/XrdOucEnv.hh>
+#include <XrdSys/XrdSysLogger.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const unsigned g_num_ops = static_cast<unsigned>(AccessOp::Close) + 1;
+
+struct ReplayOptions {
+	std::string trace;
+	bool dump{false};
+	std::string config; // replay against this configuration, not the mock
+	double speed{1};	// 0 replays as fast as possible
+	bool skip_writes{false};
+	bool json{false};
+	BenchOptions bench; // backend, plugin, tls, sign, faults and seed
+};
+
+// One operation to replay, with the path the plugin should see.
+struct ReplayOp {
+	AccessRecord rec;
+	std::string path;
+	int flags{0}; // for opens
+};
+
+struct OpResult {
+	uint64_t ops{0};
+	uint64_t errors{0};
+	// The replay failed where the recording succeeded or vice versa, or a
+	// read returned a different number of bytes.
+	uint64_t diverged{0};
+	uint64_t skipped{0};
+	uint64_t bytes{0};
+	std::vector<uint64_t> latency_ns;
+	std::vector<uint64_t> recorded_ns;
+};
+
+struct ThreadResult {
+	OpResult ops[g_num_ops];
+	uint64_t max_lag_ns{0};
+};
+
+const char *opName(uint8_t op) {
+	switch (static_cast<AccessOp>(op)) {
+	case AccessOp::Open:
+		return "open";
+	case AccessOp::Read:
+		return "read";
+	case AccessOp::Write:
+		return "write";
+	case AccessOp::Stat:
+		return "stat";
+	case AccessOp::Close:
+		return "close";
+	}
+	return "unknown";
+}
+
+void usage(const char *prog) {
+	fprintf(stderr,
+			"Usage: %s --trace FILE --dump\n"
+			"       %s --trace FILE --backend s3|http --plugin PATH "
+			"[options]\n"
+			"  --trace FILE              access log to replay\n"
+			"  --dump                    print the trace as text and exit\n"
+			"  --backend s3|http         which plugin --plugin is (s3)\n"
+			"  --plugin PATH             the plugin library to load\n"
+			"  --config FILE             replay against the endpoint in this\n"
+			"                            plugin configuration instead of a\n"
+			"                            mock server\n"
+			"  --speed X                 replay X times faster than recorded;\n"
+			"                            0 for as fast as possible (1)\n"
+			"  --skip-writes             do not replay writes\n"
+			"  --tls                     serve the mock over https\n"
+			"  --no-sign                 S3 only: send unsigned requests\n"
+			"  --faults SPEC             make the mock server misbehave\n"
+			"  --seed N                  seed for the injected faults (1)\n"
+			"  --json                    print the report as JSON\n",
+			prog, prog);
+}
+
+bool parseArgs(int argc, char *argv[], ReplayOptions &opts) {
+	for (int idx = 1; idx < argc; idx++) {
+		std::string arg = argv[idx];
+		const char *value = idx + 1 < argc ? argv[idx + 1] : nullptr;
+		bool needsValue = true;
+		if (arg == "--dump") {
+			opts.dump = true;
+			needsValue = false;
+		} else if (arg == "--skip-writes") {
+			opts.skip_writes = true;
+			needsValue = false;
+		} else if (arg == "--tls") {
+			opts.bench.tls = true;
+			needsValue = false;
+		} else if (arg == "--no-sign") {
+			opts.bench.sign = false;
+			needsValue = false;
+		} else if (arg == "--json") {
+			opts.json = true;
+			needsValue = false;
+		} else if (!value) {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		} else if (arg == "--trace") {
+			opts.trace = value;
+		} else if (arg == "--backend") {
+			opts.bench.backend = value;
+		} else if (arg == "--plugin") {
+			opts.bench.plugin = value;
+		} else if (arg == "--config") {
+			opts.config = value;
+		} else if (arg == "--speed") {
+			opts.speed = atof(value);
+		} else if (arg == "--faults") {
+			opts.bench.faults = value;
+		} else if (arg == "--seed") {
+			opts.bench.seed = strtoull(value, nullptr, 10);
+		} else {
+			fprintf(stderr, "Invalid option: %s %s\n", arg.c_str(), value);
+			return false;
+		}
+		if (needsValue) {
+			idx++;
+		}
+	}
+	if (opts.trace.empty()) {
+		fprintf(stderr, "--trace is required\n");
+		return false;
+	}
+	if (opts.dump) {
+		return true;
+	}
+	if (opts.bench.backend != "s3" && opts.bench.backend != "http") {
+		fprintf(stderr, "Unknown backend: %s\n", opts.bench.backend.c_str());
+		return false;
+	}
+	if (opts.bench.plugin.empty()) {
+		fprintf(stderr, "--plugin is required\n");
+		return false;
+	}
+	if (opts.speed < 0) {
+		fprintf(stderr, "--speed must not be negative\n");
+		return false;
+	}
+	return true;
+}
+
+// Read every record in the access log at `path`, in time order.
+bool readTrace(const std::string &path, std::vector<AccessRecord> &records,
+			   std::string &err) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		err = "cannot open " + path;
+		return false;
+	}
+	char header[16];
+	if (!in.read(header, sizeof(header)) || memcmp(header, "XRDHTAL1", 8)) {
+		err = path + " is not an access log";
+		return false;
+	}
+	uint32_t recordSize;
+	memcpy(&recordSize, header + 8, sizeof(recordSize));
+	if (__builtin_bswap32(recordSize) == sizeof(AccessRecord)) {
+		err = path + " was written on a host of the other byte order";
+		return false;
+	}
+	if (recordSize < sizeof(AccessRecord) || recordSize > 4096) {
+		err = "unsupported record size " + std::to_string(recordSize);
+		return false;
+	}
+	// Later versions may append fields to each record; skip them.
+	std::vector<char> buffer(recordSize);
+	while (in.read(buffer.data(), buffer.size())) {
+		AccessRecord rec;
+		memcpy(&rec, buffer.data(), sizeof(rec));
+		records.push_back(rec);
+	}
+	if (in.gcount() != 0) {
+		fprintf(stderr, "Ignoring a partial record at the end of %s\n",
+				path.c_str());
+	}
+	std::stable_sort(records.begin(), records.end(),
+					 [](const AccessRecord &left, const AccessRecord &right) {
+						 return left.timestamp_ns < right.timestamp_ns;
+					 });
+	return true;
+}
+
+// The recorded path; if it was longer than the record holds, this is only
+// its tail.
+std::string recordPath(const AccessRecord &rec) {
+	std::string path(rec.path, std::min<size_t>(rec.path_len,
+												sizeof(rec.path)));
+	if (path.empty() || path[0] != '/') {
+		path = "/" + path;
+	}
+	return path;
+}
+
+void dumpTrace(const std::vector<AccessRecord> &records) {
+	printf("%12s %6s %-5s %12s %10s %10s %10s  %s\n", "time_s", "thread",
+		   "op", "offset", "length", "result", "latency_us", "path");
+	for (const auto &rec : records) {
+		printf("%12.6f %6u %-5s %12" PRId64 " %10" PRIu64 " %10" PRId64
+			   " %10u  %s\n",
+			   (rec.timestamp_ns - records.front().timestamp_ns) / 1e9,
+			   rec.thread, opName(rec.op), rec.offset, rec.length, rec.result,
+			   rec.latency_us, recordPath(rec).c_str());
+	}
+}
+
+// Split the trace by recorded thread, and decide how each open should be
+// made: the log does not record open flags, so a handle that is written
+// before it is closed (or reopened) is opened for writing.
+std::map<uint32_t, std::vector<ReplayOp>>
+planReplay(const std::vector<AccessRecord> &records,
+		   const std::string &prefix) {
+	std::map<uint32_t, std::vector<ReplayOp>> plan;
+	for (const auto &rec : records) {
+		ReplayOp op;
+		op.rec = rec;
+		op.path = prefix + recordPath(rec);
+		plan[rec.thread].push_back(std::move(op));
+	}
+	for (auto &entry : plan) {
+		auto &ops = entry.second;
+		for (size_t idx = 0; idx < ops.size(); idx++) {
+			if (ops[idx].rec.op != static_cast<uint8_t>(AccessOp::Open)) {
+				continue;
+			}
+			for (size_t next = idx + 1; next < ops.size(); next++) {
+				if (ops[next].path != ops[idx].path) {
+					continue;
+				}
+				auto op = static_cast<AccessOp>(ops[next].rec.op);
+				if (op == AccessOp::Write) {
+					ops[idx].flags = O_CREAT | O_WRONLY;
+				}
+				if (op == AccessOp::Write || op == AccessOp::Open ||
+					op == AccessOp::Close) {
+					break;
+				}
+			}
+		}
+	}
+	return plan;
+}
+
+// Create an object on the mock server for every path the trace read or
+// stat'ed successfully, large enough for every recorded read.
+void populateMock(MockServer &server, const std::vector<AccessRecord> &records,
+				  const std::string &backend) {
+	std::unordered_map<std::string, uint64_t> sizes;
+	for (const auto &rec : records) {
+		if (rec.result < 0) {
+			continue;
+		}
+		uint64_t size = 0;
+		auto op = static_cast<AccessOp>(rec.op);
+		if (op == AccessOp::Read) {
+			size = rec.offset + rec.result;
+		} else if (op == AccessOp::Stat) {
+			size = rec.length;
+		} else if (op != AccessOp::Open) {
+			continue;
+		}
+		auto &known = sizes[recordPath(rec)];
+		known = std::max(known, size);
+	}
+	for (const auto &entry : sizes) {
+		server.putObject(benchBackendPath(backend, entry.first.substr(1)),
+						 std::string(entry.second, '\0'));
+	}
+}
+
+void replayThread(XrdOss &fs, const ReplayOptions &opts,
+				  const std::vector<ReplayOp> &ops, uint64_t traceStart,
+				  std::chrono::steady_clock::time_point start,
+				  ThreadResult &result) {
+	XrdOucEnv env;
+	std::vector<char> buffer;
+	std::unordered_map<std::string, std::unique_ptr<XrdOssDF>> files;
+
+	auto openFile = [&](const std::string &path, int flags) {
+		auto &file = files[path];
+		if (file) {
+			file->Close();
+		}
+		file.reset(fs.newFile("replay"));
+		int rv = file->Open(path.c_str(), flags, 0600, env);
+		if (rv != 0) {
+			file.reset();
+		}
+		return rv;
+	};
+
+	for (const auto &op : ops) {
+		const auto &rec = op.rec;
+		if (opts.speed > 0) {
+			auto target =
+				start +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double, std::nano>(
+						(rec.timestamp_ns - traceStart) / opts.speed));
+			std::this_thread::sleep_until(target);
+			uint64_t lag = std::chrono::duration_cast<std::chrono::nanoseconds>(
+							   std::chrono::steady_clock::now() - target)
+							   .count();
+			result.max_lag_ns = std::max(result.max_lag_ns, lag);
+		}
+
+		auto &stats = result.ops[rec.op < g_num_ops ? rec.op : 0];
+		auto kind = static_cast<AccessOp>(rec.op);
+		if (kind == AccessOp::Write && opts.skip_writes) {
+			stats.skipped++;
+			continue;
+		}
+		auto opStart = std::chrono::steady_clock::now();
+		int64_t rv = 0;
+		auto found = files.find(op.path);
+		XrdOssDF *file = found == files.end() ? nullptr : found->second.get();
+		switch (kind) {
+		case AccessOp::Open:
+			rv = openFile(op.path, op.flags);
+			break;
+		case AccessOp::Read:
+		case AccessOp::Write:
+			// The trace may begin with the file already open.
+			if (!file) {
+				rv = openFile(op.path,
+							  kind == AccessOp::Write ? O_CREAT | O_WRONLY : 0);
+				file = files[op.path].get();
+			}
+			if (!file) {
+				break;
+			}
+			buffer.resize(rec.length);
+			rv = kind == AccessOp::Read
+					 ? file->Read(buffer.data(), rec.offset, rec.length)
+					 : file->Write(buffer.data(), rec.offset, rec.length);
+			break;
+		case AccessOp::Stat: {
+			struct stat st;
+			rv = file ? file->Fstat(&st)
+					  : fs.Stat(op.path.c_str(), &st, 0, &env);
+			break;
+		}
+		case AccessOp::Close:
+			if (file) {
+				rv = file->Close();
+				files.erase(found);
+			}
+			break;
+		default:
+			stats.skipped++;
+			continue;
+		}
+		stats.latency_ns.push_back(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - opStart)
+				.count());
+		stats.recorded_ns.push_back(rec.latency_us * 1000ull);
+		stats.ops++;
+		if (rv < 0) {
+			stats.errors++;
+		} else if (kind == AccessOp::Read || kind == AccessOp::Write) {
+			stats.bytes += kind == AccessOp::Read ? rv : rec.length;
+		}
+		if ((rv < 0) != (rec.result < 0) ||
+			(kind == AccessOp::Read && rv >= 0 && rv != rec.result)) {
+			stats.diverged++;
+		}
+	}
+
+	for (auto &entry : files) {
+		if (entry.second) {
+			entry.second->Close();
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	ReplayOptions opts;
+	for (int idx = 1; idx < argc; idx++) {
+		if (!strcmp(argv[idx], "--help") || !strcmp(argv[idx], "-h")) {
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (!parseArgs(argc, argv, opts)) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	std::vector<AccessRecord> records;
+	std::string err;
+	if (!readTrace(opts.trace, records, err)) {
+		fprintf(stderr, "Failed to read the trace: %s\n", err.c_str());
+		return 1;
+	}
+	if (opts.dump) {
+		dumpTrace(records);
+		return 0;
+	}
+	if (records.empty()) {
+		fprintf(stderr, "The trace is empty\n");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	// Against the mock, the trace's paths are exported under g_bench_prefix;
+	// a real configuration exports them where they were recorded.
+	MockServer server;
+	std::string cfgfile = opts.config;
+	char dir[] = "/tmp/xrdhttp-replay-XXXXXX";
+	bool useMock = opts.config.empty();
+	if (useMock) {
+		FaultProfile faults;
+		if (!FaultProfile::parse(opts.bench.faults, faults, err)) {
+			fprintf(stderr, "Invalid --faults: %s\n", err.c_str());
+			return 2;
+		}
+		if (!server.Start(opts.bench.tls, err)) {
+			fprintf(stderr, "Failed to start the mock server: %s\n",
+					err.c_str());
+			return 1;
+		}
+		if (opts.bench.tls) {
+			setenv("X509_CERT_FILE", server.caFile().c_str(), 1);
+		}
+		populateMock(server, records, opts.bench.backend);
+		if (!mkdtemp(dir)) {
+			perror("mkdtemp");
+			return 1;
+		}
+		cfgfile = std::string(dir) + "/replay.cfg";
+		std::ofstream cfg(cfgfile);
+		if (!benchWriteConfig(cfg, server.url(), dir, opts.bench)) {
+			fprintf(stderr, "Failed to write the plugin configuration\n");
+			return 1;
+		}
+		server.setFaults(faults, opts.bench.seed);
+	}
+
+	XrdSysLogger logger;
+	std::unique_ptr<XrdOss> fs =
+		benchCreateFileSystem(&logger, cfgfile, opts.bench);
+	if (!fs) {
+		return 1;
+	}
+
+	auto plan = planReplay(records, useMock ? g_bench_prefix : "");
+	uint64_t traceStart = records.front().timestamp_ns;
+	double traceSeconds =
+		(records.back().timestamp_ns - traceStart +
+		 records.back().latency_us * 1000ull) /
+		1e9;
+	std::vector<ThreadResult> results(plan.size());
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	size_t idx = 0;
+	for (const auto &entry : plan) {
+		threads.emplace_back(replayThread, std::ref(*fs), std::cref(opts),
+							 std::cref(entry.second), traceStart, start,
+							 std::ref(results[idx++]));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	double elapsed = std::chrono::duration<double>(
+						 std::chrono::steady_clock::now() - start)
+						 .count();
+
+	OpResult total[g_num_ops];
+	uint64_t maxLag = 0;
+	for (auto &result : results) {
+		maxLag = std::max(maxLag, result.max_lag_ns);
+		for (unsigned op = 0; op < g_num_ops; op++) {
+			auto &from = result.ops[op];
+			auto &to = total[op];
+			to.ops += from.ops;
+			to.errors += from.errors;
+			to.diverged += from.diverged;
+			to.skipped += from.skipped;
+			to.bytes += from.bytes;
+			to.latency_ns.insert(to.latency_ns.end(), from.latency_ns.begin(),
+								 from.latency_ns.end());
+			to.recorded_ns.insert(to.recorded_ns.end(),
+								  from.recorded_ns.begin(),
+								  from.recorded_ns.end());
+		}
+	}
+	uint64_t diverged = 0;
+	for (auto &op : total) {
+		std::sort(op.latency_ns.begin(), op.latency_ns.end());
+		std::sort(op.recorded_ns.begin(), op.recorded_ns.end());
+		diverged += op.diverged;
+	}
+
+	if (opts.json) {
+		printf("{\"backend\":\"%s\",\"target\":\"%s\",\"records\":%zu,"
+			   "\"threads\":%zu,\"speed\":%.3f,\"trace_seconds\":%.3f,"
+			   "\"seconds\":%.3f,\"max_lag_ms\":%.3f,\"ops\":{",
+			   opts.bench.backend.c_str(), useMock ? "mock" : "config",
+			   records.size(), plan.size(), opts.speed, traceSeconds, elapsed,
+			   maxLag / 1e6);
+		bool first = true;
+		for (unsigned op = 1; op < g_num_ops; op++) {
+			const auto &res = total[op];
+			printf("%s\"%s\":{\"ops\":%" PRIu64 ",\"errors\":%" PRIu64
+				   ",\"diverged\":%" PRIu64 ",\"skipped\":%" PRIu64
+				   ",\"bytes\":%" PRIu64 ",\"recorded_p50_ms\":%.3f,"
+				   "\"recorded_p99_ms\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f}",
+				   first ? "" : ",", opName(op), res.ops, res.errors,
+				   res.diverged, res.skipped, res.bytes,
+				   benchPercentileMs(res.recorded_ns, 0.5),
+				   benchPercentileMs(res.recorded_ns, 0.99),
+				   benchPercentileMs(res.latency_ns, 0.5),
+				   benchPercentileMs(res.latency_ns, 0.99));
+			first = false;
+		}
+		printf("}}\n");
+	} else {
+		printf("replay       %zu records from %zu threads against %s (%s)\n",
+			   records.size(), plan.size(),
+			   useMock ? server.url().c_str() : opts.config.c_str(),
+			   opts.bench.backend.c_str());
+		printf("time         %.2f s recorded, %.2f s replayed", traceSeconds,
+			   elapsed);
+		if (opts.speed > 0) {
+			printf(" at %gx, up to %.3f ms behind schedule", opts.speed,
+				   maxLag / 1e6);
+		}
+		printf("\n%-6s %8s %7s %9s %14s %21s\n", "op", "count", "errors",
+			   "diverged", "bytes", "p50/p99 ms (recorded)");
+		for (unsigned op = 1; op < g_num_ops; op++) {
+			const auto &res = total[op];
+			if (!res.ops && !res.skipped) {
+				continue;
+			}
+			printf("%-6s %8" PRIu64 " %7" PRIu64 " %9" PRIu64 " %14" PRIu64
+				   "  %.3f/%.3f (%.3f/%.3f)",
+				   opName(op), res.ops, res.errors, res.diverged, res.bytes,
+				   benchPercentileMs(res.latency_ns, 0.5),
+				   benchPercentileMs(res.latency_ns, 0.99),
+				   benchPercentileMs(res.recorded_ns, 0.5),
+				   benchPercentileMs(res.recorded_ns, 0.99));
+			if (res.skipped) {
+				printf(", %" PRIu64 " skipped", res.skipped);
+			}
+			printf("\n");
+		}
+	}
+
+	fs.reset();
+	if (useMock) {
+		server.Stop();
+		unlink(cfgfile.c_str());
+		unlink((std::string(dir) + "/access_key").c_str());
+		unlink((std::string(dir) + "/secret_key").c_str());
+		rmdir(dir);
+	}
+	return diverged ? 1 : 0;
+}
@@ -17,17 +17,39 @@
  ***************************************************************/
 #pragma once
 
+#include <chrono>
+#include <string>
+#include <utility>
+
+// One set of AWS credentials.  Immutable, so a request can keep signing
+// with it while a newer set replaces it for later requests.
 class AWSCredential {
 
   public:
-	AWSCredential(const std::string &accessKeyID,
-				  const std::string &secretAccessKey,
-				  const std::string &securityToken)
-		: m_access_key(accessKeyID), m_secret_key(secretAccessKey),
-		  m_security_token(securityToken) {}
+	AWSCredential(std::string accessKeyID, std::string secretAccessKey,
+				  std::string securityToken,
+				  std::chrono::system_clock::time_point expiration = {})
+		: m_access_key(std::move(accessKeyID)),
+		  m_secret_key(std::move(secretAccessKey)),
+		  m_security_token(std::move(securityToken)),
+		  m_expiration(expiration) {}
+
+	const std::string &accessKeyID() const { return m_access_key; }
+	const std::string &secretAccessKey() const { return m_secret_key; }
+	// Empty for long-term credentials.
+	const std::string &securityToken() const { return m_security_token; }
+
+	// Whether the credentials expire, and when.
+	bool expires() const {
+		return m_expiration != std::chrono::system_clock::time_point();
+	}
+	std::chrono::system_clock::time_point expiration() const {
+		return m_expiration;
+	}
 
   private:
 	const std::string m_access_key;
 	const std::string m_secret_key;
 	const std::string m_security_token;
+	const std::chrono::system_clock::time_point m_expiration;
 };
@@ -26,14 +26,113 @@
  */
 
 #include <cstring>
+#include <openssl/evp.h>
 #include <openssl/hmac.h>
 
 #include "AWSv4-impl.hh"
+#include <array>
 #include <map>
 #include <string>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace AWSv4Impl {
 
+namespace {
+
+// "Do not URL encode ... A-Z, a-z, 0-9, hyphen ( - ), underscore ( _ ),
+// period ( . ), and tilde ( ~ ).  Percent encode all other characters with
+// %XY, where X and Y are hex characters 0-9 and uppercase A-F.  Percent
+// encode extended UTF-8 characters in the form %XY%ZA..."
+constexpr std::array<bool, 256> makeUnreservedTable() {
+	std::array<bool, 256> table{};
+	for (int c = 0; c < 256; c++) {
+		table[c] = ('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z') ||
+				   ('0' <= c && c <= '9') || c == '-' || c == '_' ||
+				   c == '.' || c == '~';
+	}
+	return table;
+}
+constexpr std::array<bool, 256> g_unreserved = makeUnreservedTable();
+
+const char g_upper_hex[] = "0123456789ABCDEF";
+const char g_lower_hex[] = "0123456789abcdef";
+
+// The number of unreserved characters at the start of [in, end).
+inline size_t unreservedRun(const unsigned char *in,
+							const unsigned char *end) {
+	const unsigned char *start = in;
+#if defined(__SSE2__)
+	// Classify 16 bytes at a time.  Bytes from 0x80 up are negative as
+	// signed chars, so they fall outside every range and get encoded.
+	const __m128i lowerA = _mm_set1_epi8('a' - 1);
+	const __m128i lowerZ = _mm_set1_epi8('z' + 1);
+	const __m128i digit0 = _mm_set1_epi8('0' - 1);
+	const __m128i digit9 = _mm_set1_epi8('9' + 1);
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	const __m128i dash = _mm_set1_epi8('-');
+	const __m128i underscore = _mm_set1_epi8('_');
+	const __m128i period = _mm_set1_epi8('.');
+	const __m128i tilde = _mm_set1_epi8('~');
+	while (end - in >= 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+		// Setting 0x20 folds A-Z onto a-z without moving anything else
+		// into that range.
+		__m128i folded = _mm_or_si128(chunk, caseBit);
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, lowerA),
+									  _mm_cmplt_epi8(folded, lowerZ));
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, digit0),
+									  _mm_cmplt_epi8(chunk, digit9));
+		__m128i punct = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, dash),
+						 _mm_cmpeq_epi8(chunk, underscore)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, period),
+						 _mm_cmpeq_epi8(chunk, tilde)));
+		unsigned mask = _mm_movemask_epi8(
+			_mm_or_si128(_mm_or_si128(alpha, digit), punct));
+		if (mask != 0xFFFF) {
+			return in - start + __builtin_ctz(~mask);
+		}
+		in += 16;
+	}
+#endif
+	while (in < end && g_unreserved[*in]) {
+		in++;
+	}
+	return in - start;
+}
+
+// Encode [in, in + length) into `out`, which must have room for three
+// output bytes per input byte; '/' is copied as is when `keepSlash` is set.
+// Returns the end of the output.
+char *encodeInto(const char *input, size_t length, char *out,
+				 bool keepSlash) {
+	auto in = reinterpret_cast<const unsigned char *>(input);
+	auto end = in + length;
+	while (in < end) {
+		size_t run = unreservedRun(in, end);
+		memcpy(out, in, run);
+		out += run;
+		in += run;
+		if (in == end) {
+			break;
+		}
+		if (keepSlash && *in == '/') {
+			*out++ = '/';
+		} else {
+			*out++ = '%';
+			*out++ = g_upper_hex[*in >> 4];
+			*out++ = g_upper_hex[*in & 0xF];
+		}
+		in++;
+	}
+	return out;
+}
+
+} // namespace
+
 //
 // This function should not be called for anything in query_parameters,
 // except for by AmazonQuery::SendRequest().
@@ -44,92 +143,93 @@ std::string amazonURLEncode(const std::string &input) {
 	 * http://docs.amazonwebservices.com/AWSEC2/2010-11-15/DeveloperGuide/using-query-api.html
 	 *
 	 */
-	std::string output;
-	for (unsigned i = 0; i < input.length(); ++i) {
-		// "Do not URL encode ... A-Z, a-z, 0-9, hyphen ( - ),
-		// underscore ( _ ), period ( . ), and tilde ( ~ ).  Percent
-		// encode all other characters with %XY, where X and Y are hex
-		// characters 0-9 and uppercase A-F.  Percent encode extended
-		// UTF-8 characters in the form %XY%ZA..."
-		if (('A' <= input[i] && input[i] <= 'Z') ||
-			('a' <= input[i] && input[i] <= 'z') ||
-			('0' <= input[i] && input[i] <= '9') || input[i] == '-' ||
-			input[i] == '_' || input[i] == '.' || input[i] == '~') {
-			char uglyHack[] = "X";
-			uglyHack[0] = input[i];
-			output.append(uglyHack);
-		} else {
-			char percentEncode[4];
-			snprintf(percentEncode, 4, "%%%.2hhX", input[i]);
-			output.append(percentEncode);
-		}
-	}
-
+	std::string output(input.size() * 3, '\0');
+	char *end = encodeInto(input.data(), input.size(), &output[0], false);
+	output.resize(end - output.data());
 	return output;
 }
 
+// Encode each '/'-separated segment of the path.  As this always has, the
+// path ends at the first NUL.
 std::string pathEncode(const std::string &original) {
-	std::string segment;
-	std::string encoded;
-	const char *o = original.c_str();
-
-	size_t next = 0;
-	size_t offset = 0;
-	size_t length = strlen(o);
-	while (offset < length) {
-		next = strcspn(o + offset, "/");
-		if (next == 0) {
-			encoded += "/";
-			offset += 1;
-			continue;
-		}
-
-		segment = std::string(o + offset, next);
-		encoded += amazonURLEncode(segment);
-
-		offset += next;
-	}
+	size_t length = strnlen(original.c_str(), original.size());
+	std::string encoded(length * 3, '\0');
+	char *end = encodeInto(original.data(), length, &encoded[0], true);
+	encoded.resize(end - encoded.data());
 	return encoded;
 }
 
 void convertMessageDigestToLowercaseHex(const unsigned char *messageDigest,
 										unsigned int mdLength,
 										std::string &hexEncoded) {
-	char *buffer = (char *)malloc((mdLength * 2) + 1);
-	char *ptr = buffer;
-	for (unsigned int i = 0; i < mdLength; ++i, ptr += 2) {
-		snprintf(ptr, 3, "%02x", messageDigest[i]);
+	hexEncoded.resize(mdLength * 2);
+	char *out = &hexEncoded[0];
+	for (unsigned int i = 0; i < mdLength; ++i) {
+		*out++ = g_lower_hex[messageDigest[i] >> 4];
+		*out++ = g_lower_hex[messageDigest[i] & 0xF];
 	}
-	hexEncoded.assign(buffer, mdLength * 2);
-	free(buffer);
 }
 
-bool doSha256(const std::string &payload, unsigned char *messageDigest,
+namespace {
+
+// The SHA-256 implementation, looked up once.  On OpenSSL 3 passing
+// EVP_sha256() to EVP_DigestInit_ex makes it fetch the provider's
+// implementation again on every call; fetching it explicitly avoids that
+// and still picks the SHA-NI / AVX2 code when the CPU has it.
+const EVP_MD *sha256() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	static const EVP_MD *md = [] {
+		const EVP_MD *fetched = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+		return fetched ? fetched : EVP_sha256();
+	}();
+	return md;
+#else
+	return EVP_sha256();
+#endif
+}
+
+// A digest context per thread, reset rather than recreated for each hash.
+EVP_MD_CTX *threadDigestContext() {
+	struct Context {
+		EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+		~Context() { EVP_MD_CTX_free(ctx); }
+	};
+	static thread_local Context context;
+	return context.ctx;
+}
+
+} // namespace
+
+bool doSha256(const char *payload, size_t length, unsigned char *messageDigest,
 			  unsigned int *mdLength) {
-	EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+	EVP_MD_CTX *mdctx = threadDigestContext();
 	if (mdctx == NULL) {
 		return false;
 	}
 
-	if (!EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL)) {
-		EVP_MD_CTX_destroy(mdctx);
+	// EVP_DigestInit_ex resets the context, so a hash that failed part way
+	// does not affect the next one.
+	if (!EVP_DigestInit_ex(mdctx, sha256(), NULL)) {
 		return false;
 	}
 
-	if (!EVP_DigestUpdate(mdctx, payload.c_str(), payload.length())) {
-		EVP_MD_CTX_destroy(mdctx);
+	if (!EVP_DigestUpdate(mdctx, payload, length)) {
 		return false;
 	}
 
 	if (!EVP_DigestFinal_ex(mdctx, messageDigest, mdLength)) {
-		EVP_MD_CTX_destroy(mdctx);
 		return false;
 	}
 
-	EVP_MD_CTX_destroy(mdctx);
 	return true;
 }
 
+bool doSha256(const std::string &payload, unsigned char *messageDigest,
+			  unsigned int *mdLength) {
+	return doSha256(payload.data(), payload.length(), messageDigest,
+					mdLength);
+}
+
 bool createSignature(const std::string &secretAccessKey,
 					 const std::string &date, const std::string &region,
 					 const std::string &service,
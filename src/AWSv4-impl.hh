@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <map>
 #include <string>
 
@@ -34,6 +35,12 @@ void convertMessageDigestToLowercaseHex(const unsigned char *messageDigest,
 										unsigned int mdLength,
 										std::string &hexEncoded);
 
+// SHA-256 of the payload; messageDigest needs room for EVP_MAX_MD_SIZE
+// bytes.  Reuses a digest context per thread, so it is cheap to call for
+// each request.
+bool doSha256(const char *payload, size_t length, unsigned char *messageDigest,
+			  unsigned int *mdLength);
+
 bool doSha256(const std::string &payload, unsigned char *messageDigest,
 			  unsigned int *mdLength);
 
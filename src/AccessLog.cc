@@ -0,0 +1,237 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "AccessLog.hh"
+#include "logging.hh"
+
+#include <XrdSys/XrdSysError.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace XrdHTTPServer;
+
+namespace {
+
+// How often the writer drains the rings.
+const std::chrono::milliseconds g_drain_interval(200);
+
+// Owns the calling thread's reference to its ring; when the thread exits,
+// the writer is told it may free the ring once it has been drained.
+template <typename Ring> struct RingHolder {
+	std::shared_ptr<Ring> ring;
+	~RingHolder() {
+		if (ring) {
+			ring->orphaned.store(true, std::memory_order_release);
+		}
+	}
+};
+
+bool writeAll(int fd, const char *data, size_t size) {
+	while (size) {
+		ssize_t rv = write(fd, data, size);
+		if (rv < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += rv;
+		size -= rv;
+	}
+	return true;
+}
+
+} // namespace
+
+AccessLog &AccessLog::Instance() {
+	static AccessLog instance;
+	return instance;
+}
+
+AccessLog::~AccessLog() {
+	if (m_writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_writer_mutex);
+			m_writer_stop = true;
+		}
+		m_writer_cv.notify_all();
+		m_writer.join();
+	}
+	Flush();
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+}
+
+bool AccessLog::Start(const std::string &path, XrdSysError &log) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_fd >= 0) {
+		if (path == m_path) {
+			return true;
+		}
+		log.Emsg("AccessLog", "Access log is already being written to",
+				 m_path.c_str());
+		return false;
+	}
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+				  0644);
+	if (fd < 0) {
+		log.Emsg("AccessLog", errno, "open access log", path.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size == 0) {
+		char header[16] = {'X', 'R', 'D', 'H', 'T', 'A', 'L', '1'};
+		uint32_t recordSize = sizeof(AccessRecord);
+		memcpy(header + 8, &recordSize, sizeof(recordSize));
+		if (!writeAll(fd, header, sizeof(header))) {
+			log.Emsg("AccessLog", errno, "write access log", path.c_str());
+			close(fd);
+			return false;
+		}
+	}
+
+	m_fd = fd;
+	m_path = path;
+	m_log = &log;
+	m_writer = std::thread([this] {
+		std::unique_lock<std::mutex> lock(m_writer_mutex);
+		while (!m_writer_stop) {
+			m_writer_cv.wait_for(lock, g_drain_interval);
+			lock.unlock();
+			Flush();
+			lock.lock();
+		}
+	});
+	m_enabled.store(true, std::memory_order_relaxed);
+	log.Log(LogMask::Info, "AccessLog", "Writing access log to",
+			path.c_str());
+	return true;
+}
+
+uint64_t AccessLog::HashPath(std::string_view path) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : path) {
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+	return hash;
+}
+
+AccessLog::Ring &AccessLog::ThreadRing() {
+	static thread_local RingHolder<Ring> holder;
+	if (!holder.ring) {
+		holder.ring = std::make_shared<Ring>();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		holder.ring->thread = ++m_next_thread;
+		m_rings.push_back(holder.ring);
+	}
+	return *holder.ring;
+}
+
+void AccessLog::Append(AccessOp op, std::string_view path, int64_t offset,
+					   uint64_t length, int64_t result,
+					   std::chrono::steady_clock::time_point start) {
+	auto now = std::chrono::steady_clock::now();
+	Ring &ring = ThreadRing();
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= ring_capacity) {
+		ring.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	AccessRecord &rec = ring.records[head % ring_capacity];
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	int64_t latency =
+		std::chrono::duration_cast<std::chrono::microseconds>(now - start)
+			.count();
+	// Report the start of the operation, not the time it was logged.
+	rec.timestamp_ns =
+		ts.tv_sec * 1000000000ull + ts.tv_nsec - latency * 1000;
+	rec.path_hash = HashPath(path);
+	rec.offset = offset;
+	rec.length = length;
+	rec.result = result;
+	rec.latency_us = std::min<int64_t>(std::max<int64_t>(latency, 0),
+									   UINT32_MAX);
+	rec.thread = ring.thread;
+	rec.op = static_cast<uint8_t>(op);
+	if (path.size() > sizeof(rec.path)) {
+		path.remove_prefix(path.size() - sizeof(rec.path));
+	}
+	rec.path_len = path.size();
+	memset(rec.reserved, 0, sizeof(rec.reserved));
+	memcpy(rec.path, path.data(), path.size());
+	memset(rec.path + path.size(), 0, sizeof(rec.path) - path.size());
+
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void AccessLog::Flush() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_fd < 0) {
+		return;
+	}
+
+	uint64_t dropped = 0;
+	bool failed = false;
+	for (auto iter = m_rings.begin(); iter != m_rings.end();) {
+		Ring &ring = **iter;
+		// Check before reading head: a ring orphaned before we drain it
+		// cannot receive any more records.
+		bool orphaned = ring.orphaned.load(std::memory_order_acquire);
+		uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		while (tail != head && !failed) {
+			// Write the contiguous stretch up to the end of the buffer.
+			size_t start = tail % ring_capacity;
+			size_t count =
+				std::min<uint64_t>(head - tail, ring_capacity - start);
+			const char *data =
+				reinterpret_cast<const char *>(&ring.records[start]);
+			failed = !writeAll(m_fd, data, count * sizeof(AccessRecord));
+			tail += count;
+		}
+		ring.tail.store(tail, std::memory_order_release);
+		dropped += ring.dropped.exchange(0, std::memory_order_relaxed);
+
+		if (orphaned && tail == head) {
+			iter = m_rings.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+
+	if (failed && m_log) {
+		m_log->Log(LogMask::Warning, "AccessLog", "Failed to write access log",
+				   m_path.c_str(), strerror(errno));
+	}
+	if (dropped && m_log) {
+		std::string count = std::to_string(dropped);
+		m_log->Log(LogMask::Warning, "AccessLog", "Dropped", count.c_str(),
+				   "access log records because the writer fell behind");
+	}
+}
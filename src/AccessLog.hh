@@ -0,0 +1,133 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class XrdSysError;
+
+enum class AccessOp : uint8_t {
+	Open = 1,
+	Read = 2,
+	Write = 3,
+	Stat = 4,
+	Close = 5,
+};
+
+// One access log entry.  The log file is a 16-byte header (the magic
+// "XRDHTAL1", then the record size and a reserved word, both uint32)
+// followed by these records, back to back, in the order the writer drained
+// them; records from different threads may be out of time order.  Integers
+// are in the byte order of the host that wrote the log, so readers on a host
+// of the other byte order see a byte-swapped record size.
+struct AccessRecord {
+	uint64_t timestamp_ns;	// wall-clock time the operation started
+	uint64_t path_hash;		// FNV-1a of the full path
+	int64_t offset;
+	uint64_t length;
+	int64_t result;			// the value the operation returned
+	uint32_t latency_us;
+	uint32_t thread;		// small per-process thread number
+	uint8_t op;				// AccessOp
+	uint8_t path_len;		// bytes used in `path`
+	uint8_t reserved[6];
+	char path[72];			// the last bytes of the path, not terminated
+};
+static_assert(sizeof(AccessRecord) == 128, "AccessRecord must be 128 bytes");
+
+// A binary log of every file operation, kept off the request path.  Each
+// thread appends fixed-size records to its own single-producer ring buffer
+// without locks or system calls; a background thread drains all the rings
+// to the log file a few times a second.  If a ring fills up before it is
+// drained, new records are dropped (and counted) rather than blocking.
+//
+// There is one access log per plugin library, shared by every filesystem
+// object the library creates.
+class AccessLog {
+  public:
+	static AccessLog &Instance();
+	~AccessLog();
+
+	// Start logging to `path`.  Returns false, after logging why, if the file
+	// cannot be opened or the log was already started on a different file.
+	// Problems found later are reported to `log`, which must outlive the
+	// access log.
+	bool Start(const std::string &path, XrdSysError &log);
+
+	bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	// Append a record for an operation that began at `start`.
+	void Record(AccessOp op, std::string_view path, int64_t offset,
+				uint64_t length, int64_t result,
+				std::chrono::steady_clock::time_point start) {
+		if (enabled()) {
+			Append(op, path, offset, length, result, start);
+		}
+	}
+
+	// Write out everything recorded so far; used by tests and at shutdown.
+	void Flush();
+
+	static uint64_t HashPath(std::string_view path);
+
+	// Records per thread buffered between drains.
+	static const size_t ring_capacity = 1024;
+
+  private:
+	AccessLog() {}
+
+	struct Ring {
+		AccessRecord records[ring_capacity];
+		alignas(64) std::atomic<uint64_t> head{0};
+		alignas(64) std::atomic<uint64_t> tail{0};
+		std::atomic<uint64_t> dropped{0};
+		std::atomic<bool> orphaned{false};
+		uint32_t thread{0};
+	};
+
+	void Append(AccessOp op, std::string_view path, int64_t offset,
+				uint64_t length, int64_t result,
+				std::chrono::steady_clock::time_point start);
+	Ring &ThreadRing();
+
+	std::atomic<bool> m_enabled{false};
+	std::string m_path;
+	int m_fd{-1};
+	XrdSysError *m_log{nullptr};
+
+	// Guards m_rings and the file; never taken on the request path except
+	// when a thread records its first entry.
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<Ring>> m_rings;
+	uint32_t m_next_thread{0};
+
+	std::thread m_writer;
+	std::mutex m_writer_mutex;
+	std::condition_variable m_writer_cv;
+	bool m_writer_stop{false};
+};
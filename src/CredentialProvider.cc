@@ -0,0 +1,435 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "CredentialProvider.hh"
+#include "AWSv4-impl.hh"
+#include "HTTPCommands.hh"
+#include "logging.hh"
+#include "shortfile.hh"
+#include "stl_string_utils.hh"
+
+#include <XrdSys/XrdSysError.hh>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string_view>
+
+#include <sys/wait.h>
+#include <time.h>
+
+using namespace XrdHTTPServer;
+
+namespace {
+
+// A plain request for credentials: no signing, and the caller chooses the
+// verb, headers and body.  An endpoint that stops answering fails the fetch
+// after `total` rather than holding up startup or the refresh thread.
+class CredentialRequest : public HTTPRequest {
+  public:
+	CredentialRequest(const std::string &url, std::chrono::milliseconds connect,
+					  std::chrono::milliseconds total, XrdSysError &log)
+		: HTTPRequest(url, log) {
+		SetTimeouts(connect, total);
+	}
+	virtual ~CredentialRequest() {}
+
+	bool Send(const std::string &verb, const std::string &body,
+			  const std::map<std::string, std::string> &extraHeaders = {}) {
+		httpVerb = verb;
+		for (const auto &header : extraHeaders) {
+			headers[header.first] = header.second;
+		}
+		std::string contentLength;
+		formatstr(contentLength, "%zu", body.size());
+		headers["Content-Length"] = contentLength;
+		headers["Transfer-Encoding"] = "";
+		if ((protocol != "http") && (protocol != "https")) {
+			errorCode = "E_INVALID_SERVICE_URL";
+			errorMessage = "URL not of a known protocol (http[s]).";
+			return false;
+		}
+		return sendPreparedRequest(protocol, hostUrl, body);
+	}
+
+	std::string error() const { return errorCode + ": " + errorMessage; }
+};
+
+// Parse an ISO 8601 UTC time such as "2024-05-01T12:00:00Z", ignoring any
+// fractional seconds.
+bool parseTimestamp(const std::string &value,
+					std::chrono::system_clock::time_point &when) {
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	if (!strptime(value.c_str(), "%Y-%m-%dT%H:%M:%S", &tm)) {
+		return false;
+	}
+	time_t epoch = timegm(&tm);
+	if (epoch == -1) {
+		return false;
+	}
+	when = std::chrono::system_clock::from_time_t(epoch);
+	return true;
+}
+
+// The text of the first <name> element in `xml`, with the predefined
+// entities decoded.
+bool xmlElement(const std::string &xml, const std::string &name,
+				std::string &value) {
+	std::string open = "<" + name + ">";
+	size_t start = xml.find(open);
+	if (start == std::string::npos) {
+		return false;
+	}
+	start += open.size();
+	size_t end = xml.find("</" + name + ">", start);
+	if (end == std::string::npos) {
+		return false;
+	}
+	static const std::pair<std::string_view, char> entities[] = {
+		{"&amp;", '&'}, {"&lt;", '<'},	 {"&gt;", '>'},
+		{"&quot;", '"'}, {"&apos;", '\''},
+	};
+	value.clear();
+	for (size_t idx = start; idx < end; idx++) {
+		char c = xml[idx];
+		if (c == '&') {
+			for (const auto &entity : entities) {
+				if (xml.compare(idx, entity.first.size(), entity.first) == 0) {
+					c = entity.second;
+					idx += entity.first.size() - 1;
+					break;
+				}
+			}
+		}
+		value.push_back(c);
+	}
+	return true;
+}
+
+// Where the value of the member `name` of the JSON object in `json`
+// starts, or npos.  Enough for the flat objects credential endpoints
+// return.
+size_t jsonValue(const std::string &json, const std::string &name) {
+	std::string key = "\"" + name + "\"";
+	size_t pos = json.find(key);
+	if (pos == std::string::npos) {
+		return pos;
+	}
+	pos = json.find_first_not_of(" \t\r\n", pos + key.size());
+	if (pos == std::string::npos || json[pos] != ':') {
+		return std::string::npos;
+	}
+	return json.find_first_not_of(" \t\r\n", pos + 1);
+}
+
+// The value of the string member `name`; \u escapes outside ASCII are not
+// decoded.
+bool jsonString(const std::string &json, const std::string &name,
+				std::string &value) {
+	size_t pos = jsonValue(json, name);
+	if (pos == std::string::npos || json[pos] != '"') {
+		return false;
+	}
+	value.clear();
+	for (pos++; pos < json.size(); pos++) {
+		char c = json[pos];
+		if (c == '"') {
+			return true;
+		}
+		if (c == '\\' && ++pos < json.size()) {
+			switch (json[pos]) {
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case 'b':
+				c = '\b';
+				break;
+			case 'f':
+				c = '\f';
+				break;
+			case 'u':
+				if (pos + 4 >= json.size()) {
+					return false;
+				}
+				c = static_cast<char>(
+					strtoul(json.substr(pos + 1, 4).c_str(), nullptr, 16));
+				pos += 4;
+				break;
+			default: // '"', '\\' and '/'
+				c = json[pos];
+			}
+		}
+		value.push_back(c);
+	}
+	return false;
+}
+
+// Build credentials from the JSON the metadata endpoints and credential
+// processes print; `tokenName` is the member holding the session token.
+bool credentialFromJSON(const std::string &json, const std::string &tokenName,
+						std::shared_ptr<const AWSCredential> &credential,
+						std::string &err) {
+	std::string accessKey, secretKey, token, expiration;
+	if (!jsonString(json, "AccessKeyId", accessKey) ||
+		!jsonString(json, "SecretAccessKey", secretKey)) {
+		err = "response has no AccessKeyId and SecretAccessKey";
+		return false;
+	}
+	jsonString(json, tokenName, token);
+	std::chrono::system_clock::time_point expires;
+	if (jsonString(json, "Expiration", expiration) &&
+		!parseTimestamp(expiration, expires)) {
+		err = "invalid Expiration '" + expiration + "'";
+		return false;
+	}
+	credential.reset(new AWSCredential(accessKey, secretKey, token, expires));
+	return true;
+}
+
+} // namespace
+
+CredentialProvider::~CredentialProvider() { stop(); }
+
+void CredentialProvider::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+WebIdentityCredentialProvider::~WebIdentityCredentialProvider() { stop(); }
+
+MetadataCredentialProvider::~MetadataCredentialProvider() { stop(); }
+
+ProcessCredentialProvider::~ProcessCredentialProvider() { stop(); }
+
+bool CredentialProvider::start(std::string &err) {
+	if (!refresh(err)) {
+		return false;
+	}
+	m_thread = std::thread(&CredentialProvider::refreshLoop, this);
+	return true;
+}
+
+bool CredentialProvider::refresh(std::string &err) {
+	std::shared_ptr<const AWSCredential> credential;
+	auto now = std::chrono::system_clock::now();
+	if (!fetch(credential, err)) {
+		return false;
+	}
+	if (credential->expires() && credential->expiration() <= now) {
+		err = "the credentials fetched have already expired";
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fetched = now;
+	}
+	std::atomic_store(&m_current,
+					  std::shared_ptr<const AWSCredential>(credential));
+	return true;
+}
+
+void CredentialProvider::refreshLoop() {
+	auto retry = min_retry;
+	auto next = std::chrono::system_clock::time_point::max();
+	bool failed = false;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		if (!failed) {
+			auto credential = get();
+			next = std::chrono::system_clock::time_point::max();
+			if (credential->expires()) {
+				auto lifetime = credential->expiration() - m_fetched;
+				next = m_fetched +
+					   std::chrono::duration_cast<
+						   std::chrono::system_clock::duration>(
+						   lifetime * refresh_fraction);
+			}
+		}
+		if (next == std::chrono::system_clock::time_point::max()) {
+			m_cv.wait(lock, [this] { return m_stop; });
+			break;
+		}
+		if (m_cv.wait_until(lock, next, [this] { return m_stop; })) {
+			break;
+		}
+
+		lock.unlock();
+		std::string err;
+		failed = !refresh(err);
+		if (failed) {
+			XRDHTTP_LOG(m_log, LogMask::Warning, "Credentials",
+						"Failed to refresh credentials from", m_name.c_str(),
+						err.c_str());
+			next = std::chrono::system_clock::now() + retry;
+			retry = std::min(retry * 2, max_retry);
+		} else {
+			XRDHTTP_LOG(m_log, LogMask::Debug, "Credentials",
+						"Refreshed credentials from", m_name.c_str());
+			retry = min_retry;
+		}
+		lock.lock();
+	}
+}
+
+bool WebIdentityCredentialProvider::fetch(
+	std::shared_ptr<const AWSCredential> &credential, std::string &err) {
+	std::string token;
+	if (!readShortFile(m_token_file, token)) {
+		err = "unable to read web identity token file '" + m_token_file + "'";
+		return false;
+	}
+	trim(token);
+
+	std::map<std::string, std::string> form{
+		{"Action", "AssumeRoleWithWebIdentity"},
+		{"Version", "2011-06-15"},
+		{"RoleArn", m_role_arn},
+		{"RoleSessionName", m_session_name},
+		{"WebIdentityToken", token},
+	};
+	CredentialRequest request(m_endpoint, m_connect_timeout,
+							  m_request_timeout, m_log);
+	if (!request.Send(
+			"POST", AWSv4Impl::canonicalizeQueryString(form),
+			{{"Content-Type", "application/x-www-form-urlencoded"}})) {
+		err = "STS request failed: " + request.error();
+		return false;
+	}
+
+	const std::string &xml = request.getResultString();
+	std::string accessKey, secretKey, sessionToken, expiration;
+	if (!xmlElement(xml, "AccessKeyId", accessKey) ||
+		!xmlElement(xml, "SecretAccessKey", secretKey) ||
+		!xmlElement(xml, "SessionToken", sessionToken) ||
+		!xmlElement(xml, "Expiration", expiration)) {
+		err = "STS response has no credentials";
+		return false;
+	}
+	std::chrono::system_clock::time_point expires;
+	if (!parseTimestamp(expiration, expires)) {
+		err = "invalid Expiration '" + expiration + "' from STS";
+		return false;
+	}
+	credential.reset(
+		new AWSCredential(accessKey, secretKey, sessionToken, expires));
+	return true;
+}
+
+bool MetadataCredentialProvider::fetch(
+	std::shared_ptr<const AWSCredential> &credential, std::string &err) {
+	std::map<std::string, std::string> headers;
+	std::string url = m_url;
+	if (!m_url.empty() && m_url.back() == '/') {
+		// IMDSv2: ask for a session token first.  Endpoints that only
+		// speak IMDSv1 refuse, and are then queried without one.
+		size_t scheme = m_url.find("://");
+		size_t root = m_url.find('/', scheme == std::string::npos
+										  ? 0
+										  : scheme + 3);
+		CredentialRequest tokenRequest(
+			m_url.substr(0, root) + "/latest/api/token", m_connect_timeout,
+			m_request_timeout, m_log);
+		if (tokenRequest.Send("PUT", "",
+							  {{"X-aws-ec2-metadata-token-ttl-seconds",
+								"21600"}}) &&
+			!tokenRequest.getResultString().empty()) {
+			headers["X-aws-ec2-metadata-token"] =
+				tokenRequest.getResultString();
+		}
+
+		CredentialRequest listing(m_url, m_connect_timeout, m_request_timeout,
+								  m_log);
+		if (!listing.Send("GET", "", headers)) {
+			err = "metadata request failed: " + listing.error();
+			return false;
+		}
+		std::string role = listing.getResultString();
+		role = role.substr(0, role.find('\n'));
+		trim(role);
+		if (role.empty()) {
+			err = "no role is attached to the instance";
+			return false;
+		}
+		url += role;
+	} else if (!m_token_file.empty()) {
+		std::string token;
+		if (!readShortFile(m_token_file, token)) {
+			err = "unable to read metadata token file '" + m_token_file + "'";
+			return false;
+		}
+		trim(token);
+		headers["Authorization"] = token;
+	}
+
+	CredentialRequest request(url, m_connect_timeout, m_request_timeout,
+							  m_log);
+	if (!request.Send("GET", "", headers)) {
+		err = "metadata request failed: " + request.error();
+		return false;
+	}
+	return credentialFromJSON(request.getResultString(), "Token", credential,
+							  err);
+}
+
+bool ProcessCredentialProvider::fetch(
+	std::shared_ptr<const AWSCredential> &credential, std::string &err) {
+	FILE *fp = popen(m_command.c_str(), "r");
+	if (!fp) {
+		err = "unable to run '" + m_command + "': " + strerror(errno);
+		return false;
+	}
+	std::string output;
+	char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+		output.append(buffer, count);
+	}
+	int status = pclose(fp);
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		err = "'" + m_command + "' failed";
+		return false;
+	}
+
+	// Version 1 is the only format there is.
+	size_t version = jsonValue(output, "Version");
+	if (version == std::string::npos || output[version] != '1' ||
+		isdigit(static_cast<unsigned char>(output[version + 1]))) {
+		err = "output of '" + m_command + "' is not Version 1";
+		return false;
+	}
+	if (!credentialFromJSON(output, "SessionToken", credential, err)) {
+		err = "output of '" + m_command + "': " + err;
+		return false;
+	}
+	return true;
+}
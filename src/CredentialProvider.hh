@@ -0,0 +1,164 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include "AWSCredential.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class XrdSysError;
+
+// A source of temporary credentials that replaces them in the background
+// before they expire.  Requests take a snapshot with get(), which never
+// waits for a fetch: a refresh builds a new AWSCredential and swaps the
+// pointer, and requests still holding the old one finish with it.
+//
+// The refresh thread calls the derived class's fetch(), so every derived
+// class must call stop() in its destructor, before its members go away.
+class CredentialProvider {
+  public:
+	// `name` identifies the provider in log messages.
+	CredentialProvider(const std::string &name, XrdSysError &log)
+		: m_log(log), m_name(name) {}
+	virtual ~CredentialProvider();
+
+	// Fetch the first credentials, failing if that does not work, then
+	// start refreshing them in the background.
+	bool start(std::string &err);
+
+	// Stop refreshing, waiting for a fetch in progress to finish.
+	void stop();
+
+	// The current credentials; null only before start() succeeds.
+	std::shared_ptr<const AWSCredential> get() const {
+		return std::atomic_load(&m_current);
+	}
+
+	// Fetch new credentials now, replacing the current ones on success.
+	bool refresh(std::string &err);
+
+	// Credentials that expire are refreshed once this fraction of their
+	// lifetime has passed; a failed refresh is retried after a delay that
+	// doubles from the first to the second of these.
+	static constexpr double refresh_fraction = 2.0 / 3.0;
+	static constexpr std::chrono::seconds min_retry{1};
+	static constexpr std::chrono::seconds max_retry{60};
+
+	// How long a request to a credential endpoint may take to connect and,
+	// in all, to finish before the fetch fails.  Call before start().
+	void setTimeouts(std::chrono::milliseconds connect,
+					 std::chrono::milliseconds total) {
+		m_connect_timeout = connect;
+		m_request_timeout = total;
+	}
+
+  protected:
+	// Fetch a fresh set of credentials.  Called by start() and then from
+	// the refresh thread only.
+	virtual bool fetch(std::shared_ptr<const AWSCredential> &credential,
+					   std::string &err) = 0;
+
+	XrdSysError &m_log;
+	std::chrono::milliseconds m_connect_timeout{std::chrono::seconds(5)};
+	std::chrono::milliseconds m_request_timeout{std::chrono::seconds(30)};
+
+  private:
+	void refreshLoop();
+
+	std::string m_name;
+	std::shared_ptr<const AWSCredential> m_current;
+	// When m_current was fetched.
+	std::chrono::system_clock::time_point m_fetched;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop{false};
+};
+
+// AssumeRoleWithWebIdentity against an STS endpoint.  The token file is
+// read for every refresh, since whatever issues the token rotates it too.
+class WebIdentityCredentialProvider : public CredentialProvider {
+  public:
+	WebIdentityCredentialProvider(const std::string &endpoint,
+								  const std::string &roleArn,
+								  const std::string &tokenFile,
+								  const std::string &sessionName,
+								  XrdSysError &log)
+		: CredentialProvider("web identity " + roleArn, log),
+		  m_endpoint(endpoint), m_role_arn(roleArn), m_token_file(tokenFile),
+		  m_session_name(sessionName) {}
+	~WebIdentityCredentialProvider() override;
+
+  protected:
+	bool fetch(std::shared_ptr<const AWSCredential> &credential,
+			   std::string &err) override;
+
+  private:
+	std::string m_endpoint;
+	std::string m_role_arn;
+	std::string m_token_file;
+	std::string m_session_name;
+};
+
+// An instance or container metadata endpoint.  A URL ending in '/' is an
+// EC2 security-credentials listing: the first role it names is fetched from
+// below it, with an IMDSv2 session token when the endpoint issues one.  Any
+// other URL returns the credentials directly, as the ECS endpoint does; if
+// `tokenFile` is set, its contents are sent as the Authorization header.
+class MetadataCredentialProvider : public CredentialProvider {
+  public:
+	MetadataCredentialProvider(const std::string &url,
+							   const std::string &tokenFile, XrdSysError &log)
+		: CredentialProvider("metadata endpoint " + url, log), m_url(url),
+		  m_token_file(tokenFile) {}
+	~MetadataCredentialProvider() override;
+
+  protected:
+	bool fetch(std::shared_ptr<const AWSCredential> &credential,
+			   std::string &err) override;
+
+  private:
+	std::string m_url;
+	std::string m_token_file;
+};
+
+// An external program, as with the AWS CLI's credential_process setting.
+// The command is run with /bin/sh and must print a JSON object with
+// "Version": 1, AccessKeyId, SecretAccessKey and optionally SessionToken
+// and Expiration; without an Expiration the credentials are never
+// refreshed.
+class ProcessCredentialProvider : public CredentialProvider {
+  public:
+	ProcessCredentialProvider(const std::string &command, XrdSysError &log)
+		: CredentialProvider("credential process", log), m_command(command) {}
+	~ProcessCredentialProvider() override;
+
+  protected:
+	bool fetch(std::shared_ptr<const AWSCredential> &credential,
+			   std::string &err) override;
+
+  private:
+	std::string m_command;
+};
@@ -0,0 +1,233 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "EndpointIPManager.hh"
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Weight of the newest request in an address's moving averages.
+const double g_weight = 0.2;
+// An address whose failure average passes this is demoted; four failures
+// in a row from a clean record are enough.
+const double g_error_threshold = 0.5;
+// An address is too slow when, over at least g_min_samples requests, its
+// average time to first byte exceeds g_slow_factor times the median of its
+// peers' and is g_slow_margin longer in absolute terms.
+const uint64_t g_min_samples = 8;
+const double g_slow_factor = 4;
+const double g_slow_margin = 20000; // microseconds
+
+bool isAddress(const std::string &host) {
+	unsigned char buffer[sizeof(struct in6_addr)];
+	return host.empty() || host[0] == '[' ||
+		   inet_pton(AF_INET, host.c_str(), buffer) == 1 ||
+		   inet_pton(AF_INET6, host.c_str(), buffer) == 1;
+}
+
+std::string endpointKey(const std::string &host, int port) {
+	return host + ":" + std::to_string(port);
+}
+
+} // namespace
+
+constexpr std::chrono::seconds EndpointIPManager::demotion;
+
+EndpointIPManager::~EndpointIPManager() {}
+
+EndpointIPManager &EndpointIPManager::Instance() {
+	static EndpointIPManager instance;
+	return instance;
+}
+
+bool EndpointIPManager::Resolve(const std::string &host, int port,
+								std::vector<std::string> &addresses) {
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *result = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+					&result) != 0) {
+		return false;
+	}
+	addresses.clear();
+	for (auto info = result; info; info = info->ai_next) {
+		char name[INET6_ADDRSTRLEN];
+		const void *addr;
+		if (info->ai_family == AF_INET) {
+			addr = &reinterpret_cast<struct sockaddr_in *>(info->ai_addr)
+						->sin_addr;
+		} else if (info->ai_family == AF_INET6) {
+			addr = &reinterpret_cast<struct sockaddr_in6 *>(info->ai_addr)
+						->sin6_addr;
+		} else {
+			continue;
+		}
+		if (inet_ntop(info->ai_family, addr, name, sizeof(name)) &&
+			std::find(addresses.begin(), addresses.end(), name) ==
+				addresses.end()) {
+			addresses.emplace_back(name);
+		}
+	}
+	freeaddrinfo(result);
+	return !addresses.empty();
+}
+
+bool EndpointIPManager::Pick(const std::string &host, int port,
+							 std::string &address) {
+	if (!enabled() || isAddress(host)) {
+		return false;
+	}
+	std::string key = endpointKey(host, port);
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::seconds interval(m_interval.load(std::memory_order_relaxed));
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Endpoint &endpoint = m_endpoints[key];
+		bool stale = endpoint.resolved.time_since_epoch().count() == 0 ||
+					 now - endpoint.resolved >= interval;
+		if (!stale || endpoint.resolving) {
+			// Another thread refreshes a stale list; meanwhile the old one
+			// serves.
+			return choose(endpoint, now, address);
+		}
+		endpoint.resolving = true;
+	}
+
+	// Resolve without holding the lock, as it may take a while.
+	std::vector<std::string> resolved;
+	bool ok = Resolve(host, port, resolved);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Endpoint &endpoint = m_endpoints[key];
+	endpoint.resolving = false;
+	// A failure is retried after the interval too; until then the old
+	// addresses, if any, are used.
+	endpoint.resolved = now;
+	if (ok) {
+		// Addresses that are still listed keep their history.
+		std::vector<Address> addresses(resolved.size());
+		for (size_t idx = 0; idx < resolved.size(); idx++) {
+			auto old = std::find_if(
+				endpoint.addresses.begin(), endpoint.addresses.end(),
+				[&](const Address &addr) { return addr.ip == resolved[idx]; });
+			if (old != endpoint.addresses.end()) {
+				addresses[idx] = std::move(*old);
+			} else {
+				addresses[idx].ip = resolved[idx];
+			}
+		}
+		endpoint.addresses = std::move(addresses);
+	}
+	return choose(endpoint, now, address);
+}
+
+bool EndpointIPManager::choose(Endpoint &endpoint,
+							   std::chrono::steady_clock::time_point now,
+							   std::string &address) {
+	size_t count = endpoint.addresses.size();
+	if (count == 0) {
+		return false;
+	}
+	for (size_t idx = 0; idx < count; idx++) {
+		size_t pos = (endpoint.next + idx) % count;
+		if (endpoint.addresses[pos].demotedUntil <= now) {
+			endpoint.next = pos + 1;
+			address = endpoint.addresses[pos].ip;
+			return true;
+		}
+	}
+	// Better to try a demoted address than none.
+	address = endpoint.addresses[endpoint.next++ % count].ip;
+	return true;
+}
+
+void EndpointIPManager::Report(const std::string &host, int port,
+							   const std::string &address, bool failed,
+							   std::chrono::microseconds latency) {
+	std::string key = endpointKey(host, port);
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto endpoint = m_endpoints.find(key);
+	if (endpoint == m_endpoints.end()) {
+		return;
+	}
+	auto &addresses = endpoint->second.addresses;
+	auto addr = std::find_if(
+		addresses.begin(), addresses.end(),
+		[&](const Address &entry) { return entry.ip == address; });
+	if (addr == addresses.end()) {
+		return;
+	}
+
+	addr->errors = addr->errors * (1 - g_weight) + (failed ? g_weight : 0);
+	if (addr->errors > g_error_threshold) {
+		// Start afresh once the demotion is over.
+		addr->demotedUntil = now + demotion;
+		addr->errors = 0;
+		return;
+	}
+	if (failed) {
+		return;
+	}
+	addr->latency = addr->samples ? addr->latency * (1 - g_weight) +
+										latency.count() * g_weight
+								  : latency.count();
+	if (++addr->samples < g_min_samples) {
+		return;
+	}
+
+	std::vector<double> peers;
+	for (const auto &entry : addresses) {
+		if (&entry != &*addr && entry.samples >= g_min_samples &&
+			entry.demotedUntil <= now) {
+			peers.push_back(entry.latency);
+		}
+	}
+	if (peers.empty()) {
+		return;
+	}
+	std::nth_element(peers.begin(), peers.begin() + peers.size() / 2,
+					 peers.end());
+	double median = peers[peers.size() / 2];
+	if (addr->latency > g_slow_factor * median &&
+		addr->latency - median > g_slow_margin) {
+		addr->demotedUntil = now + demotion;
+		addr->latency = 0;
+		addr->samples = 0;
+	}
+}
+
+std::vector<std::string> EndpointIPManager::Addresses(const std::string &host,
+													  int port) {
+	std::vector<std::string> result;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto endpoint = m_endpoints.find(endpointKey(host, port));
+	if (endpoint != m_endpoints.end()) {
+		for (const auto &addr : endpoint->second.addresses) {
+			result.push_back(addr.ip);
+		}
+	}
+	return result;
+}
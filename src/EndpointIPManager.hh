@@ -0,0 +1,102 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Spreads new connections to a service host over all of the addresses its
+// name resolves to.  Left to itself, curl connects to the first address
+// every time, so a host fronted by many servers gets the bandwidth of one.
+// Each host is re-resolved at most once per refresh interval, connections
+// go to its addresses in turn, and an address that keeps failing or is far
+// slower than its peers is skipped for a while.
+class EndpointIPManager {
+  public:
+	EndpointIPManager() {}
+	virtual ~EndpointIPManager();
+
+	// The manager used by every request; disabled until it is given a
+	// refresh interval.
+	static EndpointIPManager &Instance();
+
+	// Re-resolve each host once per `interval`; zero disables the manager.
+	void SetRefreshInterval(std::chrono::seconds interval) {
+		m_interval.store(interval.count(), std::memory_order_relaxed);
+	}
+	bool enabled() const {
+		return m_interval.load(std::memory_order_relaxed) > 0;
+	}
+
+	// Set `address` to the address the next connection to `host`:`port`
+	// should use.  Returns false, leaving the choice to curl, if the
+	// manager is disabled, `host` is an address already or it does not
+	// resolve.
+	bool Pick(const std::string &host, int port, std::string &address);
+
+	// Record how a request sent to `address` went: whether it failed, at
+	// the connection or with a 5xx, and its time to first byte.
+	void Report(const std::string &host, int port, const std::string &address,
+				bool failed, std::chrono::microseconds latency);
+
+	// The addresses currently known for `host`:`port`.
+	std::vector<std::string> Addresses(const std::string &host, int port);
+
+	// How long a demoted address is skipped.
+	static constexpr std::chrono::seconds demotion{30};
+
+  protected:
+	// Set `addresses` to the distinct addresses of `host`, in the
+	// resolver's order; virtual so tests can supply their own.
+	virtual bool Resolve(const std::string &host, int port,
+						 std::vector<std::string> &addresses);
+
+  private:
+	struct Address {
+		std::string ip;
+		// Moving averages of the failure rate, from 0 to 1, and of the
+		// time to first byte of successful requests, in microseconds.
+		double errors{0};
+		double latency{0};
+		uint64_t samples{0};
+		std::chrono::steady_clock::time_point demotedUntil;
+	};
+	struct Endpoint {
+		std::vector<Address> addresses;
+		std::chrono::steady_clock::time_point resolved;
+		size_t next{0};
+		bool resolving{false};
+	};
+
+	// Choose the next address of `endpoint` in turn, skipping demoted ones
+	// unless all of them are.
+	static bool choose(Endpoint &endpoint,
+					   std::chrono::steady_clock::time_point now,
+					   std::string &address);
+
+	std::atomic<int64_t> m_interval{0}; // seconds
+	std::mutex m_mutex;
+	// Keyed by "host:port".
+	std::map<std::string, Endpoint> m_endpoints;
+};
@@ -24,13 +24,17 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include <XrdSys/XrdSysError.hh>
 #include <curl/curl.h>
 #include <openssl/hmac.h>
 
 #include "HTTPCommands.hh"
+#include "EndpointIPManager.hh"
+#include "HTTPMultiplexer.hh"
 #include "logging.hh"
+#include "probes.hh"
 #include "shortfile.hh"
 #include "stl_string_utils.hh"
 
@@ -44,21 +48,43 @@ using namespace XrdHTTPServer;
 //  passed to your function, it'll signal an error to the library. This will
 //  abort the transfer and return CURLE_WRITE_ERROR."
 //
-// We also make extensive use of this function in the XML parsing code,
-// for pretty much exactly the same reason.
-//
-size_t appendToString(const void *ptr, size_t size, size_t nmemb, void *str) {
+size_t HTTPRequest::handleResults(const void *ptr, size_t size, size_t nmemb,
+								  void *req) {
 	if (size == 0 || nmemb == 0) {
 		return 0;
 	}
 
-	std::string source((const char *)ptr, size * nmemb);
-	std::string *ssptr = (std::string *)str;
-	ssptr->append(source);
+	HTTPRequest *me = static_cast<HTTPRequest *>(req);
+	auto start = std::chrono::steady_clock::now();
+	me->resultString.append(static_cast<const char *>(ptr), size * nmemb);
+	me->timing.copy += std::chrono::duration_cast<std::chrono::microseconds>(
+						   std::chrono::steady_clock::now() - start)
+						   .count();
 
 	return (size * nmemb);
 }
 
+size_t HTTPRequest::handleHeader(char *buffer, size_t size, size_t nitems,
+								 void *req) {
+	std::string_view line(buffer, size * nitems);
+	auto colon = line.find(':');
+	if (colon == std::string_view::npos) {
+		// The status line or the blank line ending the headers.
+		return size * nitems;
+	}
+	auto value = line.substr(colon + 1);
+	auto begin = value.find_first_not_of(" \t\r\n");
+	auto end = value.find_last_not_of(" \t\r\n");
+	value = begin == std::string_view::npos
+				? std::string_view()
+				: value.substr(begin, end - begin + 1);
+	static_cast<HTTPRequest *>(req)->responseHeader(line.substr(0, colon),
+													value);
+	return size * nitems;
+}
+
+void HTTPRequest::responseHeader(std::string_view, std::string_view) {}
+
 HTTPRequest::~HTTPRequest() {}
 
 #define SET_CURL_SECURITY_OPTION(A, B, C)                                      \
@@ -73,6 +99,19 @@ HTTPRequest::~HTTPRequest() {}
 		}                                                                      \
 	}
 
+// `url` as it may be logged or traced: without its query string, which in a
+// pre-signed URL carries the credential, session token and signature.  The
+// URL itself is returned when there is nothing to remove.
+static const std::string &loggableURL(const std::string &url,
+									  std::string &buffer) {
+	auto query = url.find('?');
+	if (query == std::string::npos) {
+		return url;
+	}
+	buffer.assign(url, 0, query);
+	return buffer;
+}
+
 bool HTTPRequest::parseProtocol(const std::string &url, std::string &protocol) {
 
 	auto i = url.find("://");
@@ -88,8 +127,9 @@ bool HTTPRequest::SendHTTPRequest(const std::string &payload) {
 	if ((protocol != "http") && (protocol != "https")) {
 		this->errorCode = "E_INVALID_SERVICE_URL";
 		this->errorMessage = "Service URL not of a known protocol (http[s]).";
+		std::string buffer;
 		m_log.Log(LogMask::Warning, "HTTPRequest::SendHTTPRequest",
-				  "Host URL '", hostUrl.c_str(),
+				  "Host URL '", loggableURL(hostUrl, buffer).c_str(),
 				  "' not of a known protocol (http[s]).");
 		return false;
 	}
@@ -164,6 +204,48 @@ size_t read_callback(char *buffer, size_t size, size_t n, void *v) {
 	return request;
 }
 
+// Split the authority of `uri` into host and port, the port defaulting to
+// the protocol's.  IPv6 addresses keep their brackets.
+static bool parseHostPort(const std::string &uri, const std::string &protocol,
+						  std::string &host, int &port) {
+	auto begin = uri.find("://");
+	if (begin == std::string::npos) {
+		return false;
+	}
+	begin += 3;
+	auto end = uri.find_first_of("/?#", begin);
+	std::string authority = substring(uri, begin, end);
+	auto at = authority.rfind('@');
+	if (at != std::string::npos) {
+		authority.erase(0, at + 1);
+	}
+	auto colon = authority.rfind(':');
+	if (colon != std::string::npos &&
+		authority.find(']', colon) == std::string::npos) {
+		port = atoi(authority.c_str() + colon + 1);
+		host = authority.substr(0, colon);
+	} else {
+		port = protocol == "https" ? 443 : 80;
+		host = authority;
+	}
+	return !host.empty() && port > 0;
+}
+
+// A progress callback that aborts the transfer once the request's cancel
+// flag has been raised.
+int cancel_callback(void *clientp, curl_off_t, curl_off_t, curl_off_t,
+					curl_off_t) {
+	const std::atomic<bool> *flag = (const std::atomic<bool> *)clientp;
+	return flag->load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+// Applies an export's socket options to each socket curl creates, before it
+// connects, so that the buffer sizes can take part in window scaling.
+int sockopt_callback(void *clientp, curl_socket_t fd, curlsocktype) {
+	static_cast<const TransportOptions *>(clientp)->ApplySocketOptions(fd);
+	return CURL_SOCKOPT_OK;
+}
+
 bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 									  const std::string &uri,
 									  const std::string &payload) {
@@ -192,13 +274,111 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 		return false;
 	}
 
-	rv = curl_easy_setopt(curl.get(), CURLOPT_URL, uri.c_str());
+	// A Unix domain socket never leaves the host, so TLS buys nothing on
+	// it; the scheme is the only part of the URL that changes.
+	bool unixSocket = transport && !transport->unix_socket.empty();
+	std::string plainUri;
+	if (unixSocket && uri.compare(0, 8, "https://") == 0) {
+		plainUri = "http://" + uri.substr(8);
+	}
+	rv = curl_easy_setopt(curl.get(), CURLOPT_URL,
+						  plainUri.empty() ? uri.c_str() : plainUri.c_str());
 	if (rv != CURLE_OK) {
 		this->errorCode = "E_CURL_LIB";
 		this->errorMessage = "curl_easy_setopt( CURLOPT_URL ) failed.";
 		return false;
 	}
 
+	if (unixSocket) {
+		rv = curl_easy_setopt(curl.get(), CURLOPT_UNIX_SOCKET_PATH,
+							  transport->unix_socket.c_str());
+		if (rv != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage =
+				"curl_easy_setopt( CURLOPT_UNIX_SOCKET_PATH ) failed.";
+			return false;
+		}
+	}
+
+	// Connect to the address the endpoint manager picks, if it is enabled;
+	// the URL, and so the Host header and certificate check, are unchanged.
+	// Multiplexed requests share a DNS cache and reuse each other's
+	// connections, so a pinned address need not be the one they use; they
+	// are left to curl.
+	bool multiplexed = transport && transport->http2;
+	auto &endpoints = EndpointIPManager::Instance();
+	std::string endpointHost, endpointAddress;
+	int endpointPort = 0;
+	std::unique_ptr<struct curl_slist, decltype(&curl_slist_free_all)> resolve(
+		nullptr, &curl_slist_free_all);
+	if (!unixSocket && !multiplexed && endpoints.enabled() &&
+		parseHostPort(uri, protocol, endpointHost, endpointPort) &&
+		endpoints.Pick(endpointHost, endpointPort, endpointAddress)) {
+		std::string entry = endpointHost + ":" + std::to_string(endpointPort) +
+							":" +
+							(endpointAddress.find(':') == std::string::npos
+								 ? endpointAddress
+								 : "[" + endpointAddress + "]");
+		resolve.reset(curl_slist_append(nullptr, entry.c_str()));
+		if (!resolve || curl_easy_setopt(curl.get(), CURLOPT_RESOLVE,
+										 resolve.get()) != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage = "curl_easy_setopt( CURLOPT_RESOLVE ) failed.";
+			return false;
+		}
+	}
+
+	// Negotiate HTTP/2 where TLS allows it, and have a new request wait for
+	// a connection being set up rather than open another, so concurrent
+	// requests share it.
+	if (multiplexed) {
+		rv = curl_easy_setopt(curl.get(), CURLOPT_HTTP_VERSION,
+							  (long)CURL_HTTP_VERSION_2TLS);
+		if (rv != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage =
+				"curl_easy_setopt( CURLOPT_HTTP_VERSION ) failed.";
+			return false;
+		}
+		rv = curl_easy_setopt(curl.get(), CURLOPT_PIPEWAIT, 1L);
+		if (rv != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage =
+				"curl_easy_setopt( CURLOPT_PIPEWAIT ) failed.";
+			return false;
+		}
+	}
+
+	if (transport) {
+		if (transport->tunesSockets()) {
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_SOCKOPTFUNCTION,
+									 sockopt_callback);
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_SOCKOPTDATA,
+									 transport);
+		}
+		SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_TCP_NODELAY,
+								 transport->tcp_nodelay ? 1L : 0L);
+		if (transport->tcp_keepalive.count()) {
+			long interval = transport->tcp_keepalive.count();
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_TCP_KEEPALIVE, 1L);
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_TCP_KEEPIDLE,
+									 interval);
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_TCP_KEEPINTVL,
+									 interval);
+		}
+		// curl clamps both sizes to the range it supports.
+		if (transport->download_buffer_size) {
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_BUFFERSIZE,
+									 (long)transport->download_buffer_size);
+		}
+#if LIBCURL_VERSION_NUM >= 0x073e00
+		if (transport->upload_buffer_size) {
+			SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_UPLOAD_BUFFERSIZE,
+									 (long)transport->upload_buffer_size);
+		}
+#endif
+	}
+
 	if (httpVerb == "HEAD") {
 		rv = curl_easy_setopt(curl.get(), CURLOPT_NOBODY, 1);
 		if (rv != CURLE_OK) {
@@ -255,13 +435,58 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 		}
 	}
 
-	rv = curl_easy_setopt(curl.get(), CURLOPT_NOPROGRESS, 1);
+	rv = curl_easy_setopt(curl.get(), CURLOPT_NOPROGRESS, cancelFlag ? 0 : 1);
 	if (rv != CURLE_OK) {
 		this->errorCode = "E_CURL_LIB";
 		this->errorMessage = "curl_easy_setopt( CURLOPT_NOPROGRESS ) failed.";
 		return false;
 	}
 
+	if (cancelFlag) {
+		rv = curl_easy_setopt(curl.get(), CURLOPT_XFERINFOFUNCTION,
+							  cancel_callback);
+		if (rv != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage =
+				"curl_easy_setopt( CURLOPT_XFERINFOFUNCTION ) failed.";
+			return false;
+		}
+
+		rv = curl_easy_setopt(curl.get(), CURLOPT_XFERINFODATA,
+							  const_cast<std::atomic<bool> *>(cancelFlag));
+		if (rv != CURLE_OK) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage =
+				"curl_easy_setopt( CURLOPT_XFERINFODATA ) failed.";
+			return false;
+		}
+	}
+
+	if (connectTimeout.count()) {
+		SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_CONNECTTIMEOUT_MS,
+								 (long)connectTimeout.count());
+	}
+	if (totalTimeout.count()) {
+		SET_CURL_SECURITY_OPTION(curl.get(), CURLOPT_TIMEOUT_MS,
+								 (long)totalTimeout.count());
+	}
+
+	rv = curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION,
+						  &HTTPRequest::handleHeader);
+	if (rv != CURLE_OK) {
+		this->errorCode = "E_CURL_LIB";
+		this->errorMessage =
+			"curl_easy_setopt( CURLOPT_HEADERFUNCTION ) failed.";
+		return false;
+	}
+
+	rv = curl_easy_setopt(curl.get(), CURLOPT_HEADERDATA, this);
+	if (rv != CURLE_OK) {
+		this->errorCode = "E_CURL_LIB";
+		this->errorMessage = "curl_easy_setopt( CURLOPT_HEADERDATA ) failed.";
+		return false;
+	}
+
 	if (includeResponseHeader) {
 		rv = curl_easy_setopt(curl.get(), CURLOPT_HEADER, 1);
 		if (rv != CURLE_OK) {
@@ -271,7 +496,8 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 		}
 	}
 
-	rv = curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, &appendToString);
+	rv = curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION,
+						  &HTTPRequest::handleResults);
 	if (rv != CURLE_OK) {
 		this->errorCode = "E_CURL_LIB";
 		this->errorMessage =
@@ -279,7 +505,7 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 		return false;
 	}
 
-	rv = curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &this->resultString);
+	rv = curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, this);
 	if (rv != CURLE_OK) {
 		this->errorCode = "E_CURL_LIB";
 		this->errorMessage = "curl_easy_setopt( CURLOPT_WRITEDATA ) failed.";
@@ -372,6 +598,18 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 			return false;
 		}
 	}
+	// An empty header stops curl sending its own.  It is added here, after
+	// signing, so it is not part of the signed headers.
+	if (transport && !transport->expect_100_continue) {
+		struct curl_slist *list = curl_slist_append(header_slist, "Expect:");
+		if (list == NULL) {
+			this->errorCode = "E_CURL_LIB";
+			this->errorMessage = "curl_slist_append() failed.";
+			curl_slist_free_all(header_slist);
+			return false;
+		}
+		header_slist = list;
+	}
 
 	rv = curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, header_slist);
 	if (rv != CURLE_OK) {
@@ -383,10 +621,34 @@ bool HTTPRequest::sendPreparedRequest(const std::string &protocol,
 		return false;
 	}
 
+	auto requestStart = std::chrono::steady_clock::now();
+	std::string logBuffer;
+	const std::string &logUri = loggableURL(uri, logBuffer);
+	XRDHTTP_PROBE3(request__start, this, httpVerb.c_str(), logUri.c_str());
 retry:
-	rv = curl_easy_perform(curl.get());
+	timing.queue = std::chrono::duration_cast<std::chrono::microseconds>(
+					   std::chrono::steady_clock::now() - createTime)
+					   .count() -
+				   timing.signing;
+	timing.copy = 0;
+	if (multiplexed) {
+		rv = HTTPMultiplexer::Instance(transport->http2_max_streams)
+				 .Perform(curl.get());
+	} else {
+		rv = curl_easy_perform(curl.get());
+	}
+	recordTiming(curl.get());
+	recordAttempt(curl.get());
+	if (!endpointAddress.empty()) {
+		long code = 0;
+		curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &code);
+		endpoints.Report(endpointHost, endpointPort, endpointAddress,
+						 rv != CURLE_OK || code >= 500,
+						 std::chrono::microseconds(timing.ttfb));
+	}
 
 	if (rv != 0) {
+		recordStats(requestStart, true, StatsError::Network);
 
 		this->errorCode = "E_CURL_IO";
 		std::ostringstream error;
@@ -408,6 +670,7 @@ retry:
 		// bad news.  Since we're already terminally failing the request,
 		// don't bother to check if this was our last chance at retrying.
 
+		recordStats(requestStart, true, StatsError::Network);
 		this->errorCode = "E_CURL_LIB";
 		this->errorMessage = "curl_easy_getinfo() failed.";
 		if (header_slist) {
@@ -421,6 +684,10 @@ retry:
 		(resultString.find("<Error><Code>RequestLimitExceeded</Code>") !=
 		 std::string::npos)) {
 		resultString.clear();
+		XRDHTTP_PROBE3(request__retry, this, logUri.c_str(), responseCode);
+		if (stats) {
+			stats->op(statsOp()).recordRetry();
+		}
 		goto retry;
 	}
 
@@ -429,6 +696,13 @@ retry:
 	}
 
 	if (responseCode != this->expectedResponseCode) {
+		StatsError error = StatsError::Client;
+		if (responseCode == 429 || responseCode == 503) {
+			error = StatsError::Throttled;
+		} else if (responseCode >= 500) {
+			error = StatsError::Server;
+		}
+		recordStats(requestStart, true, error);
 		formatstr(this->errorCode,
 				  "E_HTTP_RESPONSE_NOT_EXPECTED (response %lu != expected %lu)",
 				  responseCode, this->expectedResponseCode);
@@ -442,9 +716,109 @@ retry:
 		return false;
 	}
 
+	recordStats(requestStart, false);
 	return true;
 }
 
+StatsOp HTTPRequest::statsOp() const {
+	if (httpVerb == "HEAD") {
+		return StatsOp::Head;
+	} else if (httpVerb == "GET") {
+		return StatsOp::Get;
+	}
+	return StatsOp::Put;
+}
+
+// Accumulate the bytes moved by one attempt and whether it could reuse an
+// already-open connection.
+void HTTPRequest::recordAttempt(void *handle) {
+	CURL *curl = static_cast<CURL *>(handle);
+	curl_off_t bytes;
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes) ==
+		CURLE_OK) {
+		statsBytesIn += bytes;
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes) == CURLE_OK) {
+		statsBytesOut += bytes;
+	}
+	long connects = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) ==
+			CURLE_OK &&
+		connects == 0) {
+		statsReused++;
+	}
+}
+
+void HTTPRequest::recordStats(std::chrono::steady_clock::time_point start,
+							  bool failed, StatsError error) {
+	int64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+					   std::chrono::steady_clock::now() - start)
+					   .count();
+	std::string buffer;
+	XRDHTTP_PROBE7(request__end, this, httpVerb.c_str(),
+				   loggableURL(hostUrl, buffer).c_str(), responseCode, usec,
+				   statsBytesIn, statsBytesOut);
+	if (!stats) {
+		return;
+	}
+	OpStats &op = stats->op(statsOp());
+	op.recordRequest(usec, statsBytesIn, statsBytesOut, statsReused);
+	if (failed) {
+		op.recordError(error);
+	}
+}
+
+// Collect curl's view of where the time went and, if the request was slow
+// enough, log the whole breakdown.
+void HTTPRequest::recordTiming(void *handle) {
+	CURL *curl = static_cast<CURL *>(handle);
+	curl_off_t value;
+	if (curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &value) ==
+		CURLE_OK) {
+		timing.dns = value;
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &value) ==
+		CURLE_OK) {
+		timing.connect = value;
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &value) ==
+		CURLE_OK) {
+		timing.tls = value;
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &value) ==
+		CURLE_OK) {
+		timing.ttfb = value;
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &value) == CURLE_OK) {
+		timing.total = value;
+	}
+
+	if (!transport) {
+		return;
+	}
+	auto threshold = std::chrono::duration_cast<std::chrono::microseconds>(
+		transport->slow_request_threshold);
+	if (threshold.count() == 0 || timing.total < threshold.count()) {
+		return;
+	}
+
+	long code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	auto range = headers.find("Range");
+	std::string buffer, msg;
+	formatstr(msg,
+			  "%s %s range=%s status=%ld total=%.3fms queue=%.3fms "
+			  "sign=%.3fms dns=%.3fms connect=%.3fms tls=%.3fms "
+			  "ttfb=%.3fms copy=%.3fms",
+			  httpVerb.c_str(), loggableURL(hostUrl, buffer).c_str(),
+			  range == headers.end() ? "-" : range->second.c_str(), code,
+			  timing.total / 1000.0, timing.queue / 1000.0,
+			  timing.signing / 1000.0, timing.dns / 1000.0,
+			  timing.connect / 1000.0, timing.tls / 1000.0,
+			  timing.ttfb / 1000.0, timing.copy / 1000.0);
+	m_log.Emsg("SlowRequest", msg.c_str());
+}
+
 // ---------------------------------------------------------------------------
 
 HTTPUpload::~HTTPUpload() {}
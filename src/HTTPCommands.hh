@@ -18,9 +18,16 @@
 
 #pragma once
 
+#include "Stats.hh"
+#include "TransportOptions.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 
 class XrdSysError;
 
@@ -28,7 +35,8 @@ class HTTPRequest {
   public:
 	HTTPRequest(const std::string &hostUrl, XrdSysError &log)
 		: hostUrl(hostUrl), requiresSignature(false), responseCode(0),
-		  includeResponseHeader(false), httpVerb("POST"), m_log(log) {
+		  includeResponseHeader(false), httpVerb("POST"),
+		  createTime(std::chrono::steady_clock::now()), m_log(log) {
 		// Parse the URL and populate
 		// What to do if the function returns false?
 		// TODO: Figure out best way to deal with this
@@ -49,6 +57,46 @@ class HTTPRequest {
 	unsigned long getResponseCode() const { return responseCode; }
 	const std::string &getResultString() const { return resultString; }
 
+	// Abort the transfer as soon as `*flag` becomes true.  Used when several
+	// sources race for the same byte range and only the first one matters.
+	void SetCancelFlag(const std::atomic<bool> *flag) { cancelFlag = flag; }
+
+	// Fail an attempt that takes longer than `connect` to connect or `total`
+	// to finish.  Zero, the default, leaves it to curl, which gives up on
+	// connecting after 300s and never on the whole transfer.
+	void SetTimeouts(std::chrono::milliseconds connect,
+					 std::chrono::milliseconds total) {
+		connectTimeout = connect;
+		totalTimeout = total;
+	}
+
+	// Where the time went in the most recent attempt of this request, in
+	// microseconds.  The curl phases (dns through total) are cumulative from
+	// the start of the transfer, as curl reports them; tls is zero for plain
+	// HTTP.  queue covers everything between creating the request and
+	// starting the transfer other than signing, and copy is the time spent
+	// appending response bytes to the result buffer.
+	struct Timing {
+		int64_t queue{0};
+		int64_t signing{0};
+		int64_t dns{0};
+		int64_t connect{0};
+		int64_t tls{0};
+		int64_t ttfb{0};
+		int64_t total{0};
+		int64_t copy{0};
+	};
+	const Timing &getTiming() const { return timing; }
+
+	// Count this request, including its retries, in the statistics of an
+	// export.
+	void SetStats(ExportStats *stats) { this->stats = stats; }
+
+	// Send the request as `transport` says; it must outlive the request.
+	void SetTransport(const TransportOptions *transport) {
+		this->transport = transport;
+	}
+
 	// Currently only used in PUTS, but potentially useful elsewhere
 	struct Payload {
 		const std::string *data;
@@ -60,6 +108,23 @@ class HTTPRequest {
 							 const std::string &uri,
 							 const std::string &payload);
 
+	static size_t handleResults(const void *ptr, size_t size, size_t nmemb,
+								void *req);
+	static size_t handleHeader(char *buffer, size_t size, size_t nitems,
+							   void *req);
+	// Called for each header of each response, including those of a
+	// response that is retried, with the name as sent and the value
+	// trimmed.  Does nothing unless overridden.
+	virtual void responseHeader(std::string_view name, std::string_view value);
+	void recordTiming(void *curl);
+
+	// The operation class this request is counted under; by default derived
+	// from the HTTP verb.
+	virtual StatsOp statsOp() const;
+	void recordAttempt(void *curl);
+	void recordStats(std::chrono::steady_clock::time_point start, bool failed,
+					 StatsError error = StatsError::Network);
+
 	typedef std::map<std::string, std::string> AttributeValueMap;
 	AttributeValueMap query_parameters;
 	AttributeValueMap headers;
@@ -68,7 +133,8 @@ class HTTPRequest {
 	std::string protocol;
 
 	bool requiresSignature;
-	struct timespec signatureTime;
+	// Sign as of this time rather than now, when set; for tests.
+	struct timespec signatureTime = {0, 0};
 
 	std::string errorMessage;
 	std::string errorCode;
@@ -80,6 +146,18 @@ class HTTPRequest {
 
 	std::string httpVerb;
 	std::unique_ptr<HTTPRequest::Payload> callback_payload;
+	const std::atomic<bool> *cancelFlag{nullptr};
+	std::chrono::milliseconds connectTimeout{0};
+	std::chrono::milliseconds totalTimeout{0};
+
+	Timing timing;
+	std::chrono::steady_clock::time_point createTime;
+
+	ExportStats *stats{nullptr};
+	const TransportOptions *transport{nullptr};
+	uint64_t statsBytesIn{0};
+	uint64_t statsBytesOut{0};
+	uint64_t statsReused{0};
 
 	XrdSysError &m_log;
 };
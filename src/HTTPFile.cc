@@ -17,9 +17,12 @@
  ***************************************************************/
 
 #include "HTTPFile.hh"
+#include "AccessLog.hh"
 #include "HTTPCommands.hh"
 #include "HTTPFileSystem.hh"
+#include "MultiSourceDownload.hh"
 #include "logging.hh"
+#include "probes.hh"
 #include "stl_string_utils.hh"
 
 #include <XrdOuc/XrdOucEnv.hh>
@@ -30,7 +33,7 @@
 #include <XrdVersion.hh>
 #include <curl/curl.h>
 
-#include <filesystem>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -46,68 +49,42 @@ HTTPFileSystem *g_http_oss = nullptr;
 XrdVERSIONINFO(XrdOssGetFileSystem, HTTP);
 
 HTTPFile::HTTPFile(XrdSysError &log, HTTPFileSystem *oss)
-	: m_log(log), m_oss(oss), content_length(0), last_modified(0) {}
+	: m_log(log), m_oss(oss), m_export(nullptr), content_length(0),
+	  last_modified(0) {}
 
-// Ensures that path is of the form /storagePrefix/object and returns
-// the resulting object value.  The storagePrefix does not necessarily begin
-// with '/'
+// Ensures that path is of the form /storagePrefix/object for one of the
+// configured exports and returns that export along with the object value.
+// When several storage prefixes match, the longest one wins.  The
+// storagePrefix does not necessarily begin with '/'
 //
-// Examples:
+// Examples, with a single export:
 // /foo/bar, /foo/bar/baz -> baz
 // storage.com/foo, /storage.com/foo/bar -> bar
 // /baz, /foo/bar -> error
-int parse_path(const std::string &storagePrefixStr, const char *pathStr,
-			   std::string &object) {
-	const std::filesystem::path storagePath(pathStr);
-	const std::filesystem::path storagePrefix(storagePrefixStr);
-
-	auto prefixComponents = storagePrefix.begin();
-	auto pathComponents = storagePath.begin();
-
-	std::filesystem::path full;
-	std::filesystem::path prefix;
-
-	pathComponents++;
-	if (!storagePrefixStr.empty() && storagePrefixStr[0] == '/') {
-		prefixComponents++;
-	}
-
-	while (prefixComponents != storagePrefix.end() &&
-		   *prefixComponents == *pathComponents) {
-		full /= *prefixComponents++;
-		prefix /= *pathComponents++;
-	}
-
-	// Check that nothing diverged before reaching end of service name
-	if (prefixComponents != storagePrefix.end()) {
+int parse_path(const HTTPFileSystem &fs, const char *path,
+			   const HTTPExport *&exp, std::string &object) {
+	std::string_view objectView;
+	exp = fs.getExport(path, objectView);
+	if (!exp) {
 		return -ENOENT;
 	}
-
-	std::filesystem::path obj_path;
-	while (pathComponents != storagePath.end()) {
-		obj_path /= *pathComponents++;
-	}
-
-	object = obj_path.string();
+	object = objectView;
 	return 0;
 }
 
 int HTTPFile::Open(const char *path, int Oflag, mode_t Mode, XrdOucEnv &env) {
-	auto configured_hostname = m_oss->getHTTPHostName();
-	auto configured_hostUrl = m_oss->getHTTPHostUrl();
-	const auto &configured_url_base = m_oss->getHTTPUrlBase();
-	if (!configured_url_base.empty()) {
-		configured_hostUrl = configured_url_base;
-		configured_hostname = m_oss->getStoragePrefix();
-	}
-
+	auto start = std::chrono::steady_clock::now();
+	m_path = path;
 	//
 	// Check the path for validity.
 	//
+	const HTTPExport *exp = nullptr;
 	std::string object;
-	int rv = parse_path(configured_hostname, path, object);
+	int rv = parse_path(*m_oss, path, exp, object);
 
 	if (rv != 0) {
+		XRDHTTP_PROBE3(file__open, path, Oflag, rv);
+		AccessLog::Instance().Record(AccessOp::Open, m_path, 0, 0, rv, start);
 		return rv;
 	}
 
@@ -115,37 +92,75 @@ int HTTPFile::Open(const char *path, int Oflag, mode_t Mode, XrdOucEnv &env) {
 	// if you're creating a file on upload, you don't care.
 
 	this->object = object;
-	this->hostname = configured_hostname;
-	this->hostUrl = configured_hostUrl;
+	this->hostname = exp->getPrefix();
+	this->hostUrl = exp->getOrigin();
+	this->m_export = exp;
 
+	XRDHTTP_PROBE3(file__open, path, Oflag, 0);
+	AccessLog::Instance().Record(AccessOp::Open, m_path, 0, 0, 0, start);
 	return 0;
 }
 
 ssize_t HTTPFile::Read(void *buffer, off_t offset, size_t size) {
+	auto start = std::chrono::steady_clock::now();
+	// Large reads of an object whose size we know are spread across all the
+	// mirrors; we need the size so that no chunk runs past the end.
+	HTTPMirrorSet *mirrors = m_export ? m_export->mirror_set.get() : nullptr;
+	if (mirrors && content_length && size >= m_oss->getMultiSourceThreshold() &&
+		static_cast<size_t>(offset) < content_length) {
+		size_t available = std::min(size, content_length - offset);
+		m_log.Log(LogMask::Debug, "HTTPFile::Read",
+				  "Performing multi-source download of object",
+				  object.c_str());
+		HTTPMultiSourceDownload download(
+			*mirrors, object, m_oss->getMultiSourceChunkSize(), m_log,
+			m_export->stats);
+		download.SetTransport(&m_export->transport);
+		ssize_t rv = download.Read(buffer, offset, available);
+		XRDHTTP_PROBE5(file__read, object.c_str(), offset, size,
+					   probeMicrosSince(start), rv);
+		AccessLog::Instance().Record(AccessOp::Read, m_path, offset, size, rv,
+									 start);
+		return rv;
+	}
+
 	HTTPDownload download(this->hostUrl, this->object, m_log);
+	download.SetStats(m_export ? m_export->stats : nullptr);
+	download.SetTransport(m_export ? &m_export->transport : nullptr);
 	m_log.Log(
 		LogMask::Debug, "HTTPFile::Read",
 		"About to perform download from HTTPFile::Read(): hostname / object:",
 		hostname.c_str(), object.c_str());
 
 	if (!download.SendRequest(offset, size)) {
-		std::stringstream ss;
-		ss << "Failed to send GetObject command: " << download.getResponseCode()
-		   << "'" << download.getResultString() << "'";
-		m_log.Log(LogMask::Warning, "HTTPFile::Read", ss.str().c_str());
+		XRDHTTP_LOG_STREAM(m_log, LogMask::Warning, "HTTPFile::Read",
+						   "Failed to send GetObject command: "
+							   << download.getResponseCode() << "'"
+							   << download.getResultString() << "'");
+		XRDHTTP_PROBE5(file__read, object.c_str(), offset, size,
+					   probeMicrosSince(start), 0);
+		AccessLog::Instance().Record(AccessOp::Read, m_path, offset, size, 0,
+									 start);
 		return 0;
 	}
 
 	const std::string &bytes = download.getResultString();
 	memcpy(buffer, bytes.data(), bytes.size());
+	XRDHTTP_PROBE5(file__read, object.c_str(), offset, size,
+				   probeMicrosSince(start), bytes.size());
+	AccessLog::Instance().Record(AccessOp::Read, m_path, offset, size,
+								 bytes.size(), start);
 	return bytes.size();
 }
 
 int HTTPFile::Fstat(struct stat *buff) {
+	auto start = std::chrono::steady_clock::now();
 	m_log.Log(LogMask::Debug, "HTTPFile::Fstat",
 			  "About to perform HTTPFile::Fstat():", hostUrl.c_str(),
 			  object.c_str());
 	HTTPHead head(hostUrl, object, m_log);
+	head.SetStats(m_export ? m_export->stats : nullptr);
+	head.SetTransport(m_export ? &m_export->transport : nullptr);
 
 	if (!head.SendRequest()) {
 		// SendRequest() returns false for all errors, including ones
@@ -153,10 +168,12 @@ int HTTPFile::Fstat(struct stat *buff) {
 		// than code 200.  If xrootd wants us to distinguish between
 		// these cases, head.getResponseCode() is initialized to 0, so
 		// we can check.
-		std::stringstream ss;
-		ss << "Failed to send HeadObject command: " << head.getResponseCode()
-		   << "'" << head.getResultString() << "'";
-		m_log.Log(LogMask::Warning, "HTTPFile::Fstat", ss.str().c_str());
+		XRDHTTP_LOG_STREAM(m_log, LogMask::Warning, "HTTPFile::Fstat",
+						   "Failed to send HeadObject command: "
+							   << head.getResponseCode() << "'"
+							   << head.getResultString() << "'");
+		AccessLog::Instance().Record(AccessOp::Stat, m_path, 0, 0, -ENOENT,
+									 start);
 		return -ENOENT;
 	}
 
@@ -208,24 +225,40 @@ int HTTPFile::Fstat(struct stat *buff) {
 	buff->st_dev = 0;
 	buff->st_ino = 0;
 
+	AccessLog::Instance().Record(AccessOp::Stat, m_path, 0, content_length, 0,
+								 start);
 	return 0;
 }
 
 ssize_t HTTPFile::Write(const void *buffer, off_t offset, size_t size) {
+	auto start = std::chrono::steady_clock::now();
 	HTTPUpload upload(this->hostUrl, this->object, m_log);
+	upload.SetStats(m_export ? m_export->stats : nullptr);
+	upload.SetTransport(m_export ? &m_export->transport : nullptr);
 
 	std::string payload((char *)buffer, size);
 	if (!upload.SendRequest(payload, offset, size)) {
-		m_log.Emsg("Open", "upload.SendRequest() failed");
+		m_log.Log(LogMask::Warning, "HTTPFile::Write", "Failed to upload",
+				  m_path.c_str(), upload.getResultString().c_str());
+		XRDHTTP_PROBE5(file__write, object.c_str(), offset, size,
+					   probeMicrosSince(start), -ENOENT);
+		AccessLog::Instance().Record(AccessOp::Write, m_path, offset, size,
+									 -ENOENT, start);
 		return -ENOENT;
 	} else {
-		m_log.Emsg("Open", "upload.SendRequest() succeeded");
+		XRDHTTP_PROBE5(file__write, object.c_str(), offset, size,
+					   probeMicrosSince(start), 0);
+		AccessLog::Instance().Record(AccessOp::Write, m_path, offset, size, 0,
+									 start);
 		return 0;
 	}
 }
 
 int HTTPFile::Close(long long *retsz) {
-	m_log.Emsg("Close", "Closed our HTTP file");
+	XRDHTTP_PROBE1(file__close, object.c_str());
+	m_log.Log(LogMask::Debug, "HTTPFile::Close", "Closed", m_path.c_str());
+	AccessLog::Instance().Record(AccessOp::Close, m_path, 0, 0, 0,
+								 std::chrono::steady_clock::now());
 	return 0;
 }
 
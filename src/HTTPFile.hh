@@ -27,8 +27,8 @@
 
 #include <memory>
 
-int parse_path(const std::string &hostname, const char *path,
-			   std::string &object);
+int parse_path(const HTTPFileSystem &fs, const char *path,
+			   const HTTPExport *&exp, std::string &object);
 
 class HTTPFile : public XrdOssDF {
   public:
@@ -97,7 +97,9 @@ class HTTPFile : public XrdOssDF {
   private:
 	XrdSysError &m_log;
 	HTTPFileSystem *m_oss;
+	const HTTPExport *m_export;
 
+	std::string m_path;
 	std::string hostname;
 	std::string hostUrl;
 	std::string object;
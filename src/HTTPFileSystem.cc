@@ -17,6 +17,9 @@
  ***************************************************************/
 
 #include "HTTPFileSystem.hh"
+#include "AccessLog.hh"
+#include "EndpointIPManager.hh"
+#include "HTTPCommands.hh"
 #include "HTTPDirectory.hh"
 #include "HTTPFile.hh"
 #include "logging.hh"
@@ -42,7 +45,7 @@ using namespace XrdHTTPServer;
 
 HTTPFileSystem::HTTPFileSystem(XrdSysLogger *lp, const char *configfn,
 							   XrdOucEnv *envP)
-	: m_env(envP), m_log(lp, "httpserver_") {
+	: m_env(envP), m_log(lp, "httpserver_"), m_stats("httpserver", m_log) {
 	m_log.Say("------ Initializing the HTTP filesystem plugin.");
 	if (!Config(lp, configfn)) {
 		throw std::runtime_error("Failed to configure HTTP filesystem plugin.");
@@ -66,13 +69,54 @@ bool HTTPFileSystem::handle_required_config(const std::string &name_from_config,
 		return false;
 	}
 
-	std::stringstream ss;
-	ss << "Setting " << desired_name << "=" << source;
-	m_log.Log(LogMask::Debug, "Config", ss.str().c_str());
+	XRDHTTP_LOG_STREAM(m_log, LogMask::Debug, "Config",
+					   "Setting " << desired_name << "=" << source);
 	target = source;
 	return true;
 }
 
+bool HTTPFileSystem::add_export(std::unique_ptr<HTTPExport> exp) {
+	if (exp->url_base.empty()) {
+		if (exp->host_name.empty()) {
+			m_log.Emsg("Config", "httpserver.host_name not specified; this or "
+								 "httpserver.url_base are required");
+			return false;
+		}
+		if (exp->host_url.empty()) {
+			m_log.Emsg("Config", "httpserver.host_url not specified; this or "
+								 "httpserver.url_base are required");
+			return false;
+		}
+	}
+
+	if (!exp->mirrors.empty()) {
+		std::vector<std::string> urls;
+		urls.push_back(exp->getOrigin());
+		urls.insert(urls.end(), exp->mirrors.begin(), exp->mirrors.end());
+		exp->mirror_set.reset(new HTTPMirrorSet(urls));
+		for (const auto &mirror : exp->mirrors) {
+			m_log.Log(LogMask::Info, "Config", "Using mirror", mirror.c_str(),
+					  ("for " + exp->getOrigin()).c_str());
+		}
+	}
+
+	if (!m_export_trie.Insert(exp->getPrefix(), exp.get())) {
+		m_log.Emsg("Config", "Duplicate storage prefix",
+				   exp->getPrefix().c_str());
+		return false;
+	}
+	std::string prefix =
+		PathTrie<const HTTPExport *>::Normalize(exp->getPrefix());
+	if (prefix.empty()) {
+		prefix = "/";
+	}
+	exp->stats = m_stats.addExport(prefix);
+	m_log.Log(LogMask::Info, "Config", "Exporting", exp->getOrigin().c_str(),
+			  ("under " + prefix).c_str());
+	m_exports.push_back(std::move(exp));
+	return true;
+}
+
 bool HTTPFileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 	XrdOucEnv myEnv;
 	XrdOucStream Config(&m_log, getenv("XRDINSTANCE"), &myEnv, "=====> ");
@@ -87,6 +131,10 @@ bool HTTPFileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 	std::string value;
 	std::string attribute;
 	Config.Attach(cfgFD);
+	// Directives outside of an httpserver.begin/httpserver.end block describe
+	// a single, unnamed export, as they did before blocks were supported.
+	std::unique_ptr<HTTPExport> defaultExport(new HTTPExport());
+	std::unique_ptr<HTTPExport> blockExport;
 	while ((temporary = Config.GetMyFirstWord())) {
 		attribute = temporary;
 		if (attribute == "httpserver.trace") {
@@ -95,6 +143,30 @@ bool HTTPFileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 			}
 			continue;
 		}
+		if (attribute == "httpserver.begin") {
+			if (blockExport) {
+				m_log.Emsg("Config", "httpserver.begin found inside of an "
+									 "httpserver.begin block");
+				Config.Close();
+				return false;
+			}
+			blockExport.reset(new HTTPExport());
+			continue;
+		}
+		if (attribute == "httpserver.end") {
+			if (!blockExport) {
+				m_log.Emsg("Config",
+						   "httpserver.end found without httpserver.begin");
+				Config.Close();
+				return false;
+			}
+			if (!add_export(std::move(blockExport))) {
+				Config.Close();
+				return false;
+			}
+			continue;
+		}
+		HTTPExport &exp = blockExport ? *blockExport : *defaultExport;
 
 		temporary = Config.GetWord();
 		if (!temporary) {
@@ -103,31 +175,103 @@ bool HTTPFileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 		value = temporary;
 
 		if (!handle_required_config(attribute, "httpserver.host_name", value,
-									http_host_name) ||
+									exp.host_name) ||
 			!handle_required_config(attribute, "httpserver.host_url", value,
-									http_host_url) ||
+									exp.host_url) ||
 			!handle_required_config(attribute, "httpserver.url_base", value,
-									m_url_base) ||
+									exp.url_base) ||
 			!handle_required_config(attribute, "httpserver.storage_prefix",
-									value, m_storage_prefix)) {
+									value, exp.storage_prefix)) {
 			Config.Close();
 			return false;
 		}
-	}
 
-	if (m_url_base.empty()) {
-		if (http_host_name.empty()) {
-			m_log.Emsg("Config", "httpserver.host_name not specified; this or "
-								 "httpserver.url_base are required");
-			return false;
-		}
-		if (http_host_url.empty()) {
-			m_log.Emsg("Config", "httpserver.host_url not specified; this or "
-								 "httpserver.url_base are required");
-			return false;
+		if (attribute == "httpserver.mirror") {
+			exp.mirrors.push_back(value);
+		} else if (attribute.compare(0, 11, "httpserver.") == 0 &&
+				   TransportOptions::IsOption(attribute.substr(11))) {
+			std::string err;
+			if (!exp.transport.Set(attribute.substr(11), value, err)) {
+				m_log.Emsg("Config",
+						   ("Invalid value for " + attribute + ":").c_str(),
+						   value.c_str(), ("(" + err + ")").c_str());
+				Config.Close();
+				return false;
+			}
+		} else if (attribute == "httpserver.endpoint_resolve_interval") {
+			std::chrono::milliseconds interval;
+			if (!parseDuration(value, interval)) {
+				m_log.Emsg("Config", "Invalid value for "
+									 "httpserver.endpoint_resolve_interval:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+			EndpointIPManager::Instance().SetRefreshInterval(
+				std::chrono::duration_cast<std::chrono::seconds>(interval));
+		} else if (attribute == "httpserver.access_log") {
+			if (!AccessLog::Instance().Start(value, m_log)) {
+				Config.Close();
+				return false;
+			}
+		} else if (attribute == "httpserver.stats_file") {
+			StatsRegistry::Format format = StatsRegistry::Format::Json;
+			const char *formatName = Config.GetWord();
+			if (formatName && !StatsRegistry::parseFormat(formatName, format)) {
+				m_log.Emsg("Config", "Invalid format for httpserver.stats_file "
+									 "(must be 'json' or 'prometheus'):",
+						   formatName);
+				Config.Close();
+				return false;
+			}
+			m_stats.setFile(value, format);
+		} else if (attribute == "httpserver.stats_interval") {
+			std::chrono::milliseconds interval;
+			if (!parseDuration(value, interval) || interval.count() == 0) {
+				m_log.Emsg("Config",
+						   "Invalid value for httpserver.stats_interval:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+			m_stats.setInterval(interval);
+		} else if (attribute == "httpserver.multisource_threshold") {
+			if (!parseSize(value, m_multisource_threshold)) {
+				m_log.Emsg("Config", "Invalid value for "
+									 "httpserver.multisource_threshold:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+		} else if (attribute == "httpserver.multisource_chunk_size") {
+			if (!parseSize(value, m_multisource_chunk_size) ||
+				m_multisource_chunk_size == 0) {
+				m_log.Emsg("Config", "Invalid value for "
+									 "httpserver.multisource_chunk_size:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
 		}
 	}
 
+	if (blockExport) {
+		m_log.Emsg("Config", "httpserver.begin block is missing httpserver.end");
+		Config.Close();
+		return false;
+	}
+	// The unnamed export is required only when there are no blocks.
+	bool defaultUsed = !defaultExport->host_name.empty() ||
+					   !defaultExport->host_url.empty() ||
+					   !defaultExport->url_base.empty() ||
+					   !defaultExport->storage_prefix.empty();
+	if ((defaultUsed || m_exports.empty()) &&
+		!add_export(std::move(defaultExport))) {
+		Config.Close();
+		return false;
+	}
+	m_export_trie.Compile();
+
 	int retc = Config.LastError();
 	if (retc) {
 		m_log.Emsg("Config", -retc, "read config file", configfn);
@@ -136,6 +280,7 @@ bool HTTPFileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 	}
 
 	Config.Close();
+	m_stats.startWriter();
 	return true;
 }
 
@@ -151,20 +296,18 @@ XrdOssDF *HTTPFileSystem::newFile(const char *user) {
 
 int HTTPFileSystem::Stat(const char *path, struct stat *buff, int opts,
 						 XrdOucEnv *env) {
-	std::string error;
-
-	m_log.Emsg("Stat", "Stat'ing path", path);
+	m_log.Log(LogMask::Debug, "Stat", "Stat'ing path", path);
 
 	HTTPFile httpFile(m_log, this);
 	int rv = httpFile.Open(path, 0, (mode_t)0, *env);
 	if (rv) {
-		m_log.Emsg("Stat", "Failed to open path:", path);
+		m_log.Log(LogMask::Debug, "Stat",
+				  "Failed to open path:", path);
 	}
 	// Assume that HTTPFile::FStat() doesn't write to buff unless it succeeds.
 	rv = httpFile.Fstat(buff);
 	if (rv != 0) {
-		formatstr(error, "File %s not found.", path);
-		m_log.Emsg("Stat", error.c_str());
+		XRDHTTP_LOG(m_log, LogMask::Debug, "Stat", "File not found:", path);
 		return -ENOENT;
 	}
 
@@ -174,11 +317,9 @@ int HTTPFileSystem::Stat(const char *path, struct stat *buff, int opts,
 int HTTPFileSystem::Create(const char *tid, const char *path, mode_t mode,
 						   XrdOucEnv &env, int opts) {
 	// Is path valid?
-	std::string object;
-	std::string hostname = this->getHTTPHostName();
-	int rv = parse_path(hostname, path, object);
-	if (rv != 0) {
-		return rv;
+	std::string_view object;
+	if (!getExport(path, object)) {
+		return -ENOENT;
 	}
 
 	return 0;
@@ -18,6 +18,11 @@
 
 #pragma once
 
+#include "MultiSourceDownload.hh"
+#include "PathTrie.hh"
+#include "Stats.hh"
+#include "TransportOptions.hh"
+
 #include <XrdOss/XrdOss.hh>
 #include <XrdOuc/XrdOucStream.hh>
 #include <XrdSec/XrdSecEntity.hh>
@@ -25,6 +30,37 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
+// One prefix-to-origin mapping.  Either host_name/host_url or
+// url_base/storage_prefix is set; paths under the prefix are served from
+// the origin, optionally with help from a set of mirrors.
+struct HTTPExport {
+	std::string host_name;
+	std::string host_url;
+	std::string url_base;
+	std::string storage_prefix;
+	std::vector<std::string> mirrors;
+
+	// Statistics of the requests made on behalf of this export.
+	ExportStats *stats{nullptr};
+
+	// How requests reach the backend.  The options apply to the origin and
+	// to every mirror request of a multi-source download, except
+	// unix_socket, which only leads to the origin.
+	TransportOptions transport;
+
+	// Primary origin plus mirrors, or nullptr if no mirrors are configured.
+	std::unique_ptr<HTTPMirrorSet> mirror_set;
+
+	const std::string &getPrefix() const {
+		return url_base.empty() ? host_name : storage_prefix;
+	}
+	const std::string &getOrigin() const {
+		return url_base.empty() ? host_url : url_base;
+	}
+};
 
 class HTTPFileSystem : public XrdOss {
   public:
@@ -67,7 +103,7 @@ class HTTPFileSystem : public XrdOss {
 	}
 	int Stat(const char *path, struct stat *buff, int opts = 0,
 			 XrdOucEnv *env = 0);
-	int Stats(char *buff, int blen) { return -ENOSYS; }
+	int Stats(char *buff, int blen) { return m_stats.xml(buff, blen); }
 	int StatFS(const char *path, char *buff, int &blen, XrdOucEnv *env = 0) {
 		return -ENOSYS;
 	}
@@ -99,10 +135,19 @@ class HTTPFileSystem : public XrdOss {
 		return nullptr;
 	}
 
-	const std::string &getHTTPHostName() const { return http_host_name; }
-	const std::string &getHTTPHostUrl() const { return http_host_url; }
-	const std::string &getHTTPUrlBase() const { return m_url_base; }
-	const std::string &getStoragePrefix() const { return m_storage_prefix; }
+	// Find the export whose prefix is the longest match for `path`; on
+	// success, `object` is set to the remainder of the path (pointing into
+	// `path`).  Returns nullptr if no export matches.
+	const HTTPExport *getExport(std::string_view path,
+								std::string_view &object) const {
+		const HTTPExport *exp = nullptr;
+		return m_export_trie.Lookup(path, exp, object) ? exp : nullptr;
+	}
+
+	size_t getMultiSourceThreshold() const { return m_multisource_threshold; }
+	size_t getMultiSourceChunkSize() const { return m_multisource_chunk_size; }
+
+	const StatsRegistry &getStats() const { return m_stats; }
 
   protected:
 	XrdOucEnv *m_env;
@@ -113,8 +158,12 @@ class HTTPFileSystem : public XrdOss {
 								const std::string &source, std::string &target);
 
   private:
-	std::string http_host_name;
-	std::string http_host_url;
-	std::string m_url_base;
-	std::string m_storage_prefix;
+	bool add_export(std::unique_ptr<HTTPExport> exp);
+
+	std::vector<std::unique_ptr<HTTPExport>> m_exports;
+	PathTrie<const HTTPExport *> m_export_trie;
+	StatsRegistry m_stats;
+
+	size_t m_multisource_threshold{16 * 1024 * 1024};
+	size_t m_multisource_chunk_size{4 * 1024 * 1024};
 };
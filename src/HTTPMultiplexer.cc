@@ -0,0 +1,171 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "HTTPMultiplexer.hh"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace {
+
+// curl_multi_poll and curl_multi_wakeup arrived in libcurl 7.68; before
+// that the driving thread notices new transfers only when its wait for
+// socket activity times out, so the wait is kept short.
+#if LIBCURL_VERSION_NUM >= 0x074400
+const int g_poll_ms = 1000;
+#else
+const int g_poll_ms = 10;
+#endif
+
+} // namespace
+
+HTTPMultiplexer::HTTPMultiplexer(long maxStreams) {
+	curl_global_init(CURL_GLOBAL_ALL);
+	m_multi = curl_multi_init();
+	if (!m_multi) {
+		return;
+	}
+	curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#if LIBCURL_VERSION_NUM >= 0x074300
+	curl_multi_setopt(m_multi, CURLMOPT_MAX_CONCURRENT_STREAMS, maxStreams);
+#else
+	(void)maxStreams;
+#endif
+	m_thread = std::thread(&HTTPMultiplexer::run, this);
+}
+
+HTTPMultiplexer::~HTTPMultiplexer() {
+	if (m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_all();
+#if LIBCURL_VERSION_NUM >= 0x074400
+		curl_multi_wakeup(m_multi);
+#endif
+		m_thread.join();
+	}
+	if (m_multi) {
+		curl_multi_cleanup(m_multi);
+	}
+}
+
+HTTPMultiplexer &HTTPMultiplexer::Instance(long maxStreams) {
+	// Each thread remembers its multiplexers, so the shared table and its
+	// lock are only needed the first time it uses a stream limit.
+	static thread_local std::map<long, HTTPMultiplexer *> cache;
+	auto cached = cache.find(maxStreams);
+	if (cached != cache.end()) {
+		return *cached->second;
+	}
+
+	static std::atomic<unsigned> nextShard{0};
+	static thread_local unsigned shard =
+		nextShard.fetch_add(1, std::memory_order_relaxed) % shards;
+	static std::mutex mutex;
+	static std::map<std::pair<long, unsigned>,
+					std::unique_ptr<HTTPMultiplexer>>
+		instances;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto &instance = instances[{maxStreams, shard}];
+	if (!instance) {
+		instance.reset(new HTTPMultiplexer(maxStreams));
+	}
+	cache[maxStreams] = instance.get();
+	return *instance;
+}
+
+CURLcode HTTPMultiplexer::Perform(CURL *curl) {
+	if (!m_multi) {
+		return curl_easy_perform(curl);
+	}
+	Transfer transfer;
+	transfer.curl = curl;
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_pending.push_back(&transfer);
+	m_cv.notify_one();
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_wakeup(m_multi);
+#endif
+	transfer.cv.wait(lock, [&transfer] { return transfer.done; });
+	return transfer.result;
+}
+
+void HTTPMultiplexer::run() {
+	// Transfers that finished in the last pass; only this thread uses it.
+	std::vector<std::pair<Transfer *, CURLcode>> finished;
+	size_t active = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_cv.wait(lock,
+				  [&] { return m_stop || active || !m_pending.empty(); });
+		if (m_stop) {
+			break;
+		}
+		for (auto transfer : m_pending) {
+			if (curl_multi_add_handle(m_multi, transfer->curl) == CURLM_OK) {
+				active++;
+			} else {
+				transfer->result = CURLE_FAILED_INIT;
+				transfer->done = true;
+				transfer->cv.notify_one();
+			}
+		}
+		m_pending.clear();
+		lock.unlock();
+
+		int running;
+		curl_multi_perform(m_multi, &running);
+		CURLMsg *msg;
+		int queued;
+		while ((msg = curl_multi_info_read(m_multi, &queued))) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			char *transfer = nullptr;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+			CURLcode result = msg->data.result;
+			curl_multi_remove_handle(m_multi, msg->easy_handle);
+			finished.emplace_back(reinterpret_cast<Transfer *>(transfer),
+								  result);
+		}
+		if (finished.empty()) {
+#if LIBCURL_VERSION_NUM >= 0x074400
+			curl_multi_poll(m_multi, nullptr, 0, g_poll_ms, nullptr);
+#else
+			curl_multi_wait(m_multi, nullptr, 0, g_poll_ms, nullptr);
+#endif
+		}
+
+		lock.lock();
+		// The caller may return, destroying its transfer, as soon as the
+		// lock is released.
+		for (auto &entry : finished) {
+			entry.first->result = entry.second;
+			entry.first->done = true;
+			entry.first->cv.notify_one();
+		}
+		active -= finished.size();
+		finished.clear();
+	}
+}
@@ -0,0 +1,71 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <curl/curl.h>
+
+// Runs transfers on a shared curl multi handle so that they can reuse each
+// other's connections and, where the server negotiates HTTP/2, share one
+// connection as concurrent streams.  A single thread drives every transfer
+// of a multiplexer, running its callbacks and copying its data; the threads
+// submitting them block until they finish, so callers see the same
+// synchronous interface as curl_easy_perform.
+//
+// So that one core does not copy the data of every transfer, each stream
+// limit has `shards` multiplexers, and each calling thread always uses the
+// same one.  Each shard opens its own connections, so a host gets at least
+// one connection per shard in use.
+class HTTPMultiplexer {
+  public:
+	~HTTPMultiplexer();
+
+	static constexpr unsigned shards = 4;
+
+	// The calling thread's multiplexer for connections carrying at most
+	// `maxStreams` concurrent streams, created on first use.
+	static HTTPMultiplexer &Instance(long maxStreams);
+
+	// Perform the transfer set up on `curl`, as curl_easy_perform does.
+	CURLcode Perform(CURL *curl);
+
+  private:
+	explicit HTTPMultiplexer(long maxStreams);
+
+	// A transfer submitted by a caller that is waiting for it to finish.
+	struct Transfer {
+		CURL *curl;
+		CURLcode result{CURLE_OK};
+		bool done{false};
+		std::condition_variable cv;
+	};
+
+	void run();
+
+	CURLM *m_multi{nullptr};
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<Transfer *> m_pending;
+	bool m_stop{false};
+	std::thread m_thread;
+};
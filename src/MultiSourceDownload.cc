@@ -0,0 +1,277 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "MultiSourceDownload.hh"
+#include "HTTPCommands.hh"
+#include "logging.hh"
+#include "probes.hh"
+#include "stl_string_utils.hh"
+
+#include <XrdSys/XrdSysError.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <thread>
+
+using namespace XrdHTTPServer;
+
+namespace {
+
+// Weight given to the newest sample in the bandwidth moving average.
+const double g_bandwidth_alpha = 0.3;
+
+// Bandwidth assumed for a source we have never heard from (bytes/sec).
+const double g_default_bandwidth = 10.0 * 1024 * 1024;
+
+// A source is dropped from the current download after this many failures.
+const unsigned g_max_source_failures = 3;
+
+// How long an idle source waits before re-checking for work to steal.
+const std::chrono::milliseconds g_steal_poll_interval(50);
+
+typedef std::chrono::steady_clock Clock;
+
+struct Chunk {
+	off_t offset;
+	size_t size;
+	size_t owner;
+	Clock::time_point start;
+	unsigned inflight{0};
+	bool stolen{false};
+	bool done{false};
+	std::atomic<bool> cancel{false};
+};
+
+struct DownloadState {
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	// Byte ranges that have not yet been handed to any source.
+	std::deque<std::pair<off_t, size_t>> pending;
+	// All chunks ever handed out; std::list keeps the pointers stable.
+	std::list<Chunk> chunks;
+
+	std::vector<double> bandwidth;
+	std::vector<unsigned> failures;
+	size_t remaining{0};
+};
+
+double estimateBandwidth(const DownloadState &state, size_t source) {
+	if (state.bandwidth[source] > 0) {
+		return state.bandwidth[source];
+	}
+	double total = 0;
+	unsigned known = 0;
+	for (auto bw : state.bandwidth) {
+		if (bw > 0) {
+			total += bw;
+			known++;
+		}
+	}
+	return known ? total / known : g_default_bandwidth;
+}
+
+// Scale the base chunk size by how fast this source is relative to the mean
+// of all sources, so that fast mirrors take proportionally larger bites.
+size_t chunkSizeFor(const DownloadState &state, size_t source,
+					size_t baseSize) {
+	double total = 0;
+	for (size_t idx = 0; idx < state.bandwidth.size(); idx++) {
+		total += estimateBandwidth(state, idx);
+	}
+	double mean = total / state.bandwidth.size();
+	double ratio = estimateBandwidth(state, source) / mean;
+	ratio = std::min(4.0, std::max(0.25, ratio));
+	return std::max<size_t>(1, static_cast<size_t>(baseSize * ratio));
+}
+
+// Pick the next chunk for a source; must be called with the state lock held.
+// Returns nullptr if there is currently nothing useful for it to do.
+Chunk *nextChunk(DownloadState &state, size_t source, size_t baseSize) {
+	if (!state.pending.empty()) {
+		auto &range = state.pending.front();
+		size_t size = std::min(range.second,
+							   chunkSizeFor(state, source, baseSize));
+		state.chunks.emplace_back();
+		Chunk &chunk = state.chunks.back();
+		chunk.offset = range.first;
+		chunk.size = size;
+		chunk.owner = source;
+		chunk.start = Clock::now();
+		range.first += size;
+		range.second -= size;
+		if (range.second == 0) {
+			state.pending.pop_front();
+		}
+		return &chunk;
+	}
+
+	// Everything has been handed out; see if some slower source is sitting
+	// on a chunk we could finish sooner.
+	auto now = Clock::now();
+	double myRate = estimateBandwidth(state, source);
+	Chunk *best = nullptr;
+	double bestFinish = 0;
+	for (auto &chunk : state.chunks) {
+		if (chunk.done || chunk.stolen || chunk.inflight == 0 ||
+			chunk.owner == source) {
+			continue;
+		}
+		double elapsed =
+			std::chrono::duration<double>(now - chunk.start).count();
+		double ownerFinish =
+			chunk.size / estimateBandwidth(state, chunk.owner) - elapsed;
+		double myFinish = chunk.size / myRate;
+		if (myFinish < ownerFinish && ownerFinish > bestFinish) {
+			best = &chunk;
+			bestFinish = ownerFinish;
+		}
+	}
+	if (best) {
+		best->stolen = true;
+	}
+	return best;
+}
+
+} // namespace
+
+std::vector<double> HTTPMirrorSet::getBandwidth() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bandwidth;
+}
+
+void HTTPMirrorSet::recordTransfer(size_t source, size_t bytes,
+								   double seconds) {
+	if (seconds <= 0) {
+		return;
+	}
+	double rate = bytes / seconds;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	double &bw = m_bandwidth[source];
+	bw = (bw > 0) ? (1 - g_bandwidth_alpha) * bw + g_bandwidth_alpha * rate
+				  : rate;
+}
+
+ssize_t HTTPMultiSourceDownload::Read(void *buffer, off_t offset,
+									  size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+
+	DownloadState state;
+	state.pending.emplace_back(offset, size);
+	state.bandwidth = m_mirrors.getBandwidth();
+	state.failures.resize(m_mirrors.size(), 0);
+	state.remaining = size;
+
+	size_t baseSize = std::max<size_t>(
+		1, std::min(m_chunk_size, size / m_mirrors.size()));
+
+	// The mirrors are other hosts, which a local socket cannot reach.
+	TransportOptions mirrorTransport;
+	if (m_transport) {
+		mirrorTransport = *m_transport;
+		mirrorTransport.unix_socket.clear();
+	}
+
+	auto worker = [&](size_t source) {
+		const std::string &hostUrl = m_mirrors.getUrls()[source];
+		std::unique_lock<std::mutex> lock(state.mutex);
+		while (state.remaining > 0 &&
+			   state.failures[source] < g_max_source_failures) {
+			Chunk *chunk = nextChunk(state, source, baseSize);
+			if (!chunk) {
+				// Everything left is in flight elsewhere; wake up when a
+				// chunk lands or periodically to re-check for stragglers.
+				state.cv.wait_for(lock, g_steal_poll_interval);
+				continue;
+			}
+			chunk->inflight++;
+			lock.unlock();
+
+			XRDHTTP_PROBE4(chunk__issue, m_object.c_str(), chunk->offset,
+						   chunk->size, hostUrl.c_str());
+			auto start = Clock::now();
+			HTTPDownload download(hostUrl, m_object, m_log);
+			download.SetCancelFlag(&chunk->cancel);
+			download.SetStats(m_stats);
+			if (m_transport) {
+				download.SetTransport(source == 0 ? m_transport
+												  : &mirrorTransport);
+			}
+			bool ok = download.SendRequest(chunk->offset, chunk->size) &&
+					  download.getResultString().size() == chunk->size;
+			double seconds =
+				std::chrono::duration<double>(Clock::now() - start).count();
+
+			lock.lock();
+			chunk->inflight--;
+			if (ok && !chunk->done) {
+				// Claim the chunk, tell any competing copy to give up, and
+				// copy outside the lock; chunk ranges never overlap.
+				chunk->done = true;
+				chunk->cancel = true;
+				lock.unlock();
+				memcpy(static_cast<char *>(buffer) + (chunk->offset - offset),
+					   download.getResultString().data(), chunk->size);
+				m_mirrors.recordTransfer(source, chunk->size, seconds);
+				lock.lock();
+				state.bandwidth[source] = m_mirrors.getBandwidth()[source];
+				state.remaining -= chunk->size;
+				if (chunk->owner != source) {
+					m_log.Log(LogMask::Debug, "MultiSourceDownload",
+							  "Stole a chunk from a slower source:",
+							  hostUrl.c_str());
+				}
+			} else if (!ok && !chunk->done) {
+				state.failures[source]++;
+				std::string msg;
+				formatstr(msg, "Failed to fetch %zu bytes at offset %lld from",
+						  chunk->size, static_cast<long long>(chunk->offset));
+				m_log.Log(LogMask::Warning, "MultiSourceDownload",
+						  msg.c_str(), hostUrl.c_str());
+				if (chunk->inflight == 0) {
+					// Nobody else is working on it; put it back up for grabs.
+					chunk->done = true;
+					state.pending.emplace_front(chunk->offset, chunk->size);
+				}
+			}
+			state.cv.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(m_mirrors.size());
+	for (size_t idx = 0; idx < m_mirrors.size(); idx++) {
+		threads.emplace_back(worker, idx);
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	if (state.remaining > 0) {
+		return -EIO;
+	}
+	return size;
+}
@@ -0,0 +1,93 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class ExportStats;
+class XrdSysError;
+struct TransportOptions;
+
+// The set of origins that serve identical content for a storage prefix.  The
+// first entry is the primary host URL; the rest are mirrors.  The set also
+// remembers the observed throughput of each source so that later downloads
+// can hand out work proportionally from the very first chunk.
+class HTTPMirrorSet {
+  public:
+	HTTPMirrorSet() {}
+	HTTPMirrorSet(const std::vector<std::string> &urls)
+		: m_urls(urls), m_bandwidth(urls.size(), 0.0) {}
+
+	const std::vector<std::string> &getUrls() const { return m_urls; }
+	size_t size() const { return m_urls.size(); }
+
+	// Returns a snapshot of the bandwidth estimates, in bytes per second.
+	// A value of 0 means no transfer from that source has completed yet.
+	std::vector<double> getBandwidth() const;
+
+	// Fold a completed transfer into the bandwidth estimate for a source.
+	void recordTransfer(size_t source, size_t bytes, double seconds);
+
+  private:
+	std::vector<std::string> m_urls;
+
+	mutable std::mutex m_mutex;
+	std::vector<double> m_bandwidth;
+};
+
+// Fetches a single byte range of an object by splitting it into chunks and
+// downloading the chunks from every source in a mirror set at once.
+//
+// Each source pulls its next chunk as soon as it finishes the previous one,
+// with the chunk size scaled by the source's bandwidth relative to the
+// others.  Once no unassigned bytes remain, an idle source will re-issue
+// ("steal") a chunk still in flight on a slower source if it expects to
+// finish it first; whichever copy arrives first wins and the other is
+// aborted.
+class HTTPMultiSourceDownload {
+  public:
+	HTTPMultiSourceDownload(HTTPMirrorSet &mirrors, const std::string &object,
+							size_t chunkSize, XrdSysError &log,
+							ExportStats *stats = nullptr)
+		: m_mirrors(mirrors), m_object(object), m_chunk_size(chunkSize),
+		  m_log(log), m_stats(stats) {}
+
+	// Send the requests as `transport` says; it must outlive the download.
+	// A Unix domain socket, if set, is only used for the primary URL.
+	void SetTransport(const TransportOptions *transport) {
+		m_transport = transport;
+	}
+
+	// Read [offset, offset + size) into buffer.  The caller must ensure the
+	// range lies within the object.  Returns the number of bytes read or a
+	// negative errno on failure.
+	ssize_t Read(void *buffer, off_t offset, size_t size);
+
+  private:
+	HTTPMirrorSet &m_mirrors;
+	std::string m_object;
+	size_t m_chunk_size;
+	XrdSysError &m_log;
+	ExportStats *m_stats;
+	const TransportOptions *m_transport{nullptr};
+};
@@ -0,0 +1,220 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Maps path prefixes to values and finds the longest registered prefix of a
+// path, matching only on '/' component boundaries.
+//
+// Prefixes are inserted into a pointer-based radix tree while the
+// configuration is parsed.  Compile() then flattens the tree into a handful
+// of contiguous arrays so that a lookup touches a few cache lines, never
+// allocates, and compares each path byte at most once.
+//
+// Prefixes are normalized to a leading '/' and no trailing '/', so "foo",
+// "/foo" and "/foo/" are the same prefix and "/" matches every path.
+template <typename T> class PathTrie {
+  public:
+	// Register a value for a prefix.  Returns false if the prefix is already
+	// registered.  Invalidates any previous Compile().
+	bool Insert(std::string_view prefix, const T &value) {
+		std::string key = Normalize(prefix);
+		if (!m_root) {
+			m_root.reset(new BuildNode());
+		}
+		m_compiled = false;
+
+		BuildNode *node = m_root.get();
+		std::string_view rest(key);
+		while (!rest.empty()) {
+			auto iter = node->children.find(rest[0]);
+			if (iter == node->children.end()) {
+				std::unique_ptr<BuildNode> leaf(new BuildNode());
+				leaf->label = std::string(rest);
+				node = (node->children[rest[0]] = std::move(leaf)).get();
+				rest = std::string_view();
+				break;
+			}
+			BuildNode *child = iter->second.get();
+			size_t common = 0;
+			while (common < child->label.size() && common < rest.size() &&
+				   child->label[common] == rest[common]) {
+				common++;
+			}
+			if (common < child->label.size()) {
+				// Split the edge at the point of divergence.
+				std::unique_ptr<BuildNode> split(new BuildNode());
+				split->label = child->label.substr(0, common);
+				std::unique_ptr<BuildNode> tail = std::move(iter->second);
+				tail->label.erase(0, common);
+				char tailKey = tail->label[0];
+				split->children[tailKey] = std::move(tail);
+				iter->second = std::move(split);
+				child = iter->second.get();
+			}
+			node = child;
+			rest.remove_prefix(common);
+		}
+		if (node->has_value) {
+			return false;
+		}
+		node->has_value = true;
+		node->value = value;
+		return true;
+	}
+
+	// Flatten the tree for lookups.  Must be called after the last Insert()
+	// and before the first Lookup().
+	void Compile() {
+		m_nodes.clear();
+		m_labels.clear();
+		m_child_keys.clear();
+		m_child_nodes.clear();
+		m_values.clear();
+		if (m_root) {
+			m_nodes.emplace_back();
+			Flatten(*m_root, 0);
+		}
+		m_compiled = true;
+	}
+
+	// Find the longest registered prefix of `path`.  On success, sets `value`
+	// and sets `remainder` to the rest of the path with any separating '/'
+	// characters stripped; `remainder` points into `path`.
+	bool Lookup(std::string_view path, T &value,
+				std::string_view &remainder) const {
+		if (!m_compiled || m_nodes.empty()) {
+			return false;
+		}
+
+		int32_t best = -1;
+		size_t bestPos = 0;
+		uint32_t node = 0;
+		size_t pos = 0;
+		while (true) {
+			const FlatNode &cur = m_nodes[node];
+			if (cur.value >= 0 && (pos == path.size() || path[pos] == '/')) {
+				best = cur.value;
+				bestPos = pos;
+			}
+			if (pos == path.size() || cur.child_count == 0) {
+				break;
+			}
+
+			auto keysBegin = m_child_keys.begin() + cur.child_begin;
+			auto keysEnd = keysBegin + cur.child_count;
+			auto iter = std::lower_bound(keysBegin, keysEnd, path[pos]);
+			if (iter == keysEnd || *iter != path[pos]) {
+				break;
+			}
+			uint32_t next = m_child_nodes[cur.child_begin + (iter - keysBegin)];
+			const FlatNode &child = m_nodes[next];
+			if (path.size() - pos < child.label_len ||
+				path.compare(pos, child.label_len,
+							 std::string_view(m_labels.data() + child.label_off,
+											  child.label_len)) != 0) {
+				break;
+			}
+			pos += child.label_len;
+			node = next;
+		}
+
+		if (best < 0) {
+			return false;
+		}
+		while (bestPos < path.size() && path[bestPos] == '/') {
+			bestPos++;
+		}
+		value = m_values[best];
+		remainder = path.substr(bestPos);
+		return true;
+	}
+
+	bool empty() const { return !m_root; }
+
+	static std::string Normalize(std::string_view prefix) {
+		while (!prefix.empty() && prefix.back() == '/') {
+			prefix.remove_suffix(1);
+		}
+		while (!prefix.empty() && prefix.front() == '/') {
+			prefix.remove_prefix(1);
+		}
+		if (prefix.empty()) {
+			return "";
+		}
+		return "/" + std::string(prefix);
+	}
+
+  private:
+	struct BuildNode {
+		std::string label;
+		std::map<char, std::unique_ptr<BuildNode>> children;
+		bool has_value{false};
+		T value{};
+	};
+
+	struct FlatNode {
+		uint32_t label_off{0};
+		uint32_t label_len{0};
+		uint32_t child_begin{0};
+		uint32_t child_count{0};
+		int32_t value{-1};
+	};
+
+	// Fill in m_nodes[index] from `node`; children of a node are laid out
+	// contiguously and sorted by their first byte.
+	void Flatten(const BuildNode &node, uint32_t index) {
+		m_nodes[index].label_off = m_labels.size();
+		m_nodes[index].label_len = node.label.size();
+		m_labels += node.label;
+		if (node.has_value) {
+			m_nodes[index].value = m_values.size();
+			m_values.push_back(node.value);
+		}
+
+		uint32_t childBegin = m_child_keys.size();
+		m_nodes[index].child_begin = childBegin;
+		m_nodes[index].child_count = node.children.size();
+		for (const auto &entry : node.children) {
+			m_child_keys.push_back(entry.first);
+			m_child_nodes.push_back(m_nodes.size());
+			m_nodes.emplace_back();
+		}
+		uint32_t idx = 0;
+		for (const auto &entry : node.children) {
+			Flatten(*entry.second, m_child_nodes[childBegin + idx++]);
+		}
+	}
+
+	std::unique_ptr<BuildNode> m_root;
+	bool m_compiled{false};
+
+	std::vector<FlatNode> m_nodes;
+	std::string m_labels;
+	std::vector<char> m_child_keys;
+	std::vector<uint32_t> m_child_nodes;
+	std::vector<T> m_values;
+};
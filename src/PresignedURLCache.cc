@@ -0,0 +1,65 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "PresignedURLCache.hh"
+#include "Stats.hh"
+
+bool PresignedURLCache::get(const std::string &key, std::string &url) {
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_entries.find(key);
+		if (iter != m_entries.end() && now < iter->second.refresh) {
+			url = iter->second.url;
+			if (m_stats) {
+				m_stats->hit();
+			}
+			return true;
+		}
+	}
+	if (m_stats) {
+		m_stats->miss();
+	}
+	return false;
+}
+
+void PresignedURLCache::put(const std::string &key, const std::string &url,
+							std::chrono::seconds validity) {
+	auto now = std::chrono::steady_clock::now();
+	Entry entry{url, now + validity - validity / 4};
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_entries.size() >= max_entries && !m_entries.count(key)) {
+		for (auto iter = m_entries.begin(); iter != m_entries.end();) {
+			if (iter->second.refresh <= now) {
+				iter = m_entries.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+		if (m_entries.size() >= max_entries) {
+			m_entries.erase(m_entries.begin());
+		}
+	}
+	m_entries[key] = std::move(entry);
+}
+
+void PresignedURLCache::erase(const std::string &key) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.erase(key);
+}
@@ -0,0 +1,66 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class CacheStats;
+
+// Pre-signed GET URLs for the objects being read, so that each range read
+// can be sent as a plain HTTP request instead of being signed itself.  A URL
+// is handed out until less than a quarter of its validity remains, leaving
+// time for the requests that use it to finish before it expires.
+class PresignedURLCache {
+  public:
+	// URLs are generated to be valid for `validity`; `stats` may be null.
+	PresignedURLCache(std::chrono::seconds validity, CacheStats *stats)
+		: m_validity(validity), m_stats(stats) {}
+
+	std::chrono::seconds validity() const { return m_validity; }
+
+	// Set `url` to the cached URL for `key` if it is not close to expiring.
+	bool get(const std::string &key, std::string &url);
+
+	// Cache `url`, generated just now to be valid for `validity` (at most
+	// the configured validity).
+	void put(const std::string &key, const std::string &url,
+			 std::chrono::seconds validity);
+
+	// Forget the URL for `key`, e.g. after the backend refused it.
+	void erase(const std::string &key);
+
+	// At most this many URLs are kept; beyond that, expired entries are
+	// dropped first and then arbitrary ones.
+	static const size_t max_entries = 16384;
+
+  private:
+	struct Entry {
+		std::string url;
+		std::chrono::steady_clock::time_point refresh;
+	};
+
+	const std::chrono::seconds m_validity;
+	CacheStats *m_stats;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+};
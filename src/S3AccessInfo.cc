@@ -49,3 +49,31 @@ const std::string &S3AccessInfo::getS3SecretKeyFile() const {
 void S3AccessInfo::setS3SecretKeyFile(const std::string &s3SecretKeyFile) {
 	s3_secret_key_file = s3SecretKeyFile;
 }
+
+const std::string &S3AccessInfo::getS3URLStyle() const {
+	return s3_url_style;
+}
+
+void S3AccessInfo::setS3URLStyle(const std::string &s3URLStyle) {
+	s3_url_style = s3URLStyle;
+}
+
+ExportStats *S3AccessInfo::getStats() const { return s3_stats; }
+
+void S3AccessInfo::setStats(ExportStats *stats) { s3_stats = stats; }
+
+CredentialProvider *S3AccessInfo::getCredentialProvider() const {
+	return s3_credentials;
+}
+
+void S3AccessInfo::setCredentialProvider(CredentialProvider *provider) {
+	s3_credentials = provider;
+}
+
+const TransportOptions &S3AccessInfo::getTransport() const {
+	return s3_transport;
+}
+
+void S3AccessInfo::setTransport(const TransportOptions &transport) {
+	s3_transport = transport;
+}
@@ -5,8 +5,13 @@
 #ifndef XROOTD_S3_HTTP_S3ACCESSINFO_HH
 #define XROOTD_S3_HTTP_S3ACCESSINFO_HH
 
+#include "TransportOptions.hh"
+
 #include <string>
 
+class CredentialProvider;
+class ExportStats;
+
 class S3AccessInfo {
   public:
 	const std::string &getS3BucketName() const;
@@ -33,6 +38,26 @@ class S3AccessInfo {
 
 	void setS3SecretKeyFile(const std::string &s3SecretKeyFile);
 
+	// "path" or "virtual"; `auto` and the s3.url_style default are resolved
+	// when the configuration is read.
+	const std::string &getS3URLStyle() const;
+
+	void setS3URLStyle(const std::string &s3URLStyle);
+
+	ExportStats *getStats() const;
+
+	void setStats(ExportStats *stats);
+
+	// Temporary credentials to use instead of the key files; null if the
+	// export has none.
+	CredentialProvider *getCredentialProvider() const;
+
+	void setCredentialProvider(CredentialProvider *provider);
+
+	const TransportOptions &getTransport() const;
+
+	void setTransport(const TransportOptions &transport);
+
   private:
 	std::string s3_bucket_name;
 	std::string s3_service_name;
@@ -40,6 +65,10 @@ class S3AccessInfo {
 	std::string s3_service_url;
 	std::string s3_access_key_file;
 	std::string s3_secret_key_file;
+	std::string s3_url_style;
+	ExportStats *s3_stats{nullptr};
+	CredentialProvider *s3_credentials{nullptr};
+	TransportOptions s3_transport;
 };
 
 #endif // XROOTD_S3_HTTP_S3ACCESSINFO_HH
@@ -18,20 +18,62 @@
 
 #include "S3Commands.hh"
 #include "AWSv4-impl.hh"
+#include "logging.hh"
+#include "probes.hh"
 #include "shortfile.hh"
 #include "stl_string_utils.hh"
 
 #include <XrdSys/XrdSysError.hh>
 #include <curl/curl.h>
 #include <openssl/hmac.h>
+#include <strings.h>
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
+
+using namespace XrdHTTPServer;
+
+BucketRegionCache &BucketRegionCache::Instance() {
+	static BucketRegionCache instance;
+	return instance;
+}
+
+bool BucketRegionCache::Get(std::string_view serviceUrl,
+							std::string_view bucket,
+							std::string &region) const {
+	if (m_empty.load(std::memory_order_acquire)) {
+		return false;
+	}
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	auto endpoint = m_regions.find(serviceUrl);
+	if (endpoint == m_regions.end()) {
+		return false;
+	}
+	auto iter = endpoint->second.find(bucket);
+	if (iter == endpoint->second.end()) {
+		return false;
+	}
+	region = iter->second;
+	return true;
+}
+
+void BucketRegionCache::Set(std::string_view serviceUrl,
+							std::string_view bucket,
+							const std::string &region) {
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	m_regions[std::string(serviceUrl)][std::string(bucket)] = region;
+	m_empty.store(false, std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------
 
 AmazonRequest::~AmazonRequest() {}
 
@@ -54,6 +96,109 @@ std::string AmazonRequest::canonicalizeQueryString() {
 	return AWSv4Impl::canonicalizeQueryString(query_parameters);
 }
 
+namespace {
+
+// One header in SigningBuffers::arena: the lower-cased name runs from
+// `name` to `value` and the canonical value from `value` to `end`.
+struct CanonicalHeader {
+	size_t name;
+	size_t value;
+	size_t end;
+};
+
+// Scratch space for createV4Signature, kept per thread so that signing
+// reuses the capacity of earlier requests instead of allocating.
+struct SigningBuffers {
+	std::string arena;
+	std::vector<CanonicalHeader> headers;
+	std::string canonicalRequest;
+	std::string signedHeaders;
+	std::string credentialScope;
+	std::string stringToSign;
+	std::string key;
+	std::string payloadHash;
+	std::string requestHash;
+	std::string signature;
+};
+
+SigningBuffers &signingBuffers() {
+	static thread_local SigningBuffers buffers;
+	return buffers;
+}
+
+// Append `value` without leading or trailing spaces and with each run of
+// spaces inside it collapsed to one, in a single pass.
+void appendCanonicalValue(std::string &out, const std::string &value) {
+	size_t begin = value.find_first_not_of(' ');
+	if (begin == std::string::npos) {
+		return;
+	}
+	size_t end = value.find_last_not_of(' ') + 1;
+	for (size_t idx = begin; idx < end; idx++) {
+		if (value[idx] != ' ' || value[idx - 1] != ' ') {
+			out.push_back(value[idx]);
+		}
+	}
+}
+
+// The host of `region`'s endpoint standing in for the AWS S3 endpoint
+// `host`, keeping any bucket prefix: "bucket.s3.eu-west-1.amazonaws.com"
+// for "bucket.s3.amazonaws.com", say.  Empty if `host` is not an AWS S3
+// endpoint, in which case the host cannot be derived from the region.
+std::string regionalHost(std::string_view host, const std::string &region) {
+	const std::string_view suffix = ".amazonaws.com";
+	if (host.size() <= suffix.size() ||
+		host.substr(host.size() - suffix.size()) != suffix) {
+		return "";
+	}
+	// What precedes the suffix ends in "s3", "s3-<region>" or
+	// "s3.<region>".
+	std::string_view rest = host.substr(0, host.size() - suffix.size());
+	for (int labels = 0; labels < 2; labels++) {
+		size_t dot = rest.rfind('.');
+		std::string_view label =
+			dot == std::string_view::npos ? rest : rest.substr(dot + 1);
+		if (label == "s3" || (labels == 0 && label.substr(0, 3) == "s3-")) {
+			std::string_view prefix = rest.substr(0, rest.size() - label.size());
+			return std::string(prefix) + "s3." + region + std::string(suffix);
+		}
+		if (dot == std::string_view::npos) {
+			break;
+		}
+		rest = rest.substr(0, dot);
+	}
+	return "";
+}
+
+} // namespace
+
+std::string_view AmazonRequest::bucketName() const {
+	if (!bucket.empty()) {
+		return bucket;
+	}
+	std::string_view path = object;
+	return path.substr(0, path.find('/'));
+}
+
+void AmazonRequest::useRegion(const std::string &region) {
+	this->region = region;
+	std::string regional = regionalHost(host, region);
+	if (!regional.empty() && regional != host) {
+		host = std::move(regional);
+		hostUrl = protocol + "://" + host + canonicalURI;
+		headers.erase("Host");
+	}
+}
+
+void AmazonRequest::responseHeader(std::string_view name,
+								   std::string_view value) {
+	const char header[] = "x-amz-bucket-region";
+	if (name.size() == sizeof(header) - 1 &&
+		strncasecmp(name.data(), header, name.size()) == 0) {
+		bucketRegion = value;
+	}
+}
+
 // Takes in the configured `s3.service_url` and uses the bucket/object requested
 // to generate the host URL, as well as the canonical URI (which is the path to
 // the object).
@@ -117,49 +262,71 @@ std::string pathEncode(const std::string &original) {
 	return AWSv4Impl::pathEncode(original);
 }
 
-bool AmazonRequest::createV4Signature(const std::string &payload,
-									  std::string &authorizationValue,
-									  bool sendContentSHA) {
-	// If we're using temporary credentials, we need to add the token
-	// header here as well.  We set saKey and keyID here (well before
-	// necessary) since we'll get them for free when we get the token.
-	std::string keyID;
+bool AmazonRequest::readCredentials(
+	std::shared_ptr<const AWSCredential> &credential) {
+	if (this->credential) {
+		credential = this->credential;
+		return true;
+	}
+	credential.reset();
+	if (this->secretKeyFile.empty()) { // Some origins may exist in front of
+									   // unauthenticated buckets
+		return true;
+	}
 	std::string saKey;
-	std::string token;
-	if (!this->secretKeyFile.empty()) { // Some origins may exist in front of
-										// unauthenticated buckets
-		if (!readShortFile(this->secretKeyFile, saKey)) {
-			this->errorCode = "E_FILE_IO";
-			this->errorMessage = "Unable to read from secretkey file '" +
-								 this->secretKeyFile + "'.";
-			return false;
-		}
-		trim(saKey);
-	} else {
-		requiresSignature =
-			false;	 // If we don't create a signature, it must not be needed...
-		return true; // If there was no saKey, we need not generate a signature
+	if (!readShortFile(this->secretKeyFile, saKey)) {
+		this->errorCode = "E_FILE_IO";
+		this->errorMessage = "Unable to read from secretkey file '" +
+							 this->secretKeyFile + "'.";
+		return false;
 	}
+	trim(saKey);
 
-	if (!this->accessKeyFile.empty()) { // Some origins may exist in front of
-										// unauthenticated buckets
-		if (!readShortFile(this->accessKeyFile, keyID)) {
-			this->errorCode = "E_FILE_IO";
-			this->errorMessage = "Unable to read from accesskey file '" +
-								 this->accessKeyFile + "'.";
-			return false;
-		}
-		trim(keyID);
-	} else {
+	std::string keyID;
+	if (this->accessKeyFile.empty()) {
 		this->errorCode = "E_FILE_IO";
 		this->errorMessage = "The secretkey file was read, but I can't read "
 							 "from accesskey file '" +
 							 this->secretKeyFile + "'.";
 		return false;
 	}
+	if (!readShortFile(this->accessKeyFile, keyID)) {
+		this->errorCode = "E_FILE_IO";
+		this->errorMessage = "Unable to read from accesskey file '" +
+							 this->accessKeyFile + "'.";
+		return false;
+	}
+	trim(keyID);
+	credential = std::make_shared<const AWSCredential>(
+		std::move(keyID), std::move(saKey), std::string());
+	return true;
+}
+
+bool AmazonRequest::createV4Signature(const std::string &payload,
+									  std::string &authorizationValue,
+									  bool sendContentSHA) {
+	std::shared_ptr<const AWSCredential> credential;
+	if (!readCredentials(credential)) {
+		return false;
+	}
+	if (!credential) {
+		requiresSignature =
+			false;	 // If we don't create a signature, it must not be needed...
+		return true; // If there was no saKey, we need not generate a signature
+	}
+	const std::string &keyID = credential->accessKeyID();
+	const std::string &saKey = credential->secretAccessKey();
+
+	// If we're using temporary credentials, we need to add the token
+	// header here as well, before the headers are canonicalized.
+	if (!credential->securityToken().empty()) {
+		headers["X-Amz-Security-Token"] = credential->securityToken();
+	}
 
-	time_t now;
-	time(&now);
+	time_t now = signatureTime.tv_sec;
+	if (!now) {
+		time(&now);
+	}
 	struct tm brokenDownTime;
 	gmtime_r(&now, &brokenDownTime);
 
@@ -179,7 +346,6 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 	// URI-encoded parameter names '=' values, separated by '&'s.  That
 	// wouldn't be hard to do, but we don't need to, since we send
 	// everything in the POST body, instead.
-	std::string canonicalQueryString;
 
 	// This function doesn't (currently) support query parameters,
 	// but no current caller attempts to use them.
@@ -212,83 +378,76 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 		// dprintf( D_ALWAYS, "Unable to hash payload, failing.\n" );
 		return false;
 	}
-	std::string payloadHash;
-	convertMessageDigestToLowercaseHex(messageDigest, mdLength, payloadHash);
+	auto &buf = signingBuffers();
+	convertMessageDigestToLowercaseHex(messageDigest, mdLength,
+									   buf.payloadHash);
 	if (sendContentSHA) {
-		headers["X-Amz-Content-Sha256"] = payloadHash;
+		headers["X-Amz-Content-Sha256"] = buf.payloadHash;
 	}
 
 	// The canonical list of headers is a sorted list of lowercase header
 	// names paired via ':' with the trimmed header value, each pair
-	// terminated with a newline.
-	AmazonRequest::AttributeValueMap transformedHeaders;
-	for (auto i = headers.begin(); i != headers.end(); ++i) {
-		std::string header = i->first;
-		std::transform(header.begin(), header.end(), header.begin(), &tolower);
-
-		std::string value = i->second;
+	// terminated with a newline.  Names and values are written once into
+	// the arena and sorted as offsets, so nothing is allocated once the
+	// thread's buffers have grown to fit.
+	buf.arena.clear();
+	buf.headers.clear();
+	for (const auto &header : headers) {
 		// We need to leave empty headers alone so that they can be used
 		// to disable CURL stupidity later.
-		if (value.size() == 0) {
+		if (header.second.empty()) {
 			continue;
 		}
-
-		// Eliminate trailing spaces.
-		unsigned j = value.length() - 1;
-		while (value[j] == ' ') {
-			--j;
+		CanonicalHeader entry;
+		entry.name = buf.arena.size();
+		for (char c : header.first) {
+			buf.arena.push_back(tolower(static_cast<unsigned char>(c)));
 		}
-		if (j != value.length() - 1) {
-			value.erase(j + 1);
+		entry.value = buf.arena.size();
+		appendCanonicalValue(buf.arena, header.second);
+		entry.end = buf.arena.size();
+		buf.headers.push_back(entry);
+	}
+	auto name = [&buf](const CanonicalHeader &entry) {
+		return std::string_view(buf.arena).substr(entry.name,
+												  entry.value - entry.name);
+	};
+	// A stable insertion sort: there are only a handful of headers, and of
+	// two names differing only in case, the later one in `headers` wins.
+	for (size_t idx = 1; idx < buf.headers.size(); idx++) {
+		CanonicalHeader entry = buf.headers[idx];
+		size_t pos = idx;
+		for (; pos > 0 && name(entry) < name(buf.headers[pos - 1]); pos--) {
+			buf.headers[pos] = buf.headers[pos - 1];
 		}
+		buf.headers[pos] = entry;
+	}
 
-		// Eliminate leading spaces.
-		for (j = 0; value[j] == ' '; ++j) {
+	// Task 1: create the canonical request.  The canonical query string
+	// is always empty (see above).  The canonical list of signed headers is
+	// trivial to generate while generating the list of headers.
+	std::string &canonicalRequest = buf.canonicalRequest;
+	canonicalRequest.clear();
+	canonicalRequest.append(httpVerb).append(1, '\n');
+	canonicalRequest.append(canonicalURI).append("\n\n");
+	buf.signedHeaders.clear();
+	for (size_t idx = 0; idx < buf.headers.size(); idx++) {
+		const auto &entry = buf.headers[idx];
+		if (idx + 1 < buf.headers.size() &&
+			name(entry) == name(buf.headers[idx + 1])) {
+			continue;
 		}
-		value.erase(0, j);
-
-		// Convert internal runs of spaces into single spaces.
-		unsigned left = 1;
-		unsigned right = 1;
-		bool inSpaces = false;
-		while (right < value.length()) {
-			if (!inSpaces) {
-				if (value[right] == ' ') {
-					inSpaces = true;
-					left = right;
-					++right;
-				} else {
-					++right;
-				}
-			} else {
-				if (value[right] == ' ') {
-					++right;
-				} else {
-					inSpaces = false;
-					value.erase(left, right - left - 1);
-					right = left + 1;
-				}
-			}
+		canonicalRequest.append(name(entry))
+			.append(1, ':')
+			.append(buf.arena, entry.value, entry.end - entry.value)
+			.append(1, '\n');
+		if (!buf.signedHeaders.empty()) {
+			buf.signedHeaders.append(1, ';');
 		}
-
-		transformedHeaders[header] = value;
+		buf.signedHeaders.append(name(entry));
 	}
-
-	// The canonical list of signed headers is trivial to generate while
-	// generating the list of headers.
-	std::string signedHeaders;
-	std::string canonicalHeaders;
-	for (auto i = transformedHeaders.begin(); i != transformedHeaders.end();
-		 ++i) {
-		canonicalHeaders += i->first + ":" + i->second + "\n";
-		signedHeaders += i->first + ";";
-	}
-	signedHeaders.erase(signedHeaders.end() - 1);
-
-	// Task 1: create the canonical request.
-	std::string canonicalRequest =
-		httpVerb + "\n" + canonicalURI + "\n" + canonicalQueryString + "\n" +
-		canonicalHeaders + "\n" + signedHeaders + "\n" + payloadHash;
+	canonicalRequest.append(1, '\n').append(buf.signedHeaders);
+	canonicalRequest.append(1, '\n').append(buf.payloadHash);
 
 	//
 	// Create task 2's inputs.
@@ -300,38 +459,34 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 		this->errorMessage = "Unable to hash canonical request.";
 		return false;
 	}
-	std::string canonicalRequestHash;
 	convertMessageDigestToLowercaseHex(messageDigest, mdLength,
-									   canonicalRequestHash);
+									   buf.requestHash);
 
-	std::string s = this->service;
+	std::string_view s = this->service;
 	if (s.empty()) {
 		size_t i = host.find(".");
-		if (i != std::string::npos) {
-			s = host.substr(0, i);
-		} else {
-			s = host;
-		}
+		s = std::string_view(host).substr(0, i);
 	}
 
-	std::string r = this->region;
+	std::string_view r = this->region;
 	if (r.empty()) {
 		size_t i = host.find(".");
 		size_t j = host.find(".", i + 1);
 		if (j != std::string::npos) {
-			r = host.substr(i + 1, j - i - 1);
+			r = std::string_view(host).substr(i + 1, j - i - 1);
 		} else {
 			r = host;
 		}
 	}
 
 	// Task 2: create the string to sign.
-	std::string credentialScope;
-	formatstr(credentialScope, "%s/%s/%s/aws4_request", d, r.c_str(),
-			  s.c_str());
-	std::string stringToSign;
-	formatstr(stringToSign, "AWS4-HMAC-SHA256\n%s\n%s\n%s", dt,
-			  credentialScope.c_str(), canonicalRequestHash.c_str());
+	std::string &credentialScope = buf.credentialScope;
+	credentialScope.assign(d).append(1, '/').append(r).append(1, '/');
+	credentialScope.append(s).append("/aws4_request");
+	std::string &stringToSign = buf.stringToSign;
+	stringToSign.assign("AWS4-HMAC-SHA256\n").append(dt).append(1, '\n');
+	stringToSign.append(credentialScope).append(1, '\n');
+	stringToSign.append(buf.requestHash);
 
 	//
 	// Creating task 3's inputs was done when we checked to see if we needed
@@ -339,10 +494,10 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 	//
 
 	// Task 3: calculate the signature.
-	saKey = "AWS4" + saKey;
-	const unsigned char *hmac =
-		HMAC(EVP_sha256(), saKey.c_str(), saKey.length(), (unsigned char *)d,
-			 sizeof(d) - 1, messageDigest, &mdLength);
+	buf.key.assign("AWS4").append(saKey);
+	const unsigned char *hmac = HMAC(
+		EVP_sha256(), buf.key.data(), buf.key.length(), (unsigned char *)d,
+		sizeof(d) - 1, messageDigest, &mdLength);
 	if (hmac == NULL) {
 		return false;
 	}
@@ -350,14 +505,14 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 	unsigned int md2Length = 0;
 	unsigned char messageDigest2[EVP_MAX_MD_SIZE];
 	hmac = HMAC(EVP_sha256(), messageDigest, mdLength,
-				(const unsigned char *)r.c_str(), r.length(), messageDigest2,
+				(const unsigned char *)r.data(), r.length(), messageDigest2,
 				&md2Length);
 	if (hmac == NULL) {
 		return false;
 	}
 
 	hmac = HMAC(EVP_sha256(), messageDigest2, md2Length,
-				(const unsigned char *)s.c_str(), s.length(), messageDigest,
+				(const unsigned char *)s.data(), s.length(), messageDigest,
 				&mdLength);
 	if (hmac == NULL) {
 		return false;
@@ -371,20 +526,26 @@ bool AmazonRequest::createV4Signature(const std::string &payload,
 	}
 
 	hmac = HMAC(EVP_sha256(), messageDigest2, md2Length,
-				(const unsigned char *)stringToSign.c_str(),
+				(const unsigned char *)stringToSign.data(),
 				stringToSign.length(), messageDigest, &mdLength);
 	if (hmac == NULL) {
 		return false;
 	}
 
-	std::string signature;
-	convertMessageDigestToLowercaseHex(messageDigest, mdLength, signature);
-
-	formatstr(authorizationValue,
-			  "AWS4-HMAC-SHA256 Credential=%s/%s,"
-			  " SignedHeaders=%s, Signature=%s",
-			  keyID.c_str(), credentialScope.c_str(), signedHeaders.c_str(),
-			  signature.c_str());
+	convertMessageDigestToLowercaseHex(messageDigest, mdLength,
+									   buf.signature);
+
+	authorizationValue.clear();
+	authorizationValue.reserve(96 + keyID.size() + credentialScope.size() +
+							   buf.signedHeaders.size());
+	authorizationValue.append("AWS4-HMAC-SHA256 Credential=")
+		.append(keyID)
+		.append(1, '/')
+		.append(credentialScope)
+		.append(", SignedHeaders=")
+		.append(buf.signedHeaders)
+		.append(", Signature=")
+		.append(buf.signature);
 	return true;
 }
 
@@ -400,24 +561,60 @@ bool AmazonRequest::sendV4Request(const std::string &payload,
 		// dprintf( D_FULLDEBUG, "Payload is '%s'\n", payload.c_str() );
 	}
 
-	std::string authorizationValue;
-	if (!createV4Signature(payload, authorizationValue, sendContentSHA)) {
-		if (this->errorCode.empty()) {
-			this->errorCode = "E_INTERNAL";
+	// Signing encodes canonicalURI in place, so keep the original for a
+	// retry in another region.
+	std::string uri = canonicalURI;
+	for (int attempt = 0;; attempt++) {
+		std::string authorizationValue;
+		auto signStart = std::chrono::steady_clock::now();
+		bool signedOK =
+			createV4Signature(payload, authorizationValue, sendContentSHA);
+		timing.signing = std::chrono::duration_cast<std::chrono::microseconds>(
+							 std::chrono::steady_clock::now() - signStart)
+							 .count();
+		XRDHTTP_PROBE2(request__sign, this, timing.signing);
+		if (!signedOK) {
+			if (this->errorCode.empty()) {
+				this->errorCode = "E_INTERNAL";
+			}
+			if (this->errorMessage.empty()) {
+				this->errorMessage = "Failed to create v4 signature.";
+			}
+			return false;
 		}
-		if (this->errorMessage.empty()) {
-			this->errorMessage = "Failed to create v4 signature.";
+
+		// When accessing an unauthenticated bucket, providing an auth header
+		// will cause errors
+		if (!authorizationValue.empty()) {
+			headers["Authorization"] = authorizationValue;
 		}
-		return false;
-	}
 
-	// When accessing an unauthenticated bucket, providing an auth header will
-	// cause errors
-	if (!authorizationValue.empty()) {
-		headers["Authorization"] = authorizationValue;
-	}
+		bucketRegion.clear();
+		if (sendPreparedRequest(protocol, hostUrl, payload)) {
+			return true;
+		}
 
-	return sendPreparedRequest(protocol, hostUrl, payload);
+		// S3 refuses a request signed for, or sent to, the wrong region
+		// (with a 301 or a 400) but names the bucket's region in the
+		// response.  Remember it for every later request to the bucket and
+		// try once more there.
+		if (attempt > 0 || bucketRegion.empty() || bucketRegion == region) {
+			return false;
+		}
+		BucketRegionCache::Instance().Set(serviceUrl, bucketName(),
+										  bucketRegion);
+		std::string msg = "Bucket '" + std::string(bucketName()) +
+						  "' is in region " + bucketRegion +
+						  "; retrying the request there";
+		m_log.Log(LogMask::Info, "AmazonRequest", msg.c_str());
+		// The old signature must not be signed along with the new one.
+		headers.erase("Authorization");
+		canonicalURI = uri;
+		useRegion(bucketRegion);
+		resultString.clear();
+		errorCode.clear();
+		errorMessage.clear();
+	}
 }
 
 // It's stated in the API documentation that you can upload to any region
@@ -474,6 +671,97 @@ bool AmazonS3Download::SendRequest(off_t offset, size_t size) {
 
 // ---------------------------------------------------------------------------
 
+AmazonS3Presign::~AmazonS3Presign() {}
+
+bool AmazonS3Presign::Presign(std::chrono::seconds validity,
+							  std::string &url) {
+	// S3 refuses pre-signed URLs that claim to be valid for longer.
+	if (validity.count() <= 0 || validity.count() > 604800) {
+		this->errorCode = "E_INVALID_ARGUMENT";
+		this->errorMessage = "Pre-signed URL validity must be between one "
+							 "second and seven days.";
+		return false;
+	}
+
+	std::shared_ptr<const AWSCredential> credential;
+	if (!readCredentials(credential)) {
+		return false;
+	}
+	std::string path = pathEncode(canonicalURI);
+	if (!credential) {
+		// An unauthenticated bucket; there is nothing to sign.
+		url = protocol + "://" + host + path;
+		return true;
+	}
+
+	// As in SendS3Request().
+	service = "s3";
+	if (region.empty()) {
+		region = "us-east-1";
+	}
+
+	time_t now = signatureTime.tv_sec;
+	if (!now) {
+		time(&now);
+	}
+	struct tm brokenDownTime;
+	gmtime_r(&now, &brokenDownTime);
+	char dt[] = "YYYYMMDDThhmmssZ";
+	strftime(dt, sizeof(dt), "%Y%m%dT%H%M%SZ", &brokenDownTime);
+	char d[] = "YYYYMMDD";
+	strftime(d, sizeof(d), "%Y%m%d", &brokenDownTime);
+
+	// Only the Host header is signed, so the Range header of each read can
+	// vary, and the payload of a GET is never hashed.
+	std::string credentialScope =
+		std::string(d) + "/" + region + "/" + service + "/aws4_request";
+	AttributeValueMap query{
+		{"X-Amz-Algorithm", "AWS4-HMAC-SHA256"},
+		{"X-Amz-Credential", credential->accessKeyID() + "/" + credentialScope},
+		{"X-Amz-Date", dt},
+		{"X-Amz-Expires", std::to_string(validity.count())},
+		{"X-Amz-SignedHeaders", "host"},
+	};
+	if (!credential->securityToken().empty()) {
+		query["X-Amz-Security-Token"] = credential->securityToken();
+	}
+	std::string queryString = AWSv4Impl::canonicalizeQueryString(query);
+	std::string canonicalRequest = "GET\n" + path + "\n" + queryString +
+								   "\nhost:" + host + "\n\nhost\n" +
+								   "UNSIGNED-PAYLOAD";
+
+	unsigned int mdLength = 0;
+	unsigned char messageDigest[EVP_MAX_MD_SIZE];
+	if (!doSha256(canonicalRequest, messageDigest, &mdLength)) {
+		this->errorCode = "E_INTERNAL";
+		this->errorMessage = "Unable to hash canonical request.";
+		return false;
+	}
+	std::string canonicalRequestHash;
+	convertMessageDigestToLowercaseHex(messageDigest, mdLength,
+									   canonicalRequestHash);
+
+	std::string stringToSign = std::string("AWS4-HMAC-SHA256\n") + dt + "\n" +
+							   credentialScope + "\n" + canonicalRequestHash;
+	std::string signature;
+	if (!AWSv4Impl::createSignature(credential->secretAccessKey(), d, region,
+									service, stringToSign, signature)) {
+		this->errorCode = "E_INTERNAL";
+		this->errorMessage = "Unable to sign pre-signed URL.";
+		return false;
+	}
+
+	url = protocol + "://" + host + path + "?" + queryString +
+		  "&X-Amz-Signature=" + signature;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+PresignedDownload::~PresignedDownload() {}
+
+// ---------------------------------------------------------------------------
+
 AmazonS3Head::~AmazonS3Head() {}
 
 bool AmazonS3Head::SendRequest() {
@@ -18,9 +18,42 @@
 
 #pragma once
 
+#include "AWSCredential.hh"
 #include "HTTPCommands.hh"
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <utility>
+
+// The region of each bucket, as learned from the x-amz-bucket-region header
+// of a response, keyed by service URL and bucket.  Shared by all requests so
+// that only the first request to a bucket in an unexpected region is
+// redirected.
+class BucketRegionCache {
+  public:
+	static BucketRegionCache &Instance();
+
+	// Sets `region` and returns true if the region of `bucket` is known.
+	bool Get(std::string_view serviceUrl, std::string_view bucket,
+			 std::string &region) const;
+	void Set(std::string_view serviceUrl, std::string_view bucket,
+			 const std::string &region);
+
+  private:
+	BucketRegionCache() {}
+
+	mutable std::shared_mutex m_mutex;
+	// Checked first so that, until a region is learned, lookups take no lock.
+	std::atomic<bool> m_empty{true};
+	std::map<std::string, std::map<std::string, std::string, std::less<>>,
+			 std::less<>>
+		m_regions;
+};
 
 class AmazonRequest : public HTTPRequest {
   public:
@@ -29,7 +62,8 @@ class AmazonRequest : public HTTPRequest {
 				  const std::string &o, const std::string &style, int sv,
 				  XrdSysError &log)
 		: HTTPRequest(s, log), accessKeyFile(akf), secretKeyFile(skf),
-		  signatureVersion(sv), bucket(b), object(o), style(style) {
+		  signatureVersion(sv), bucket(b), object(o), style(style),
+		  serviceUrl(s) {
 		requiresSignature = true;
 		// Start off by parsing the hostUrl, which we use in conjunction with
 		// the bucket to fill in the host (for setting host header). For
@@ -61,6 +95,13 @@ class AmazonRequest : public HTTPRequest {
 		if (host.find("s3.") == 0) {
 			region = host.substr(3, secondDot - 2 - 1);
 		}
+
+		// A region learned from an earlier response overrides the guess.
+		std::string learned;
+		if (BucketRegionCache::Instance().Get(serviceUrl, bucketName(),
+											  learned)) {
+			useRegion(learned);
+		}
 	}
 	virtual ~AmazonRequest();
 
@@ -72,11 +113,18 @@ class AmazonRequest : public HTTPRequest {
 	virtual bool SendRequest();
 	virtual bool SendS3Request(const std::string &payload);
 
+	// Sign with these credentials instead of reading the key files, e.g.
+	// a snapshot from a CredentialProvider.
+	void SetCredential(std::shared_ptr<const AWSCredential> credential) {
+		this->credential = std::move(credential);
+	}
+
   protected:
 	bool sendV4Request(const std::string &payload, bool sendContentSHA = false);
 
 	std::string accessKeyFile;
 	std::string secretKeyFile;
+	std::shared_ptr<const AWSCredential> credential;
 
 	int signatureVersion;
 
@@ -90,12 +138,34 @@ class AmazonRequest : public HTTPRequest {
 	std::string service;
 
 	std::string style;
+	std::string serviceUrl;
 
-  private:
+	// The region named by the x-amz-bucket-region header of the latest
+	// response, if any.
+	std::string bucketRegion;
+
+	// The bucket the request is for: the configured bucket or, when the
+	// bucket is part of the object path, its first component.
+	std::string_view bucketName() const;
+
+	// Sign for `region` from now on and, for an AWS endpoint, send to that
+	// region's endpoint.
+	void useRegion(const std::string &region);
+
+	void responseHeader(std::string_view name, std::string_view value) override;
+
+	// The credentials to sign with: those passed to SetCredential(), or
+	// else read from the key files.  Null for an unauthenticated bucket,
+	// which has no secret key file.
+	bool readCredentials(std::shared_ptr<const AWSCredential> &credential);
+
+	// Sets the signing headers and computes the Authorization value; exposed
+	// to subclasses so bench/microbench.cc can sign without sending.
 	bool createV4Signature(const std::string &payload,
 						   std::string &authorizationHeader,
 						   bool sendContentSHA = false);
 
+  private:
 	std::string canonicalizeQueryString();
 };
 
@@ -133,6 +203,35 @@ class AmazonS3Download : public AmazonRequest {
 	virtual bool SendRequest(off_t offset, size_t size);
 };
 
+// Generates query-string pre-signed GET URLs for an object, which can then
+// be read with PresignedDownload without signing each request.
+class AmazonS3Presign : public AmazonRequest {
+  public:
+	AmazonS3Presign(const std::string &s, const std::string &akf,
+					const std::string &skf, const std::string &b,
+					const std::string &o, const std::string &style,
+					XrdSysError &log)
+		: AmazonRequest(s, akf, skf, b, o, style, 4, log) {}
+
+	virtual ~AmazonS3Presign();
+
+	// Sets `url` to a URL for GETs of the object that stays valid for
+	// `validity` (at most seven days) from now.  Sends nothing.
+	bool Presign(std::chrono::seconds validity, std::string &url);
+};
+
+// A (range) GET of a URL from AmazonS3Presign; the URL carries the
+// signature, so the request needs none of its own.
+class PresignedDownload : public HTTPDownload {
+  public:
+	PresignedDownload(const std::string &url, XrdSysError &log)
+		: HTTPDownload(url, "", log) {
+		hostUrl = url;
+	}
+
+	virtual ~PresignedDownload();
+};
+
 class AmazonS3Head : public AmazonRequest {
 	using AmazonRequest::SendRequest;
 
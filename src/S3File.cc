@@ -17,9 +17,12 @@
  ***************************************************************/
 
 #include "S3File.hh"
+#include "AccessLog.hh"
+#include "CredentialProvider.hh"
 #include "S3Commands.hh"
 #include "S3FileSystem.hh"
 #include "logging.hh"
+#include "probes.hh"
 #include "stl_string_utils.hh"
 
 #include <XrdOuc/XrdOucEnv.hh>
@@ -31,7 +34,7 @@
 
 #include <curl/curl.h>
 
-#include <filesystem>
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -48,74 +51,48 @@ XrdVERSIONINFO(XrdOssGetFileSystem, S3);
 S3File::S3File(XrdSysError &log, S3FileSystem *oss)
 	: m_log(log), m_oss(oss), content_length(0), last_modified(0) {}
 
+// Splits a path of the form /exposedPath/object into the export configured
+// for the longest matching s3.path_name and the object key, which may itself
+// contain path separators.  The object view points into `fullPath`.
 int parse_path(const S3FileSystem &fs, const char *fullPath,
-			   std::string &exposedPath, std::string &object) {
-	//
-	// Check the path for validity.
-	//
-	std::filesystem::path p(fullPath);
-	auto pathComponents = p.begin();
-
-	// Iterate through components of the fullPath until we either find a match
-	// or we've reached the end of the path.
-	std::filesystem::path currentPath = *pathComponents;
-	while (pathComponents != p.end()) {
-		if (fs.exposedPathExists(currentPath.string())) {
-			exposedPath = currentPath.string();
-			break;
-		}
-		++pathComponents;
-		if (pathComponents != p.end()) {
-			currentPath /= *pathComponents;
-		} else {
-			return -ENOENT;
-		}
-	}
-
-	// Objects names may contain path separators.
-	++pathComponents;
-	if (pathComponents == p.end()) {
+			   const S3AccessInfo *&info, std::string_view &object) {
+	info = fs.getAccessInfo(fullPath, object);
+	if (!info || object.empty()) {
 		return -ENOENT;
 	}
-
-	std::filesystem::path objectPath = *pathComponents++;
-	for (; pathComponents != p.end(); ++pathComponents) {
-		objectPath /= (*pathComponents);
-	}
-	object = objectPath.string();
-
-	fprintf(stderr, "object = %s\n", object.c_str());
-
 	return 0;
 }
 
 int S3File::Open(const char *path, int Oflag, mode_t Mode, XrdOucEnv &env) {
-	std::string exposedPath, object;
-	int rv = parse_path(*m_oss, path, exposedPath, object);
+	auto start = std::chrono::steady_clock::now();
+	m_path = path;
+	const S3AccessInfo *info = nullptr;
+	std::string_view object;
+	int rv = parse_path(*m_oss, path, info, object);
 	if (rv != 0) {
+		XRDHTTP_PROBE3(file__open, path, Oflag, rv);
+		AccessLog::Instance().Record(AccessOp::Open, m_path, 0, 0, rv, start);
 		return rv;
 	}
-	if (!m_oss->exposedPathExists(exposedPath))
-		return -ENOENT;
-
-	std::string configured_s3_region = m_oss->getS3Region(exposedPath);
-	std::string configured_s3_service_url = m_oss->getS3ServiceURL(exposedPath);
-	std::string configured_s3_access_key =
-		m_oss->getS3AccessKeyFile(exposedPath);
-	std::string configured_s3_secret_key =
-		m_oss->getS3SecretKeyFile(exposedPath);
-	std::string configured_s3_bucket_name = m_oss->getS3BucketName(exposedPath);
-	std::string configured_s3_url_style = m_oss->getS3URLStyle();
 
 	// We used to query S3 here to see if the object existed, but of course
 	// if you're creating a file on upload, you don't care.
 
 	this->s3_object_name = object;
-	this->s3_bucket_name = configured_s3_bucket_name;
-	this->s3_service_url = configured_s3_service_url;
-	this->s3_access_key = configured_s3_access_key;
-	this->s3_secret_key = configured_s3_secret_key;
-	this->s3_url_style = configured_s3_url_style;
+	this->s3_bucket_name = info->getS3BucketName();
+	this->s3_service_url = info->getS3ServiceUrl();
+	this->s3_access_key = info->getS3AccessKeyFile();
+	this->s3_secret_key = info->getS3SecretKeyFile();
+	this->s3_url_style = info->getS3URLStyle();
+	this->m_stats = info->getStats();
+	this->m_transport = &info->getTransport();
+	this->m_credentials = info->getCredentialProvider();
+	if (m_oss->getPresignedURLCache()) {
+		// Everything the URL depends on.
+		m_presign_key = s3_service_url + "\n" + s3_url_style + "\n" +
+						s3_access_key + "\n" + s3_bucket_name + "\n" +
+						s3_object_name;
+	}
 
 	// This flag is not set when it's going to be a read operation
 	// so we check if the file exists in order to be able to return a 404
@@ -123,37 +100,126 @@ int S3File::Open(const char *path, int Oflag, mode_t Mode, XrdOucEnv &env) {
 		AmazonS3Head head(this->s3_service_url, this->s3_access_key,
 						  this->s3_secret_key, this->s3_bucket_name,
 						  this->s3_object_name, this->s3_url_style, m_log);
+		prepare(head);
+		setCredential(head);
 
 		if (!head.SendRequest()) {
+			XRDHTTP_PROBE3(file__open, path, Oflag, -ENOENT);
+			AccessLog::Instance().Record(AccessOp::Open, m_path, 0, 0, -ENOENT,
+										 start);
 			return -ENOENT;
 		}
 	}
 
+	XRDHTTP_PROBE3(file__open, path, Oflag, 0);
+	AccessLog::Instance().Record(AccessOp::Open, m_path, 0, 0, 0, start);
 	return 0;
 }
 
+void S3File::prepare(HTTPRequest &request) const {
+	request.SetStats(m_stats);
+	request.SetTransport(m_transport);
+}
+
+void S3File::setCredential(AmazonRequest &request) const {
+	if (m_credentials) {
+		request.SetCredential(m_credentials->get());
+	}
+}
+
+bool S3File::presignedURL(PresignedURLCache &cache, std::string &key,
+						  std::string &url) {
+	key = m_presign_key;
+	auto validity = cache.validity();
+	std::shared_ptr<const AWSCredential> credential;
+	if (m_credentials) {
+		// A URL is only good while the credentials that signed it are.
+		credential = m_credentials->get();
+		key += "\n" + credential->accessKeyID();
+		if (credential->expires()) {
+			validity = std::min(
+				validity, std::chrono::duration_cast<std::chrono::seconds>(
+							  credential->expiration() -
+							  std::chrono::system_clock::now()));
+		}
+	}
+	if (cache.get(key, url)) {
+		return true;
+	}
+	if (validity.count() < 1) {
+		return false;
+	}
+	AmazonS3Presign presign(this->s3_service_url, this->s3_access_key,
+							this->s3_secret_key, this->s3_bucket_name,
+							this->s3_object_name, this->s3_url_style, m_log);
+	presign.SetCredential(credential);
+	if (!presign.Presign(validity, url)) {
+		XRDHTTP_LOG(m_log, LogMask::Warning, "S3File::Read",
+					"Failed to pre-sign a URL for", m_path.c_str());
+		return false;
+	}
+	cache.put(key, url, validity);
+	return true;
+}
+
 ssize_t S3File::Read(void *buffer, off_t offset, size_t size) {
+	auto start = std::chrono::steady_clock::now();
+	PresignedURLCache *cache = m_oss->getPresignedURLCache();
+	std::string key, url;
+	if (cache && presignedURL(*cache, key, url)) {
+		PresignedDownload download(url, m_log);
+		prepare(download);
+		bool ok = download.SendRequest(offset, size);
+		auto code = download.getResponseCode();
+		if (ok || (code != 400 && code != 403)) {
+			return finishRead(download, ok, buffer, offset, size, start);
+		}
+		// The backend refused the URL, perhaps because the credentials
+		// changed since it was signed: sign this read instead, and the
+		// next one gets a new URL.
+		cache->erase(key);
+	}
+
 	AmazonS3Download download(this->s3_service_url, this->s3_access_key,
 							  this->s3_secret_key, this->s3_bucket_name,
 							  this->s3_object_name, this->s3_url_style, m_log);
+	prepare(download);
+	setCredential(download);
+	bool ok = download.SendRequest(offset, size);
+	return finishRead(download, ok, buffer, offset, size, start);
+}
 
-	if (!download.SendRequest(offset, size)) {
-		std::stringstream ss;
-		ss << "Failed to send GetObject command: " << download.getResponseCode()
-		   << "'" << download.getResultString() << "'";
-		m_log.Log(LogMask::Warning, "S3File::Read", ss.str().c_str());
+ssize_t S3File::finishRead(const HTTPRequest &download, bool ok, void *buffer,
+						   off_t offset, size_t size,
+						   std::chrono::steady_clock::time_point start) {
+	if (!ok) {
+		XRDHTTP_LOG_STREAM(m_log, LogMask::Warning, "S3File::Read",
+						   "Failed to send GetObject command: "
+							   << download.getResponseCode() << "'"
+							   << download.getResultString() << "'");
+		XRDHTTP_PROBE5(file__read, s3_object_name.c_str(), offset, size,
+					   probeMicrosSince(start), 0);
+		AccessLog::Instance().Record(AccessOp::Read, m_path, offset, size, 0,
+									 start);
 		return 0;
 	}
 
 	const std::string &bytes = download.getResultString();
 	memcpy(buffer, bytes.data(), bytes.size());
+	XRDHTTP_PROBE5(file__read, s3_object_name.c_str(), offset, size,
+				   probeMicrosSince(start), bytes.size());
+	AccessLog::Instance().Record(AccessOp::Read, m_path, offset, size,
+								 bytes.size(), start);
 	return bytes.size();
 }
 
 int S3File::Fstat(struct stat *buff) {
+	auto start = std::chrono::steady_clock::now();
 	AmazonS3Head head(this->s3_service_url, this->s3_access_key,
 					  this->s3_secret_key, this->s3_bucket_name,
 					  this->s3_object_name, this->s3_url_style, m_log);
+	prepare(head);
+	setCredential(head);
 
 	if (!head.SendRequest()) {
 		// SendRequest() returns false for all errors, including ones
@@ -161,10 +227,12 @@ int S3File::Fstat(struct stat *buff) {
 		// than code 200.  If xrootd wants us to distinguish between
 		// these cases, head.getResponseCode() is initialized to 0, so
 		// we can check.
-		std::stringstream ss;
-		ss << "Failed to send HeadObject command: " << head.getResponseCode()
-		   << "'" << head.getResultString() << "'";
-		m_log.Log(LogMask::Warning, "S3File::Fstat", ss.str().c_str());
+		XRDHTTP_LOG_STREAM(m_log, LogMask::Warning, "S3File::Fstat",
+						   "Failed to send HeadObject command: "
+							   << head.getResponseCode() << "'"
+							   << head.getResultString() << "'");
+		AccessLog::Instance().Record(AccessOp::Stat, m_path, 0, 0, -ENOENT,
+									 start);
 		return -ENOENT;
 	}
 
@@ -214,26 +282,43 @@ int S3File::Fstat(struct stat *buff) {
 	buff->st_dev = 0;
 	buff->st_ino = 0;
 
+	AccessLog::Instance().Record(AccessOp::Stat, m_path, 0, content_length, 0,
+								 start);
 	return 0;
 }
 
 ssize_t S3File::Write(const void *buffer, off_t offset, size_t size) {
+	auto start = std::chrono::steady_clock::now();
 	AmazonS3Upload upload(this->s3_service_url, this->s3_access_key,
 						  this->s3_secret_key, this->s3_bucket_name,
 						  this->s3_object_name, this->s3_url_style, m_log);
+	prepare(upload);
+	setCredential(upload);
 
 	std::string payload((char *)buffer, size);
 	if (!upload.SendRequest(payload, offset, size)) {
-		m_log.Emsg("Open", "upload.SendRequest() failed");
+		m_log.Log(LogMask::Warning, "S3File::Write", "Failed to upload",
+				  m_path.c_str(), upload.getResultString().c_str());
+		XRDHTTP_PROBE5(file__write, s3_object_name.c_str(), offset, size,
+					   probeMicrosSince(start), -ENOENT);
+		AccessLog::Instance().Record(AccessOp::Write, m_path, offset, size,
+									 -ENOENT, start);
 		return -ENOENT;
 	} else {
-		m_log.Emsg("Open", "upload.SendRequest() succeeded");
+		XRDHTTP_PROBE5(file__write, s3_object_name.c_str(), offset, size,
+					   probeMicrosSince(start), 0);
+		AccessLog::Instance().Record(AccessOp::Write, m_path, offset, size, 0,
+									 start);
 		return 0;
 	}
 }
 
 int S3File::Close(long long *retsz) {
-	m_log.Emsg("Close", "Closed our S3 file");
+	XRDHTTP_PROBE1(file__close, s3_object_name.c_str());
+	XRDHTTP_LOG(m_log, LogMask::Debug, "S3File::Close", "Closed",
+				m_path.c_str());
+	AccessLog::Instance().Record(AccessOp::Close, m_path, 0, 0, 0,
+								 std::chrono::steady_clock::now());
 	return 0;
 }
 
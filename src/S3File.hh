@@ -26,12 +26,18 @@
 #include <XrdSec/XrdSecEntityAttr.hh>
 #include <XrdVersion.hh>
 
+#include <chrono>
 #include <memory>
+#include <string_view>
 
 #include <fcntl.h>
 
+class AmazonRequest;
+class CredentialProvider;
+class HTTPRequest;
+
 int parse_path(const S3FileSystem &fs, const char *path,
-			   std::string &exposedPath, std::string &object);
+			   const S3AccessInfo *&info, std::string_view &object);
 
 class S3File : public XrdOssDF {
   public:
@@ -95,15 +101,34 @@ class S3File : public XrdOssDF {
 	time_t getLastModified() { return last_modified; }
 
   private:
+	// Count `request` in the export's statistics and send it over the
+	// export's transport.
+	void prepare(HTTPRequest &request) const;
+	// Sign `request` with the export's temporary credentials, if any.
+	void setCredential(AmazonRequest &request) const;
+	// Set `url` to a pre-signed URL for the object, from the cache if it
+	// has a fresh one, and `key` to its key in the cache.
+	bool presignedURL(PresignedURLCache &cache, std::string &key,
+					  std::string &url);
+	// Copy out the result of a read, or log why it failed.
+	ssize_t finishRead(const HTTPRequest &download, bool ok, void *buffer,
+					   off_t offset, size_t size,
+					   std::chrono::steady_clock::time_point start);
+
 	XrdSysError &m_log;
 	S3FileSystem *m_oss;
 
+	std::string m_path;
 	std::string s3_service_url;
 	std::string s3_bucket_name;
 	std::string s3_object_name;
 	std::string s3_access_key;
 	std::string s3_secret_key;
 	std::string s3_url_style;
+	std::string m_presign_key;
+	ExportStats *m_stats{nullptr};
+	const TransportOptions *m_transport{nullptr};
+	CredentialProvider *m_credentials{nullptr};
 
 	size_t content_length;
 	time_t last_modified;
@@ -17,9 +17,14 @@
  ***************************************************************/
 
 #include "S3FileSystem.hh"
+#include "AccessLog.hh"
+#include "CredentialProvider.hh"
+#include "EndpointIPManager.hh"
+#include "HTTPCommands.hh"
 #include "S3AccessInfo.hh"
 #include "S3Directory.hh"
 #include "S3File.hh"
+#include "logging.hh"
 #include "shortfile.hh"
 #include "stl_string_utils.hh"
 
@@ -37,9 +42,51 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+using namespace XrdHTTPServer;
+
+namespace {
+
+// The style s3.url_style auto stands for at `serviceUrl`: path style, so
+// that all buckets share the endpoint's connections, DNS entries and TLS
+// sessions, unless the endpoint serves only virtual-hosted requests, as the
+// zonal endpoints of S3 Express One Zone do.
+std::string autoURLStyle(const std::string &serviceUrl) {
+	auto begin = serviceUrl.find("://");
+	begin = begin == std::string::npos ? 0 : begin + 3;
+	std::string host =
+		serviceUrl.substr(begin, serviceUrl.find_first_of(":/", begin) - begin);
+	if (host.compare(0, 10, "s3express-") == 0) {
+		return "virtual";
+	}
+	return "path";
+}
+
+// Whether `attribute` configures a single export's credentials or transport,
+// and so only makes sense between s3.begin and s3.end.
+bool isExportDirective(const std::string &attribute) {
+	static const char *const credentialDirectives[] = {
+		"s3.sts_endpoint",
+		"s3.role_arn",
+		"s3.web_identity_token_file",
+		"s3.role_session_name",
+		"s3.credential_metadata_url",
+		"s3.credential_metadata_token_file",
+		"s3.credential_process",
+	};
+	for (const char *directive : credentialDirectives) {
+		if (attribute == directive) {
+			return true;
+		}
+	}
+	return attribute.compare(0, 3, "s3.") == 0 &&
+		   TransportOptions::IsOption(attribute.substr(3));
+}
+
+} // namespace
+
 S3FileSystem::S3FileSystem(XrdSysLogger *lp, const char *configfn,
 						   XrdOucEnv *envP)
-	: m_env(envP), m_log(lp, "s3_") {
+	: m_env(envP), m_log(lp, "s3_"), m_stats("s3", m_log) {
 	m_log.Say("------ Initializing the S3 filesystem plugin.");
 	if (!Config(lp, configfn)) {
 		throw std::runtime_error("Failed to configure S3 filesystem plugin.");
@@ -48,6 +95,51 @@ S3FileSystem::S3FileSystem(XrdSysLogger *lp, const char *configfn,
 
 S3FileSystem::~S3FileSystem() {}
 
+bool S3FileSystem::configureCredentials(const CredentialConfig &config,
+										S3AccessInfo &info) {
+	std::unique_ptr<CredentialProvider> provider;
+	int sources = 0;
+	if (!config.role_arn.empty() || !config.web_identity_token_file.empty()) {
+		if (config.role_arn.empty() || config.web_identity_token_file.empty()) {
+			m_log.Emsg("Config", "s3.role_arn and s3.web_identity_token_file "
+								 "must be set together");
+			return false;
+		}
+		provider.reset(new WebIdentityCredentialProvider(
+			config.sts_endpoint, config.role_arn,
+			config.web_identity_token_file, config.role_session_name, m_log));
+		sources++;
+	}
+	if (!config.metadata_url.empty()) {
+		provider.reset(new MetadataCredentialProvider(
+			config.metadata_url, config.metadata_token_file, m_log));
+		sources++;
+	}
+	if (!config.process.empty()) {
+		provider.reset(new ProcessCredentialProvider(config.process, m_log));
+		sources++;
+	}
+	if (!sources) {
+		return true;
+	}
+	if (sources > 1 || !info.getS3AccessKeyFile().empty() ||
+		!info.getS3SecretKeyFile().empty()) {
+		m_log.Emsg("Config", "An export may use only one of key files, a web "
+							 "identity, a metadata endpoint and a credential "
+							 "process");
+		return false;
+	}
+
+	std::string err;
+	if (!provider->start(err)) {
+		m_log.Emsg("Config", "Failed to fetch credentials:", err.c_str());
+		return false;
+	}
+	info.setCredentialProvider(provider.get());
+	s3_credentials.push_back(std::move(provider));
+	return true;
+}
+
 bool S3FileSystem::handle_required_config(const char *desired_name,
 										  const std::string &source) {
 	if (source.empty()) {
@@ -73,13 +165,29 @@ bool S3FileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 	std::string value;
 	std::string attribute;
 	Config.Attach(cfgFD);
-	S3AccessInfo *newAccessInfo = new S3AccessInfo();
+	std::unique_ptr<S3AccessInfo> newAccessInfo(new S3AccessInfo());
 	std::string exposedPath;
+	CredentialConfig credentials;
+	TransportOptions transport;
+	bool inExport = false;
 	while ((temporary = Config.GetMyFirstWord())) {
 		attribute = temporary;
+		if (attribute == "s3.trace") {
+			if (!XrdHTTPServer::ConfigLog(Config, m_log, "s3.trace")) {
+				m_log.Emsg("Config", "Failed to configure the log level");
+			}
+			continue;
+		}
+		if (attribute == "s3.begin") {
+			inExport = true;
+		}
 		temporary = Config.GetWord();
 		if (attribute == "s3.end") {
-			s3_access_map[exposedPath] = newAccessInfo;
+			inExport = false;
+			if (exposedPath.empty()) {
+				m_log.Emsg("Config", "s3.path_name not specified");
+				return false;
+			}
 			if (newAccessInfo->getS3ServiceName().empty()) {
 				m_log.Emsg("Config", "s3.service_name not specified");
 				return false;
@@ -103,7 +211,20 @@ bool S3FileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 					return false;
 				}
 			}
-			newAccessInfo = new S3AccessInfo();
+			if (!configureCredentials(credentials, *newAccessInfo)) {
+				return false;
+			}
+			credentials = CredentialConfig();
+			newAccessInfo->setTransport(transport);
+			transport = TransportOptions();
+			if (!s3_export_trie.Insert(exposedPath, newAccessInfo.get())) {
+				m_log.Emsg("Config", "Duplicate s3.path_name",
+						   exposedPath.c_str());
+				return false;
+			}
+			newAccessInfo->setStats(m_stats.addExport(exposedPath));
+			s3_exports.push_back(std::move(newAccessInfo));
+			newAccessInfo.reset(new S3AccessInfo());
 			exposedPath = "";
 			continue;
 		}
@@ -112,6 +233,15 @@ bool S3FileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 		}
 		value = temporary;
 
+		// Outside a block these would silently apply to the next export,
+		// or to none at all after the last one.
+		if (!inExport && isExportDirective(attribute)) {
+			m_log.Emsg("Config", attribute.c_str(),
+					   "must be inside an s3.begin/s3.end block");
+			Config.Close();
+			return false;
+		}
+
 		if (!handle_required_config("s3.path_name", value)) {
 			Config.Close();
 			return false;
@@ -164,24 +294,128 @@ bool S3FileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 			newAccessInfo->setS3SecretKeyFile(value);
 		else if (attribute == "s3.service_url")
 			newAccessInfo->setS3ServiceUrl(value);
-		else if (attribute == "s3.url_style")
-			this->s3_url_style = value;
+		else if (attribute == "s3.sts_endpoint")
+			credentials.sts_endpoint = value;
+		else if (attribute == "s3.role_arn")
+			credentials.role_arn = value;
+		else if (attribute == "s3.web_identity_token_file")
+			credentials.web_identity_token_file = value;
+		else if (attribute == "s3.role_session_name")
+			credentials.role_session_name = value;
+		else if (attribute == "s3.credential_metadata_url")
+			credentials.metadata_url = value;
+		else if (attribute == "s3.credential_metadata_token_file")
+			credentials.metadata_token_file = value;
+		else if (attribute == "s3.credential_process") {
+			// The rest of the line is the command.
+			credentials.process = value;
+			while ((temporary = Config.GetWord())) {
+				credentials.process += std::string(" ") + temporary;
+			}
+		}
+		else if (attribute == "s3.url_style") {
+			// We want this to be case-insensitive.
+			toLower(value);
+			if (value != "virtual" && value != "path" && value != "auto") {
+				m_log.Emsg("Config", "invalid s3.url_style specified. Must be "
+									 "'virtual', 'path' or 'auto'");
+				Config.Close();
+				return false;
+			}
+			// Within s3.begin/s3.end it applies to that export only.
+			if (inExport) {
+				newAccessInfo->setS3URLStyle(value);
+			} else {
+				this->s3_url_style = value;
+			}
+		} else if (attribute.compare(0, 3, "s3.") == 0 &&
+				   TransportOptions::IsOption(attribute.substr(3))) {
+			std::string err;
+			if (!transport.Set(attribute.substr(3), value, err)) {
+				m_log.Emsg("Config",
+						   ("Invalid value for " + attribute + ":").c_str(),
+						   value.c_str(), ("(" + err + ")").c_str());
+				Config.Close();
+				return false;
+			}
+		} else if (attribute == "s3.endpoint_resolve_interval") {
+			std::chrono::milliseconds interval;
+			if (!parseDuration(value, interval)) {
+				m_log.Emsg("Config", "Invalid value for "
+									 "s3.endpoint_resolve_interval:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+			EndpointIPManager::Instance().SetRefreshInterval(
+				std::chrono::duration_cast<std::chrono::seconds>(interval));
+		} else if (attribute == "s3.presign_validity") {
+			std::chrono::milliseconds validity;
+			if (!parseDuration(value, validity) ||
+				validity < std::chrono::seconds(1) ||
+				validity > std::chrono::hours(24 * 7)) {
+				m_log.Emsg("Config",
+						   "Invalid value for s3.presign_validity (must be "
+						   "between 1s and 7 days):",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+			m_presigned_urls.reset(new PresignedURLCache(
+				std::chrono::duration_cast<std::chrono::seconds>(validity),
+				m_stats.addCache("presigned_url")));
+		} else if (attribute == "s3.access_log") {
+			if (!AccessLog::Instance().Start(value, m_log)) {
+				Config.Close();
+				return false;
+			}
+		} else if (attribute == "s3.stats_file") {
+			StatsRegistry::Format format = StatsRegistry::Format::Json;
+			const char *formatName = Config.GetWord();
+			if (formatName && !StatsRegistry::parseFormat(formatName, format)) {
+				m_log.Emsg("Config", "Invalid format for s3.stats_file (must "
+									 "be 'json' or 'prometheus'):",
+						   formatName);
+				Config.Close();
+				return false;
+			}
+			m_stats.setFile(value, format);
+		} else if (attribute == "s3.stats_interval") {
+			std::chrono::milliseconds interval;
+			if (!parseDuration(value, interval) || interval.count() == 0) {
+				m_log.Emsg("Config", "Invalid value for s3.stats_interval:",
+						   value.c_str());
+				Config.Close();
+				return false;
+			}
+			m_stats.setInterval(interval);
+		}
 	}
 
-	if (this->s3_url_style.empty()) {
-		m_log.Emsg("Config", "s3.url_style not specified");
-		return false;
-	} else {
-		// We want this to be case-insensitive.
-		toLower(this->s3_url_style);
-	}
-	if (this->s3_url_style != "virtual" && this->s3_url_style != "path") {
-		m_log.Emsg(
-			"Config",
-			"invalid s3.url_style specified. Must be 'virtual' or 'path'");
+	if (inExport) {
+		m_log.Emsg("Config", "s3.begin without a matching s3.end");
+		Config.Close();
 		return false;
 	}
 
+	// The default style can follow the exports it applies to.
+	for (auto &info : s3_exports) {
+		std::string style = info->getS3URLStyle();
+		if (style.empty()) {
+			style = this->s3_url_style;
+		}
+		if (style.empty()) {
+			m_log.Emsg("Config", "s3.url_style not specified");
+			return false;
+		}
+		if (style == "auto") {
+			style = autoURLStyle(info->getS3ServiceUrl());
+		}
+		info->setS3URLStyle(style);
+	}
+
+	s3_export_trie.Compile();
+
 	int retc = Config.LastError();
 	if (retc) {
 		m_log.Emsg("Config", -retc, "read config file", configfn);
@@ -190,6 +424,7 @@ bool S3FileSystem::Config(XrdSysLogger *lp, const char *configfn) {
 	}
 
 	Config.Close();
+	m_stats.startWriter();
 	return true;
 }
 
@@ -205,20 +440,18 @@ XrdOssDF *S3FileSystem::newFile(const char *user) {
 
 int S3FileSystem::Stat(const char *path, struct stat *buff, int opts,
 					   XrdOucEnv *env) {
-	std::string error;
-
-	m_log.Emsg("Stat", "Stat'ing path", path);
+	m_log.Log(LogMask::Debug, "Stat", "Stat'ing path", path);
 
 	S3File s3file(m_log, this);
 	int rv = s3file.Open(path, 0, (mode_t)0, *env);
 	if (rv) {
-		m_log.Emsg("Stat", "Failed to open path:", path);
+		m_log.Log(LogMask::Debug, "Stat",
+				  "Failed to open path:", path);
 	}
 	// Assume that S3File::FStat() doesn't write to buff unless it succeeds.
 	rv = s3file.Fstat(buff);
 	if (rv != 0) {
-		formatstr(error, "File %s not found.", path);
-		m_log.Emsg("Stat", error.c_str());
+		XRDHTTP_LOG(m_log, LogMask::Debug, "Stat", "File not found:", path);
 		return -ENOENT;
 	}
 
@@ -228,8 +461,9 @@ int S3FileSystem::Stat(const char *path, struct stat *buff, int opts,
 int S3FileSystem::Create(const char *tid, const char *path, mode_t mode,
 						 XrdOucEnv &env, int opts) {
 	// Is path valid?
-	std::string exposedPath, object;
-	int rv = parse_path(*this, path, exposedPath, object);
+	const S3AccessInfo *info = nullptr;
+	std::string_view object;
+	int rv = parse_path(*this, path, info, object);
 	if (rv != 0) {
 		return rv;
 	}
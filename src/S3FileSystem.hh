@@ -18,15 +18,22 @@
 
 #pragma once
 
+#include "PathTrie.hh"
+#include "PresignedURLCache.hh"
+#include "Stats.hh"
 #include "S3AccessInfo.hh"
+
 #include <XrdOss/XrdOss.hh>
 #include <XrdOuc/XrdOucStream.hh>
 #include <XrdSec/XrdSecEntity.hh>
 #include <XrdVersion.hh>
 
-#include <map>
+class CredentialProvider;
+
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 class S3FileSystem : public XrdOss {
   public:
@@ -69,7 +76,7 @@ class S3FileSystem : public XrdOss {
 	}
 	int Stat(const char *path, struct stat *buff, int opts = 0,
 			 XrdOucEnv *env = 0);
-	int Stats(char *buff, int blen) { return -ENOSYS; }
+	int Stats(char *buff, int blen) { return m_stats.xml(buff, blen); }
 	int StatFS(const char *path, char *buff, int &blen, XrdOucEnv *env = 0) {
 		return -ENOSYS;
 	}
@@ -101,30 +108,22 @@ class S3FileSystem : public XrdOss {
 		return nullptr;
 	}
 
-	bool exposedPathExists(const std::string &exposedPath) const {
-		return s3_access_map.count(exposedPath) > 0;
-	}
-	const std::string &getS3ServiceName(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3ServiceName();
-	}
-	const std::string &getS3Region(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3Region();
-	}
-	const std::string &getS3ServiceURL(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3ServiceUrl();
-	}
-	const std::string &getS3BucketName(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3BucketName();
+	// Find the export whose s3.path_name is the longest match for `path`;
+	// on success, `object` is set to the remainder of the path (pointing into
+	// `path`).  Returns nullptr if no export matches.
+	const S3AccessInfo *getAccessInfo(std::string_view path,
+									  std::string_view &object) const {
+		const S3AccessInfo *info = nullptr;
+		return s3_export_trie.Lookup(path, info, object) ? info : nullptr;
 	}
-	const std::string &
-	getS3AccessKeyFile(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3AccessKeyFile();
-	}
-	const std::string &
-	getS3SecretKeyFile(const std::string &exposedPath) const {
-		return s3_access_map.at(exposedPath)->getS3SecretKeyFile();
+
+	// The cache of pre-signed read URLs, or null if s3.presign_validity is
+	// not set.
+	PresignedURLCache *getPresignedURLCache() const {
+		return m_presigned_urls.get();
 	}
-	const std::string &getS3URLStyle() const { return s3_url_style; }
+
+	const StatsRegistry &getStats() const { return m_stats; }
 
   private:
 	XrdOucEnv *m_env;
@@ -132,6 +131,27 @@ class S3FileSystem : public XrdOss {
 
 	bool handle_required_config(const char *desired_name,
 								const std::string &source);
-	std::map<std::string, S3AccessInfo *> s3_access_map;
+
+	// The temporary credential settings of one export.
+	struct CredentialConfig {
+		std::string sts_endpoint{"https://sts.amazonaws.com"};
+		std::string role_arn;
+		std::string web_identity_token_file;
+		std::string role_session_name{"xrootd-s3"};
+		std::string metadata_url;
+		std::string metadata_token_file;
+		std::string process;
+	};
+	// Start the credential provider `config` describes, if any, for the
+	// export `info`.
+	bool configureCredentials(const CredentialConfig &config,
+							  S3AccessInfo &info);
+
+	std::vector<std::unique_ptr<S3AccessInfo>> s3_exports;
+	PathTrie<const S3AccessInfo *> s3_export_trie;
+	StatsRegistry m_stats;
+	// The default s3.url_style, for exports that do not set their own.
 	std::string s3_url_style;
+	std::unique_ptr<PresignedURLCache> m_presigned_urls;
+	std::vector<std::unique_ptr<CredentialProvider>> s3_credentials;
 };
@@ -0,0 +1,567 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "Stats.hh"
+#include "logging.hh"
+#include "stl_string_utils.hh"
+
+#include <XrdSys/XrdSysError.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace XrdHTTPServer;
+
+namespace {
+
+std::atomic<unsigned> g_next_shard{0};
+
+const unsigned g_num_ops = static_cast<unsigned>(StatsOp::Count);
+const unsigned g_num_errors = static_cast<unsigned>(StatsError::Count);
+
+// The quantiles reported in the XML and JSON renderings.
+const struct {
+	const char *name;
+	double q;
+} g_quantiles[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+
+std::string jsonEscape(const std::string &str) {
+	std::string result;
+	result.reserve(str.size());
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x",
+					 static_cast<unsigned>(c));
+			result += buf;
+		} else {
+			result += c;
+		}
+	}
+	return result;
+}
+
+std::string xmlEscape(const std::string &str) {
+	std::string result;
+	result.reserve(str.size());
+	for (char c : str) {
+		switch (c) {
+		case '&':
+			result += "&amp;";
+			break;
+		case '<':
+			result += "&lt;";
+			break;
+		case '>':
+			result += "&gt;";
+			break;
+		case '"':
+			result += "&quot;";
+			break;
+		default:
+			result += c;
+		}
+	}
+	return result;
+}
+
+// Prometheus label values use the same escapes as JSON strings, minus the
+// \u form, which it does not understand.
+std::string promEscape(const std::string &str) {
+	std::string result;
+	result.reserve(str.size());
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		} else if (c == '\n') {
+			result += "\\n";
+		} else {
+			result += c;
+		}
+	}
+	return result;
+}
+
+} // namespace
+
+unsigned statsShard() {
+	static thread_local unsigned shard =
+		g_next_shard.fetch_add(1, std::memory_order_relaxed) % g_stats_shards;
+	return shard;
+}
+
+const char *statsOpName(StatsOp op) {
+	switch (op) {
+	case StatsOp::Head:
+		return "head";
+	case StatsOp::Get:
+		return "get";
+	case StatsOp::Put:
+		return "put";
+	case StatsOp::List:
+		return "list";
+	default:
+		return "unknown";
+	}
+}
+
+const char *statsErrorName(StatsError err) {
+	switch (err) {
+	case StatsError::Network:
+		return "network";
+	case StatsError::Client:
+		return "client";
+	case StatsError::Server:
+		return "server";
+	case StatsError::Throttled:
+		return "throttled";
+	default:
+		return "unknown";
+	}
+}
+
+unsigned LatencyBuckets::index(uint64_t usec) {
+	const uint64_t linear = 1 << sub_bucket_bits;
+	if (usec < linear) {
+		return usec;
+	}
+	unsigned exponent = 63 - __builtin_clzll(usec);
+	if (exponent > max_exponent) {
+		return count - 1;
+	}
+	unsigned shift = exponent - sub_bucket_bits;
+	return ((exponent - sub_bucket_bits + 1) << sub_bucket_bits) +
+		   ((usec >> shift) & (linear - 1));
+}
+
+uint64_t LatencyBuckets::lowerBound(unsigned idx) {
+	const uint64_t linear = 1 << sub_bucket_bits;
+	if (idx < linear) {
+		return idx;
+	}
+	unsigned shift = (idx >> sub_bucket_bits) - 1;
+	return (linear + (idx & (linear - 1))) << shift;
+}
+
+uint64_t LatencyBuckets::upperBound(unsigned idx) {
+	const uint64_t linear = 1 << sub_bucket_bits;
+	if (idx < linear) {
+		return idx;
+	}
+	unsigned shift = (idx >> sub_bucket_bits) - 1;
+	return lowerBound(idx) + (uint64_t(1) << shift) - 1;
+}
+
+uint64_t LatencySnapshot::quantile(double q) const {
+	if (count == 0) {
+		return 0;
+	}
+	// The rank of the wanted value, counting from 1.
+	uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+	rank = std::max<uint64_t>(1, std::min(rank, count));
+	uint64_t seen = 0;
+	for (unsigned idx = 0; idx < buckets.size(); idx++) {
+		seen += buckets[idx];
+		if (seen >= rank) {
+			return LatencyBuckets::upperBound(idx);
+		}
+	}
+	return LatencyBuckets::upperBound(buckets.size() - 1);
+}
+
+OpStats::~OpStats() {
+	for (auto &shard : m_shards) {
+		delete shard.latency.load(std::memory_order_relaxed);
+	}
+}
+
+OpStats::Histogram &OpStats::histogram(Shard &shard) {
+	auto hist = shard.latency.load(std::memory_order_acquire);
+	if (hist) {
+		return *hist;
+	}
+	// Several threads may share the shard; the first to publish its
+	// histogram wins and the others discard theirs.
+	auto fresh = new Histogram();
+	if (shard.latency.compare_exchange_strong(hist, fresh,
+											  std::memory_order_acq_rel)) {
+		return *fresh;
+	}
+	delete fresh;
+	return *hist;
+}
+
+void OpStats::recordRequest(int64_t usec, uint64_t bytesIn, uint64_t bytesOut,
+							uint64_t reused) {
+	Shard &shard = m_shards[statsShard()];
+	uint64_t value = usec > 0 ? usec : 0;
+	shard.requests.fetch_add(1, std::memory_order_relaxed);
+	shard.bytes_in.fetch_add(bytesIn, std::memory_order_relaxed);
+	shard.bytes_out.fetch_add(bytesOut, std::memory_order_relaxed);
+	shard.connections_reused.fetch_add(reused, std::memory_order_relaxed);
+	shard.latency_sum.fetch_add(value, std::memory_order_relaxed);
+	histogram(shard).buckets[LatencyBuckets::index(value)].fetch_add(
+		1, std::memory_order_relaxed);
+}
+
+void OpStats::recordError(StatsError err) {
+	m_shards[statsShard()].errors[static_cast<unsigned>(err)].fetch_add(
+		1, std::memory_order_relaxed);
+}
+
+void OpStats::recordRetry() {
+	m_shards[statsShard()].retries.fetch_add(1, std::memory_order_relaxed);
+}
+
+OpStats::Snapshot OpStats::snapshot() const {
+	Snapshot snap;
+	snap.latency.buckets.resize(LatencyBuckets::count, 0);
+	for (const auto &shard : m_shards) {
+		snap.requests += shard.requests.load(std::memory_order_relaxed);
+		for (unsigned idx = 0; idx < g_num_errors; idx++) {
+			snap.errors[idx] += shard.errors[idx].load(std::memory_order_relaxed);
+		}
+		snap.retries += shard.retries.load(std::memory_order_relaxed);
+		snap.bytes_in += shard.bytes_in.load(std::memory_order_relaxed);
+		snap.bytes_out += shard.bytes_out.load(std::memory_order_relaxed);
+		snap.connections_reused +=
+			shard.connections_reused.load(std::memory_order_relaxed);
+		snap.latency.sum += shard.latency_sum.load(std::memory_order_relaxed);
+		auto hist = shard.latency.load(std::memory_order_acquire);
+		if (!hist) {
+			continue;
+		}
+		for (unsigned idx = 0; idx < LatencyBuckets::count; idx++) {
+			uint64_t count = hist->buckets[idx].load(std::memory_order_relaxed);
+			snap.latency.buckets[idx] += count;
+			snap.latency.count += count;
+		}
+	}
+	return snap;
+}
+
+uint64_t CacheStats::hits() const {
+	uint64_t total = 0;
+	for (const auto &cell : m_cells) {
+		total += cell.hits.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+uint64_t CacheStats::misses() const {
+	uint64_t total = 0;
+	for (const auto &cell : m_cells) {
+		total += cell.misses.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+StatsRegistry::~StatsRegistry() {
+	if (m_writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_writer_mutex);
+			m_writer_stop = true;
+		}
+		m_writer_cv.notify_all();
+		m_writer.join();
+	}
+}
+
+bool StatsRegistry::parseFormat(const std::string &name, Format &format) {
+	if (name == "json") {
+		format = Format::Json;
+	} else if (name == "prometheus") {
+		format = Format::Prometheus;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+ExportStats *StatsRegistry::addExport(const std::string &name) {
+	m_exports.emplace_back(new ExportStats(name));
+	return m_exports.back().get();
+}
+
+CacheStats *StatsRegistry::addCache(const std::string &name) {
+	m_caches.emplace_back(new CacheStats(name));
+	return m_caches.back().get();
+}
+
+int StatsRegistry::xml(char *buff, int blen) const {
+	std::string result;
+	formatstr(result, "<stats id=\"%s\">", m_plugin.c_str());
+	std::string entry;
+	for (const auto &exp : m_exports) {
+		result += "<export name=\"" + xmlEscape(exp->name()) + "\">";
+		for (unsigned op = 0; op < g_num_ops; op++) {
+			auto snap = exp->op(static_cast<StatsOp>(op)).snapshot();
+			formatstr(entry,
+					  "<op id=\"%s\"><req>%llu</req><retry>%llu</retry>"
+					  "<in>%llu</in><out>%llu</out><reuse>%llu</reuse>",
+					  statsOpName(static_cast<StatsOp>(op)),
+					  (unsigned long long)snap.requests,
+					  (unsigned long long)snap.retries,
+					  (unsigned long long)snap.bytes_in,
+					  (unsigned long long)snap.bytes_out,
+					  (unsigned long long)snap.connections_reused);
+			result += entry;
+			result += "<err>";
+			for (unsigned err = 0; err < g_num_errors; err++) {
+				formatstr(entry, "<%s>%llu</%s>",
+						  statsErrorName(static_cast<StatsError>(err)),
+						  (unsigned long long)snap.errors[err],
+						  statsErrorName(static_cast<StatsError>(err)));
+				result += entry;
+			}
+			result += "</err><lat>";
+			for (const auto &quantile : g_quantiles) {
+				formatstr(entry, "<%s>%llu</%s>", quantile.name,
+						  (unsigned long long)snap.latency.quantile(quantile.q),
+						  quantile.name);
+				result += entry;
+			}
+			result += "</lat></op>";
+		}
+		result += "</export>";
+	}
+	for (const auto &cache : m_caches) {
+		formatstr(entry,
+				  "<cache name=\"%s\"><hits>%llu</hits><misses>%llu</misses>"
+				  "</cache>",
+				  xmlEscape(cache->name()).c_str(),
+				  (unsigned long long)cache->hits(),
+				  (unsigned long long)cache->misses());
+		result += entry;
+	}
+	result += "</stats>";
+
+	if (!buff) {
+		// Leave room for the counters to grow until the next call.
+		return result.size() * 2 + 1024;
+	}
+	if (blen <= 0 || result.size() >= static_cast<size_t>(blen)) {
+		return 0;
+	}
+	memcpy(buff, result.c_str(), result.size() + 1);
+	return result.size();
+}
+
+std::string StatsRegistry::json() const {
+	std::string result = "{\"plugin\":\"" + jsonEscape(m_plugin) +
+						 "\",\"exports\":[";
+	std::string entry;
+	for (size_t idx = 0; idx < m_exports.size(); idx++) {
+		const auto &exp = m_exports[idx];
+		result += idx ? "," : "";
+		result += "{\"name\":\"" + jsonEscape(exp->name()) + "\",\"ops\":{";
+		for (unsigned op = 0; op < g_num_ops; op++) {
+			auto snap = exp->op(static_cast<StatsOp>(op)).snapshot();
+			formatstr(entry,
+					  "%s\"%s\":{\"requests\":%llu,\"retries\":%llu,"
+					  "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+					  "\"connections_reused\":%llu,\"errors\":{",
+					  op ? "," : "", statsOpName(static_cast<StatsOp>(op)),
+					  (unsigned long long)snap.requests,
+					  (unsigned long long)snap.retries,
+					  (unsigned long long)snap.bytes_in,
+					  (unsigned long long)snap.bytes_out,
+					  (unsigned long long)snap.connections_reused);
+			result += entry;
+			for (unsigned err = 0; err < g_num_errors; err++) {
+				formatstr(entry, "%s\"%s\":%llu", err ? "," : "",
+						  statsErrorName(static_cast<StatsError>(err)),
+						  (unsigned long long)snap.errors[err]);
+				result += entry;
+			}
+			formatstr(entry, "},\"latency_us\":{\"count\":%llu,\"sum\":%llu",
+					  (unsigned long long)snap.latency.count,
+					  (unsigned long long)snap.latency.sum);
+			result += entry;
+			for (const auto &quantile : g_quantiles) {
+				formatstr(entry, ",\"%s\":%llu", quantile.name,
+						  (unsigned long long)snap.latency.quantile(quantile.q));
+				result += entry;
+			}
+			result += "}}";
+		}
+		result += "}}";
+	}
+	result += "],\"caches\":[";
+	for (size_t idx = 0; idx < m_caches.size(); idx++) {
+		const auto &cache = m_caches[idx];
+		uint64_t hits = cache->hits();
+		uint64_t misses = cache->misses();
+		formatstr(entry,
+				  "%s{\"name\":\"%s\",\"hits\":%llu,\"misses\":%llu,"
+				  "\"hit_ratio\":%.4f}",
+				  idx ? "," : "", jsonEscape(cache->name()).c_str(),
+				  (unsigned long long)hits, (unsigned long long)misses,
+				  hits + misses ? double(hits) / (hits + misses) : 0.0);
+		result += entry;
+	}
+	result += "]}\n";
+	return result;
+}
+
+std::string StatsRegistry::prometheus() const {
+	std::string prefix = "xrootd_" + m_plugin + "_";
+	std::vector<std::pair<std::string, OpStats::Snapshot>> snaps;
+	for (const auto &exp : m_exports) {
+		for (unsigned op = 0; op < g_num_ops; op++) {
+			std::string labels = "export=\"" + promEscape(exp->name()) +
+								 "\",op=\"" +
+								 statsOpName(static_cast<StatsOp>(op)) + "\"";
+			snaps.emplace_back(labels,
+							   exp->op(static_cast<StatsOp>(op)).snapshot());
+		}
+	}
+
+	std::string result;
+	std::string line;
+	auto counter = [&](const char *name, const char *help,
+					   uint64_t OpStats::Snapshot::*field) {
+		result += "# HELP " + prefix + name + " " + help + "\n";
+		result += "# TYPE " + prefix + name + " counter\n";
+		for (const auto &entry : snaps) {
+			formatstr(line, "%s%s{%s} %llu\n", prefix.c_str(), name,
+					  entry.first.c_str(),
+					  (unsigned long long)(entry.second.*field));
+			result += line;
+		}
+	};
+	counter("requests_total", "Backend requests completed.",
+			&OpStats::Snapshot::requests);
+	counter("retries_total", "Backend request attempts that were retried.",
+			&OpStats::Snapshot::retries);
+	counter("received_bytes_total", "Bytes received from the backend.",
+			&OpStats::Snapshot::bytes_in);
+	counter("sent_bytes_total", "Bytes sent to the backend.",
+			&OpStats::Snapshot::bytes_out);
+	counter("connections_reused_total",
+			"Backend request attempts that reused an open connection.",
+			&OpStats::Snapshot::connections_reused);
+
+	result += "# HELP " + prefix + "errors_total Failed backend requests.\n";
+	result += "# TYPE " + prefix + "errors_total counter\n";
+	for (const auto &entry : snaps) {
+		for (unsigned err = 0; err < g_num_errors; err++) {
+			formatstr(line, "%serrors_total{%s,class=\"%s\"} %llu\n",
+					  prefix.c_str(), entry.first.c_str(),
+					  statsErrorName(static_cast<StatsError>(err)),
+					  (unsigned long long)entry.second.errors[err]);
+			result += line;
+		}
+	}
+
+	// Prometheus wants cumulative buckets; emit one per power of two, up to
+	// the largest value seen, rather than all of the sub-buckets.
+	std::string name = prefix + "request_duration_seconds";
+	result += "# HELP " + name + " Backend request latency.\n";
+	result += "# TYPE " + name + " histogram\n";
+	const unsigned step = 1 << LatencyBuckets::sub_bucket_bits;
+	for (const auto &entry : snaps) {
+		const auto &latency = entry.second.latency;
+		unsigned last = 0;
+		for (unsigned idx = 0; idx < latency.buckets.size(); idx++) {
+			if (latency.buckets[idx]) {
+				last = idx;
+			}
+		}
+		uint64_t cumulative = 0;
+		for (unsigned idx = 0; idx < latency.buckets.size(); idx++) {
+			cumulative += latency.buckets[idx];
+			if ((idx + 1) % step == 0 && idx <= last + step) {
+				formatstr(line, "%s_bucket{%s,le=\"%g\"} %llu\n", name.c_str(),
+						  entry.first.c_str(),
+						  (LatencyBuckets::upperBound(idx) + 1) / 1e6,
+						  (unsigned long long)cumulative);
+				result += line;
+			}
+		}
+		formatstr(line,
+				  "%s_bucket{%s,le=\"+Inf\"} %llu\n%s_sum{%s} %g\n"
+				  "%s_count{%s} %llu\n",
+				  name.c_str(), entry.first.c_str(),
+				  (unsigned long long)latency.count, name.c_str(),
+				  entry.first.c_str(), latency.sum / 1e6, name.c_str(),
+				  entry.first.c_str(), (unsigned long long)latency.count);
+		result += line;
+	}
+
+	if (!m_caches.empty()) {
+		for (const char *kind : {"hits", "misses"}) {
+			result += "# HELP " + prefix + "cache_" + kind + "_total Cache " +
+					  kind + ".\n";
+			result += "# TYPE " + prefix + "cache_" + kind + "_total counter\n";
+			for (const auto &cache : m_caches) {
+				formatstr(line, "%scache_%s_total{cache=\"%s\"} %llu\n",
+						  prefix.c_str(), kind,
+						  promEscape(cache->name()).c_str(),
+						  (unsigned long long)(strcmp(kind, "hits")
+												   ? cache->misses()
+												   : cache->hits()));
+				result += line;
+			}
+		}
+	}
+	return result;
+}
+
+bool StatsRegistry::writeFile() const {
+	std::string contents =
+		m_format == Format::Prometheus ? prometheus() : json();
+	std::string tmpName = m_file + ".tmp";
+	FILE *fp = fopen(tmpName.c_str(), "w");
+	if (!fp) {
+		m_log.Log(LogMask::Warning, "Stats", "Failed to open statistics file",
+				  tmpName.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok = fwrite(contents.data(), 1, contents.size(), fp) ==
+			  contents.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmpName.c_str(), m_file.c_str()) != 0) {
+		m_log.Log(LogMask::Warning, "Stats", "Failed to write statistics file",
+				  m_file.c_str(), strerror(errno));
+		unlink(tmpName.c_str());
+		return false;
+	}
+	return true;
+}
+
+void StatsRegistry::startWriter() {
+	if (m_file.empty() || m_writer.joinable()) {
+		return;
+	}
+	m_writer = std::thread([this] {
+		std::unique_lock<std::mutex> lock(m_writer_mutex);
+		while (!m_writer_stop) {
+			m_writer_cv.wait_for(lock, m_interval);
+			writeFile();
+		}
+	});
+}
@@ -0,0 +1,234 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include "probes.hh"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class XrdSysError;
+
+// Every statistic is split into this many shards.  A thread always updates
+// the same shard, so concurrent updates almost never share a cache line and
+// never take a lock; readers add the shards together.
+const unsigned g_stats_shards = 8;
+
+// Returns the shard the calling thread updates.
+unsigned statsShard();
+
+// The operation classes tracked separately for each export.  Multipart
+// upload bookkeeping requests count as PUT.
+enum class StatsOp { Head = 0, Get, Put, List, Count };
+const char *statsOpName(StatsOp op);
+
+// Why a backend request failed: the transfer itself failed (DNS, connect,
+// reset, timeout); the backend rejected the request (4xx or any other
+// unexpected response); the backend failed (5xx); or the backend asked us to
+// slow down (429, 503).
+enum class StatsError { Network = 0, Client, Server, Throttled, Count };
+const char *statsErrorName(StatsError err);
+
+// Bucket layout of a log-linear ("HDR-style") latency histogram.  Values are
+// in microseconds.  Below 8us every value has its own bucket; above that,
+// each power of two is split into 8 equal sub-buckets, so a value is never
+// more than 12.5% away from its bucket bounds.  Values of 2^40us (about 12
+// days) and up land in the last bucket.
+struct LatencyBuckets {
+	static const unsigned sub_bucket_bits = 3;
+	static const unsigned max_exponent = 40;
+	static const unsigned count = (max_exponent - sub_bucket_bits + 2)
+								  << sub_bucket_bits;
+
+	static unsigned index(uint64_t usec);
+	static uint64_t lowerBound(unsigned idx);
+	static uint64_t upperBound(unsigned idx);
+};
+
+struct LatencySnapshot {
+	uint64_t count{0};
+	uint64_t sum{0};
+	std::vector<uint64_t> buckets;
+
+	// The upper bound of the bucket holding the q-th quantile (0 <= q <= 1),
+	// or 0 if nothing has been recorded.
+	uint64_t quantile(double q) const;
+};
+
+// Counters and latency histogram for one operation class of one export.
+//
+// A configuration may define thousands of exports, most of which see little
+// traffic, so each shard's histogram is only allocated when the shard records
+// its first request.
+class OpStats {
+  public:
+	OpStats() = default;
+	OpStats(const OpStats &) = delete;
+	OpStats &operator=(const OpStats &) = delete;
+	~OpStats();
+
+	struct Snapshot {
+		uint64_t requests{0};
+		uint64_t errors[static_cast<unsigned>(StatsError::Count)]{};
+		uint64_t retries{0};
+		uint64_t bytes_in{0};
+		uint64_t bytes_out{0};
+		uint64_t connections_reused{0};
+		LatencySnapshot latency;
+	};
+
+	// Record a finished request, successful or not, including all of its
+	// retries.  `reused` counts the attempts that did not open a new
+	// connection.
+	void recordRequest(int64_t usec, uint64_t bytesIn, uint64_t bytesOut,
+					   uint64_t reused);
+	void recordError(StatsError err);
+	void recordRetry();
+
+	Snapshot snapshot() const;
+
+  private:
+	struct Histogram {
+		std::atomic<uint64_t> buckets[LatencyBuckets::count]{};
+	};
+
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> requests{0};
+		std::atomic<uint64_t> errors[static_cast<unsigned>(StatsError::Count)]{};
+		std::atomic<uint64_t> retries{0};
+		std::atomic<uint64_t> bytes_in{0};
+		std::atomic<uint64_t> bytes_out{0};
+		std::atomic<uint64_t> connections_reused{0};
+		std::atomic<uint64_t> latency_sum{0};
+		std::atomic<Histogram *> latency{nullptr};
+	};
+
+	static Histogram &histogram(Shard &shard);
+
+	Shard m_shards[g_stats_shards];
+};
+
+// The statistics for all operations against one export.
+class ExportStats {
+  public:
+	ExportStats(const std::string &name) : m_name(name) {}
+
+	const std::string &name() const { return m_name; }
+	OpStats &op(StatsOp op) { return m_ops[static_cast<unsigned>(op)]; }
+	const OpStats &op(StatsOp op) const {
+		return m_ops[static_cast<unsigned>(op)];
+	}
+
+  private:
+	std::string m_name;
+	OpStats m_ops[static_cast<unsigned>(StatsOp::Count)];
+};
+
+// Hit and miss counts for one of the plugin's caches.
+class CacheStats {
+  public:
+	CacheStats(const std::string &name) : m_name(name) {}
+
+	const std::string &name() const { return m_name; }
+	void hit() {
+		XRDHTTP_PROBE1(cache__hit, m_name.c_str());
+		m_cells[statsShard()].hits.fetch_add(1, std::memory_order_relaxed);
+	}
+	void miss() {
+		XRDHTTP_PROBE1(cache__miss, m_name.c_str());
+		m_cells[statsShard()].misses.fetch_add(1, std::memory_order_relaxed);
+	}
+	uint64_t hits() const;
+	uint64_t misses() const;
+
+  private:
+	struct alignas(64) Cell {
+		std::atomic<uint64_t> hits{0};
+		std::atomic<uint64_t> misses{0};
+	};
+
+	std::string m_name;
+	Cell m_cells[g_stats_shards];
+};
+
+// All the statistics of one plugin instance.  Exports and caches are
+// registered while the configuration is parsed; afterwards the registry
+// only changes through the lock-free counters, and can be rendered as the
+// XML fragment XRootD's summary monitoring expects from XrdOss::Stats(),
+// as JSON or as Prometheus text.  Optionally, a background thread writes
+// one of the latter to a file at a fixed interval.
+class StatsRegistry {
+  public:
+	enum class Format { Json, Prometheus };
+
+	// `plugin` names the plugin in the rendered output ("s3", "httpserver").
+	StatsRegistry(const std::string &plugin, XrdSysError &log)
+		: m_plugin(plugin), m_log(log) {}
+	~StatsRegistry();
+
+	// Parse the format argument of a stats_file directive.
+	static bool parseFormat(const std::string &name, Format &format);
+
+	ExportStats *addExport(const std::string &name);
+	CacheStats *addCache(const std::string &name);
+
+	// Implements XrdOss::Stats(): with a null buffer, returns an upper bound
+	// on the space needed; otherwise fills the buffer and returns the length
+	// written, or 0 if it does not fit.
+	int xml(char *buff, int blen) const;
+	std::string json() const;
+	std::string prometheus() const;
+
+	// Configure the periodic statistics file; call startWriter() once the
+	// configuration is complete.
+	void setFile(const std::string &path, Format format) {
+		m_file = path;
+		m_format = format;
+	}
+	void setInterval(std::chrono::milliseconds interval) {
+		m_interval = interval;
+	}
+	void startWriter();
+
+	// Atomically replace the statistics file with the current statistics.
+	bool writeFile() const;
+
+  private:
+	std::string m_plugin;
+	XrdSysError &m_log;
+
+	std::vector<std::unique_ptr<ExportStats>> m_exports;
+	std::vector<std::unique_ptr<CacheStats>> m_caches;
+
+	std::string m_file;
+	Format m_format{Format::Json};
+	std::chrono::milliseconds m_interval{60000};
+
+	std::thread m_writer;
+	std::mutex m_writer_mutex;
+	std::condition_variable m_writer_cv;
+	bool m_writer_stop{false};
+};
@@ -0,0 +1,170 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#include "TransportOptions.hh"
+#include "stl_string_utils.hh"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const char *const g_options[] = {
+	"unix_socket",			 "http2",
+	"http2_max_streams",	 "tcp_nodelay",
+	"tcp_keepalive",		 "tcp_congestion",
+	"socket_receive_buffer", "socket_send_buffer",
+	"download_buffer_size",	 "upload_buffer_size",
+	"expect_100_continue",	 "slow_request_threshold",
+};
+
+bool parseSwitch(std::string value, bool &result, std::string &err) {
+	toLower(value);
+	if (value != "on" && value != "off") {
+		err = "must be 'on' or 'off'";
+		return false;
+	}
+	result = value == "on";
+	return true;
+}
+
+bool parseBufferSize(const std::string &value, size_t &result,
+					 std::string &err) {
+	if (!parseSize(value, result) || result > INT_MAX) {
+		err = "must be a size of at most 2G";
+		return false;
+	}
+	return true;
+}
+
+// Check that sockets can use congestion control algorithm `name`, so that
+// a typo or a missing kernel module shows up in the configuration rather
+// than silently on every connection.
+bool checkCongestion(const std::string &name, std::string &err) {
+#ifdef TCP_CONGESTION
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		err = std::string("cannot create a socket to check it: ") +
+			  strerror(errno);
+		return false;
+	}
+	int rv = setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name.c_str(),
+						name.size());
+	int saved = errno;
+	close(fd);
+	if (rv != 0) {
+		err = std::string("not available: ") + strerror(saved);
+		return false;
+	}
+	return true;
+#else
+	(void)name;
+	err = "not supported on this platform";
+	return false;
+#endif
+}
+
+} // namespace
+
+bool TransportOptions::IsOption(const std::string &name) {
+	for (const char *option : g_options) {
+		if (name == option) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TransportOptions::Set(const std::string &name, const std::string &value,
+						   std::string &err) {
+	if (name == "unix_socket") {
+		unix_socket = value;
+	} else if (name == "http2") {
+		return parseSwitch(value, http2, err);
+	} else if (name == "http2_max_streams") {
+		size_t streams;
+		if (!parseSize(value, streams) || streams == 0 || streams > INT_MAX) {
+			err = "must be a positive number of streams";
+			return false;
+		}
+		http2_max_streams = streams;
+	} else if (name == "tcp_nodelay") {
+		return parseSwitch(value, tcp_nodelay, err);
+	} else if (name == "tcp_keepalive") {
+		std::chrono::milliseconds idle;
+		if (value == "off") {
+			tcp_keepalive = std::chrono::seconds(0);
+		} else if (parseDuration(value, idle) &&
+				   idle >= std::chrono::seconds(1) &&
+				   idle <= std::chrono::hours(24)) {
+			tcp_keepalive =
+				std::chrono::duration_cast<std::chrono::seconds>(idle);
+		} else {
+			err = "must be 'off' or a duration between 1s and 24h";
+			return false;
+		}
+	} else if (name == "tcp_congestion") {
+		if (!checkCongestion(value, err)) {
+			return false;
+		}
+		tcp_congestion = value;
+	} else if (name == "socket_receive_buffer") {
+		return parseBufferSize(value, socket_receive_buffer, err);
+	} else if (name == "socket_send_buffer") {
+		return parseBufferSize(value, socket_send_buffer, err);
+	} else if (name == "download_buffer_size") {
+		return parseBufferSize(value, download_buffer_size, err);
+	} else if (name == "upload_buffer_size") {
+		return parseBufferSize(value, upload_buffer_size, err);
+	} else if (name == "expect_100_continue") {
+		return parseSwitch(value, expect_100_continue, err);
+	} else if (name == "slow_request_threshold") {
+		if (!parseDuration(value, slow_request_threshold)) {
+			err = "must be a duration";
+			return false;
+		}
+	} else {
+		err = "unknown transport option";
+		return false;
+	}
+	return true;
+}
+
+void TransportOptions::ApplySocketOptions(int fd) const {
+	// TCP options fail harmlessly on a Unix domain socket.
+	if (socket_receive_buffer) {
+		int size = socket_receive_buffer;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	if (socket_send_buffer) {
+		int size = socket_send_buffer;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	}
+#ifdef TCP_CONGESTION
+	if (!tcp_congestion.empty()) {
+		setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, tcp_congestion.c_str(),
+				   tcp_congestion.size());
+	}
+#endif
+}
@@ -0,0 +1,78 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// How the requests of one export reach its backend.  The defaults leave
+// everything to curl.
+struct TransportOptions {
+	// Connect over this Unix domain socket, e.g. to a gateway on the same
+	// host, instead of TCP.  The URL, and with it the Host header and any
+	// signature, is unchanged, but an https URL is sent without TLS.
+	std::string unix_socket;
+
+	// Offer HTTP/2 during the TLS handshake and run the requests on shared
+	// connections, up to `http2_max_streams` concurrent requests on each.
+	// Servers that only speak HTTP/1.1, and plain http URLs, get HTTP/1.1
+	// over the shared connections.
+	bool http2{false};
+	long http2_max_streams{100};
+
+	// Socket tuning.  A zero buffer size keeps the kernel's default; note
+	// that setting one also turns off the kernel's autotuning of it.
+	bool tcp_nodelay{true};
+	std::chrono::seconds tcp_keepalive{0}; // idle time and probe interval
+	std::string tcp_congestion;			   // e.g. "bbr"; Linux only
+	size_t socket_receive_buffer{0};	   // SO_RCVBUF
+	size_t socket_send_buffer{0};		   // SO_SNDBUF
+
+	// Sizes of curl's download and upload buffers; zero keeps curl's.
+	size_t download_buffer_size{0};
+	size_t upload_buffer_size{0};
+
+	// Whether uploads wait for a "100 Continue" before sending the body.
+	bool expect_100_continue{true};
+
+	// Log the timing breakdown of requests that take at least this long;
+	// zero turns the log off.
+	std::chrono::milliseconds slow_request_threshold{0};
+
+	// Whether `name` is an option set by a configuration directive: the
+	// directive without its "s3." or "httpserver." prefix, as in
+	// "tcp_nodelay".
+	static bool IsOption(const std::string &name);
+
+	// Set option `name` from the directive's value.  Returns false, with
+	// `err` saying why, if the value is invalid.
+	bool Set(const std::string &name, const std::string &value,
+			 std::string &err);
+
+	// Whether any option must be applied to the sockets themselves.
+	bool tunesSockets() const {
+		return socket_receive_buffer || socket_send_buffer ||
+			   !tcp_congestion.empty();
+	}
+
+	// Apply the socket options to `fd`, a socket curl has just created.
+	// Failures are ignored: each option is only a hint.
+	void ApplySocketOptions(int fd) const;
+};
@@ -51,14 +51,16 @@ std::string XrdHTTPServer::LogMaskToString(int mask) {
 	return ss.str();
 }
 
-bool XrdHTTPServer::ConfigLog(XrdOucStream &conf, XrdSysError &log) {
+bool XrdHTTPServer::ConfigLog(XrdOucStream &conf, XrdSysError &log,
+							   const char *directive) {
 	std::string map_filename;
 	log.setMsgMask(0);
 	char *val = nullptr;
 	if (!(val = conf.GetToken())) {
-		log.Emsg("Config",
-				 "httpserver.trace requires an argument.  Usage: "
-				 "httpserver.trace [all|error|warning|info|debug|none]");
+		std::string usage = std::string(directive) +
+							" requires an argument.  Usage: " + directive +
+							" [all|error|warning|info|debug|none]";
+		log.Emsg("Config", usage.c_str());
 		return false;
 	}
 	do {
@@ -75,8 +77,8 @@ bool XrdHTTPServer::ConfigLog(XrdOucStream &conf, XrdSysError &log) {
 		} else if (!strcmp(val, "none")) {
 			log.setMsgMask(0);
 		} else {
-			log.Emsg("Config",
-					 "scitokens.trace encountered an unknown directive:", val);
+			log.Emsg("Config", directive,
+					 "encountered an unknown directive:", val);
 			return false;
 		}
 	} while ((val = conf.GetToken()));
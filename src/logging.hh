@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <sstream>
 #include <string>
 
 class XrdOucStream;
@@ -37,8 +38,32 @@ enum LogMask {
 // logging levels.
 std::string LogMaskToString(int mask);
 
-// Given an xrootd configuration object that matched on httpserver.trace, parse
-// the remainder of the line and configure the logger appropriately.
-bool ConfigLog(XrdOucStream &conf, XrdSysError &log);
+// Given an xrootd configuration object that matched on a trace directive
+// (httpserver.trace, s3.trace), parse the remainder of the line and configure
+// the logger appropriately.
+bool ConfigLog(XrdOucStream &conf, XrdSysError &log,
+			   const char *directive = "httpserver.trace");
 
 } // namespace XrdHTTPServer
+
+// Log through `log` (an XrdSysError) only if `mask` is enabled.  Unlike
+// calling XrdSysError::Log() directly, the message arguments are not evaluated
+// at all when the level is disabled, so the cost is a single branch.
+#define XRDHTTP_LOG(log, mask, ...)                                            \
+	do {                                                                       \
+		if ((log).getMsgMask() & (mask)) {                                     \
+			(log).Log((mask), __VA_ARGS__);                                    \
+		}                                                                      \
+	} while (0)
+
+// As XRDHTTP_LOG, but the message is built by streaming `expr` into a
+// std::stringstream, e.g.
+//   XRDHTTP_LOG_STREAM(m_log, LogMask::Warning, "Read", "code " << code);
+#define XRDHTTP_LOG_STREAM(log, mask, context, expr)                          \
+	do {                                                                       \
+		if ((log).getMsgMask() & (mask)) {                                     \
+			std::stringstream xrdhttp_log_ss_;                                 \
+			xrdhttp_log_ss_ << expr;                                           \
+			(log).Log((mask), (context), xrdhttp_log_ss_.str().c_str());       \
+		}                                                                      \
+	} while (0)
@@ -0,0 +1,91 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// USDT (user-level statically defined tracing) probes for bpftrace, perf and
+// SystemTap.  An unattached probe compiles down to a single nop; when
+// sys/sdt.h is not available at build time the probes vanish entirely and
+// their arguments are never evaluated.
+//
+// All probes belong to the `xrootd_s3_http` provider; for example
+//
+//   bpftrace -e 'usdt:libXrdS3-5.so:xrootd_s3_http:request__end
+//                { @us = hist(arg4); }'
+//
+// Probe names and argument orders are a stable interface:
+//
+//   request__start(req, verb, url)
+//   request__end(req, verb, url, status, latency_us, bytes_in, bytes_out)
+//   request__retry(req, url, status)
+//   request__sign(req, latency_us)
+//   cache__hit(cache), cache__miss(cache)
+//   chunk__issue(object, offset, length, source_url)
+//   file__open(path, oflag, rc)
+//   file__read(object, offset, length, latency_us, rc)
+//   file__write(object, offset, length, latency_us, rc)
+//   file__close(object)
+//
+// `req` is an opaque request identifier that pairs up the events of one
+// backend request; strings are NUL-terminated; URLs are given without their
+// query string, which may hold a pre-signed URL's credentials; `status` is
+// the HTTP response code, or 0 if no response was received; `rc` is the
+// value the XrdOssDF call returns.
+
+// Microseconds elapsed since `start`, for latency arguments.
+inline int64_t probeMicrosSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   std::chrono::steady_clock::now() - start)
+		.count();
+}
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define XRDHTTP_PROBE1(name, a) DTRACE_PROBE1(xrootd_s3_http, name, a)
+#define XRDHTTP_PROBE2(name, a, b) DTRACE_PROBE2(xrootd_s3_http, name, a, b)
+#define XRDHTTP_PROBE3(name, a, b, c)                                          \
+	DTRACE_PROBE3(xrootd_s3_http, name, a, b, c)
+#define XRDHTTP_PROBE4(name, a, b, c, d)                                       \
+	DTRACE_PROBE4(xrootd_s3_http, name, a, b, c, d)
+#define XRDHTTP_PROBE5(name, a, b, c, d, e)                                    \
+	DTRACE_PROBE5(xrootd_s3_http, name, a, b, c, d, e)
+#define XRDHTTP_PROBE7(name, a, b, c, d, e, f, g)                              \
+	DTRACE_PROBE7(xrootd_s3_http, name, a, b, c, d, e, f, g)
+#else
+// Keep the arguments type-checked and "used", but never evaluate them.
+#define XRDHTTP_PROBE_ARGS_(...)                                               \
+	do {                                                                       \
+		if (false) {                                                           \
+			xrdhttp_probe_unused_(__VA_ARGS__);                                \
+		}                                                                      \
+	} while (0)
+template <typename... Args>
+inline void xrdhttp_probe_unused_(const Args &...) {}
+
+#define XRDHTTP_PROBE1(name, a) XRDHTTP_PROBE_ARGS_(a)
+#define XRDHTTP_PROBE2(name, a, b) XRDHTTP_PROBE_ARGS_(a, b)
+#define XRDHTTP_PROBE3(name, a, b, c) XRDHTTP_PROBE_ARGS_(a, b, c)
+#define XRDHTTP_PROBE4(name, a, b, c, d) XRDHTTP_PROBE_ARGS_(a, b, c, d)
+#define XRDHTTP_PROBE5(name, a, b, c, d, e) XRDHTTP_PROBE_ARGS_(a, b, c, d, e)
+#define XRDHTTP_PROBE7(name, a, b, c, d, e, f, g)                              \
+	XRDHTTP_PROBE_ARGS_(a, b, c, d, e, f, g)
+#endif
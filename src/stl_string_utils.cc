@@ -20,6 +20,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdlib>
 #include <string>
 
 #include <stdarg.h>
@@ -55,6 +57,79 @@ void toLower(std::string &str) {
 	std::transform(str.begin(), str.end(), str.begin(), ::tolower);
 }
 
+bool parseSize(const std::string &str, size_t &result) {
+	if (str.empty() || !isdigit(str[0])) {
+		return false;
+	}
+	char *end = nullptr;
+	errno = 0;
+	unsigned long long value = strtoull(str.c_str(), &end, 10);
+	if (errno == ERANGE) {
+		return false;
+	}
+
+	unsigned shift = 0;
+	switch (*end) {
+	case '\0':
+		break;
+	case 'k':
+	case 'K':
+		shift = 10;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		break;
+	default:
+		return false;
+	}
+	if (shift && *(end + 1) != '\0') {
+		return false;
+	}
+	if (value > (~0ULL >> shift)) {
+		return false;
+	}
+	result = static_cast<size_t>(value << shift);
+	return true;
+}
+
+bool parseDuration(const std::string &str, std::chrono::milliseconds &result) {
+	if (str.empty() || !isdigit(str[0])) {
+		return false;
+	}
+	char *end = nullptr;
+	errno = 0;
+	unsigned long long value = strtoull(str.c_str(), &end, 10);
+	if (errno == ERANGE) {
+		return false;
+	}
+
+	std::string unit(end);
+	unsigned long long scale;
+	if (unit == "ms") {
+		scale = 1;
+	} else if (unit.empty() || unit == "s") {
+		scale = 1000;
+	} else if (unit == "m") {
+		scale = 60 * 1000;
+	} else if (unit == "h") {
+		scale = 60 * 60 * 1000;
+	} else {
+		return false;
+	}
+	if (value > static_cast<unsigned long long>(
+					std::chrono::milliseconds::max().count()) /
+					scale) {
+		return false;
+	}
+	result = std::chrono::milliseconds(value * scale);
+	return true;
+}
+
 int vformatstr_impl(std::string &s, bool concat, const char *format,
 					va_list pargs) {
 	char fixbuf[512];
@@ -93,7 +168,7 @@ int vformatstr_impl(std::string &s, bool concat, const char *format,
 	}
 	// if (NULL == varbuf) { EXCEPT("Failed to allocate char buffer of %d
 	// chars", n); }
-	assert(NULL == varbuf);
+	assert(NULL != varbuf);
 
 	// re-print, using buffer of sufficient size
 #if !defined(va_copy)
@@ -107,7 +182,7 @@ int vformatstr_impl(std::string &s, bool concat, const char *format,
 	// Sanity check.  This ought not to happen.  Ever.
 	// if (nn >= n) EXCEPT("Insufficient buffer size (%d) for printing %d
 	// chars", n, nn);
-	assert(nn >= n);
+	assert(nn < n);
 
 	// safe to do string assignment
 	if (concat) {
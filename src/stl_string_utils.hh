@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <string>
 
 #ifndef CHECK_PRINTF_FORMAT
@@ -33,6 +34,16 @@ std::string substring(const std::string &str, size_t left,
 					  size_t right = std::string::npos);
 void toLower(std::string &str);
 
+// Parse a non-negative integer with an optional, case-insensitive K/M/G
+// suffix (powers of 1024) as used by size-valued configuration directives.
+// Returns false if the string is not a valid size.
+bool parseSize(const std::string &str, size_t &result);
+
+// Parse a non-negative duration with an optional unit suffix of "ms", "s",
+// "m" or "h"; a bare number is in seconds.  Returns false if the string is
+// not a valid duration.
+bool parseDuration(const std::string &str, std::chrono::milliseconds &result);
+
 int formatstr(std::string &s, const char *format, ...)
 	CHECK_PRINTF_FORMAT(2, 3);
 int formatstr_cat(std::string &s, const char *format, ...)
@@ -16,12 +16,32 @@
  *
  ***************************************************************/
 
+#include "../bench/MockServer.hh"
+#include "../src/AccessLog.hh"
+#include "../src/EndpointIPManager.hh"
 #include "../src/HTTPCommands.hh"
+#include "../src/HTTPFile.hh"
+#include "../src/HTTPFileSystem.hh"
+#include "../src/MultiSourceDownload.hh"
+#include "../src/PathTrie.hh"
+#include "../src/Stats.hh"
+#include "../src/logging.hh"
+#include "../src/stl_string_utils.hh"
 
 #include <XrdSys/XrdSysError.hh>
 #include <XrdSys/XrdSysLogger.hh>
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
 class TestHTTPRequest : public HTTPRequest {
   public:
 	XrdSysLogger log{};
@@ -44,6 +64,432 @@ TEST(TestHTTPParseProtocol, Test1) {
 	ASSERT_EQ(protocol, "http");
 }
 
+TEST(TestPathTrie, LongestPrefix) {
+	PathTrie<int> trie;
+	ASSERT_TRUE(trie.Insert("/foo", 1));
+	ASSERT_TRUE(trie.Insert("foo/bar/", 2));
+	ASSERT_TRUE(trie.Insert("/foobar", 3));
+	ASSERT_FALSE(trie.Insert("/foo/", 4));
+	trie.Compile();
+
+	int value = 0;
+	std::string_view rest;
+	ASSERT_TRUE(trie.Lookup("/foo/baz", value, rest));
+	ASSERT_EQ(value, 1);
+	ASSERT_EQ(rest, "baz");
+
+	ASSERT_TRUE(trie.Lookup("/foo/bar/baz/qux", value, rest));
+	ASSERT_EQ(value, 2);
+	ASSERT_EQ(rest, "baz/qux");
+
+	ASSERT_TRUE(trie.Lookup("/foobar//obj", value, rest));
+	ASSERT_EQ(value, 3);
+	ASSERT_EQ(rest, "obj");
+
+	// Prefixes only match on component boundaries.
+	ASSERT_TRUE(trie.Lookup("/foo/barn", value, rest));
+	ASSERT_EQ(value, 1);
+	ASSERT_EQ(rest, "barn");
+	ASSERT_FALSE(trie.Lookup("/foob", value, rest));
+	ASSERT_FALSE(trie.Lookup("/baz/foo", value, rest));
+
+	PathTrie<int> rootTrie;
+	ASSERT_TRUE(rootTrie.Insert("/", 7));
+	rootTrie.Compile();
+	ASSERT_TRUE(rootTrie.Lookup("/any/thing", value, rest));
+	ASSERT_EQ(value, 7);
+	ASSERT_EQ(rest, "any/thing");
+}
+
+TEST(TestHTTPParsePath, MultipleExports) {
+	char configFile[] = "/tmp/http-gtest-XXXXXX";
+	int fd = mkstemp(configFile);
+	ASSERT_NE(fd, -1);
+	close(fd);
+	{
+		std::ofstream config(configFile);
+		config << "httpserver.begin\n"
+			   << "httpserver.url_base https://origin-a.example.com\n"
+			   << "httpserver.storage_prefix /a\n"
+			   << "httpserver.end\n"
+			   << "httpserver.begin\n"
+			   << "httpserver.url_base https://origin-b.example.com/data\n"
+			   << "httpserver.storage_prefix /a/b\n"
+			   << "httpserver.end\n"
+			   << "httpserver.begin\n"
+			   << "httpserver.host_name storage.com\n"
+			   << "httpserver.host_url https://storage.com\n"
+			   << "httpserver.end\n";
+	}
+
+	XrdSysLogger log;
+	HTTPFileSystem fs(&log, configFile, nullptr);
+	unlink(configFile);
+
+	const HTTPExport *exp = nullptr;
+	std::string object;
+	ASSERT_EQ(parse_path(fs, "/a/obj", exp, object), 0);
+	ASSERT_EQ(exp->getOrigin(), "https://origin-a.example.com");
+	ASSERT_EQ(object, "obj");
+
+	ASSERT_EQ(parse_path(fs, "/a/b/dir/obj", exp, object), 0);
+	ASSERT_EQ(exp->getOrigin(), "https://origin-b.example.com/data");
+	ASSERT_EQ(object, "dir/obj");
+
+	ASSERT_EQ(parse_path(fs, "/storage.com/foo/bar", exp, object), 0);
+	ASSERT_EQ(exp->getOrigin(), "https://storage.com");
+	ASSERT_EQ(object, "foo/bar");
+
+	ASSERT_EQ(parse_path(fs, "/baz/foo", exp, object), -ENOENT);
+}
+
+TEST(TestLogging, SkipsDisabledLevels) {
+	XrdSysLogger log;
+	XrdSysError err(&log, "TestLogging");
+	err.setMsgMask(XrdHTTPServer::LogMask::Error |
+				   XrdHTTPServer::LogMask::Warning);
+
+	int evaluated = 0;
+	auto message = [&] {
+		evaluated++;
+		return "message";
+	};
+	XRDHTTP_LOG(err, XrdHTTPServer::LogMask::Debug, "Test", message());
+	XRDHTTP_LOG_STREAM(err, XrdHTTPServer::LogMask::Info, "Test", message() << 1);
+	ASSERT_EQ(evaluated, 0);
+	XRDHTTP_LOG_STREAM(err, XrdHTTPServer::LogMask::Warning, "Test", message() << 1);
+	ASSERT_EQ(evaluated, 1);
+}
+
+TEST(TestStats, LatencyBuckets) {
+	for (uint64_t usec : {0ull, 1ull, 7ull, 8ull, 9ull, 100ull, 1000ull,
+						  123456ull, 10000000ull}) {
+		unsigned idx = LatencyBuckets::index(usec);
+		ASSERT_LE(LatencyBuckets::lowerBound(idx), usec);
+		ASSERT_GE(LatencyBuckets::upperBound(idx), usec);
+	}
+	ASSERT_EQ(LatencyBuckets::index(~0ull), LatencyBuckets::count - 1);
+	ASSERT_LT(LatencyBuckets::index(100), LatencyBuckets::index(1000));
+}
+
+TEST(TestStats, ShardedCounters) {
+	XrdSysLogger log;
+	XrdSysError err(&log, "TestStats");
+	StatsRegistry registry("httpserver", err);
+	ExportStats *exp = registry.addExport("/foo");
+	CacheStats *cache = registry.addCache("test");
+
+	// 90 fast requests and 10 slow ones per thread.
+	std::vector<std::thread> threads;
+	for (int thread = 0; thread < 4; thread++) {
+		threads.emplace_back([&] {
+			for (int idx = 0; idx < 100; idx++) {
+				exp->op(StatsOp::Get)
+					.recordRequest(idx < 90 ? 1000 : 100000, 10, 1, 0);
+				cache->hit();
+			}
+			exp->op(StatsOp::Get).recordError(StatsError::Throttled);
+			exp->op(StatsOp::Get).recordRetry();
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto snap = exp->op(StatsOp::Get).snapshot();
+	ASSERT_EQ(snap.requests, 400u);
+	ASSERT_EQ(snap.bytes_in, 4000u);
+	ASSERT_EQ(snap.bytes_out, 400u);
+	ASSERT_EQ(snap.retries, 4u);
+	ASSERT_EQ(snap.errors[static_cast<unsigned>(StatsError::Throttled)], 4u);
+	ASSERT_EQ(snap.latency.count, 400u);
+	ASSERT_GE(snap.latency.quantile(0.5), 1000u);
+	ASSERT_LT(snap.latency.quantile(0.5), 1125u);
+	ASSERT_GE(snap.latency.quantile(0.99), 100000u);
+	ASSERT_EQ(cache->hits(), 400u);
+	auto idle = exp->op(StatsOp::Head).snapshot();
+	ASSERT_EQ(idle.requests, 0u);
+	ASSERT_EQ(idle.latency.count, 0u);
+	ASSERT_EQ(idle.latency.quantile(0.5), 0u);
+	// Idle operations must not carry their histograms around.
+	ASSERT_LT(sizeof(OpStats), 2048u);
+
+	std::string json = registry.json();
+	ASSERT_NE(json.find("\"name\":\"/foo\""), std::string::npos);
+	ASSERT_NE(json.find("\"get\":{\"requests\":400"), std::string::npos);
+	std::string prom = registry.prometheus();
+	ASSERT_NE(prom.find("xrootd_httpserver_requests_total{export=\"/foo\","
+						"op=\"get\"} 400"),
+			  std::string::npos);
+	ASSERT_NE(prom.find("xrootd_httpserver_request_duration_seconds_count{"
+						"export=\"/foo\",op=\"get\"} 400"),
+			  std::string::npos);
+
+	int needed = registry.xml(nullptr, 0);
+	std::vector<char> buff(needed);
+	int len = registry.xml(buff.data(), needed);
+	ASSERT_GT(len, 0);
+	ASSERT_EQ(std::string(buff.data(), 19), "<stats id=\"httpserv");
+	ASSERT_EQ(registry.xml(buff.data(), 10), 0);
+}
+
+// An endpoint manager with a fixed set of addresses for every host.
+class TestEndpoints : public EndpointIPManager {
+  public:
+	std::vector<std::string> addresses{"10.0.0.1", "10.0.0.2", "10.0.0.3"};
+	int resolves{0};
+
+  protected:
+	bool Resolve(const std::string &, int,
+				 std::vector<std::string> &result) override {
+		resolves++;
+		result = addresses;
+		return true;
+	}
+};
+
+TEST(TestEndpointIPManager, RoundRobinAndDemotion) {
+	TestEndpoints endpoints;
+	std::string address;
+	ASSERT_FALSE(endpoints.Pick("s3.example.com", 443, address));
+	endpoints.SetRefreshInterval(std::chrono::seconds(3600));
+	// Addresses are used as they are.
+	ASSERT_FALSE(endpoints.Pick("10.1.2.3", 443, address));
+
+	std::map<std::string, int> picks;
+	for (int idx = 0; idx < 6; idx++) {
+		ASSERT_TRUE(endpoints.Pick("s3.example.com", 443, address));
+		picks[address]++;
+	}
+	ASSERT_EQ(endpoints.resolves, 1);
+	ASSERT_EQ(picks.size(), 3u);
+	for (const auto &entry : picks) {
+		ASSERT_EQ(entry.second, 2);
+	}
+
+	// Repeated failures take an address out of the rotation.
+	for (int idx = 0; idx < 4; idx++) {
+		endpoints.Report("s3.example.com", 443, "10.0.0.2", true,
+						 std::chrono::microseconds(0));
+	}
+	for (int idx = 0; idx < 6; idx++) {
+		ASSERT_TRUE(endpoints.Pick("s3.example.com", 443, address));
+		ASSERT_NE(address, "10.0.0.2");
+	}
+
+	// So does being far slower than the others.
+	for (int idx = 0; idx < 8; idx++) {
+		endpoints.Report("s3.example.com", 443, "10.0.0.1", false,
+						 std::chrono::microseconds(1000));
+		endpoints.Report("s3.example.com", 443, "10.0.0.3", false,
+						 std::chrono::microseconds(500000));
+	}
+	for (int idx = 0; idx < 4; idx++) {
+		ASSERT_TRUE(endpoints.Pick("s3.example.com", 443, address));
+		ASSERT_EQ(address, "10.0.0.1");
+	}
+}
+
+TEST(TestStringUtils, ParseSize) {
+	size_t size;
+	ASSERT_TRUE(parseSize("0", size));
+	ASSERT_EQ(size, 0u);
+	ASSERT_TRUE(parseSize("4096", size));
+	ASSERT_EQ(size, 4096u);
+	ASSERT_TRUE(parseSize("8k", size));
+	ASSERT_EQ(size, 8u << 10);
+	ASSERT_TRUE(parseSize("16M", size));
+	ASSERT_EQ(size, 16u << 20);
+	ASSERT_TRUE(parseSize("2G", size));
+	ASSERT_EQ(size, size_t(2) << 30);
+	for (const char *bad : {"", "-1", "M", "4MB", "1.5M", "4 M", "10T",
+							"99999999999999999999", "17179869184G"}) {
+		ASSERT_FALSE(parseSize(bad, size)) << bad;
+	}
+}
+
+TEST(TestStringUtils, ParseDuration) {
+	std::chrono::milliseconds duration;
+	ASSERT_TRUE(parseDuration("0", duration));
+	ASSERT_EQ(duration.count(), 0);
+	ASSERT_TRUE(parseDuration("500ms", duration));
+	ASSERT_EQ(duration.count(), 500);
+	ASSERT_TRUE(parseDuration("2", duration));
+	ASSERT_EQ(duration.count(), 2000);
+	ASSERT_TRUE(parseDuration("2s", duration));
+	ASSERT_EQ(duration.count(), 2000);
+	ASSERT_TRUE(parseDuration("5m", duration));
+	ASSERT_EQ(duration.count(), 5 * 60 * 1000);
+	ASSERT_TRUE(parseDuration("1h", duration));
+	ASSERT_EQ(duration.count(), 60 * 60 * 1000);
+	for (const char *bad : {"", "-1", "s", "1.5s", "1 s", "10d", "1S",
+							"99999999999999999999", "9999999999999999h"}) {
+		ASSERT_FALSE(parseDuration(bad, duration)) << bad;
+	}
+}
+
+// Two mirrors serving the same object from the mock server.
+class TestMultiSource : public ::testing::Test {
+  protected:
+	void SetUp() override {
+		signal(SIGPIPE, SIG_IGN);
+		std::string err;
+		ASSERT_TRUE(m_primary.Start(false, err)) << err;
+		ASSERT_TRUE(m_mirror.Start(false, err)) << err;
+		for (size_t idx = 0; idx < m_object.size(); idx++) {
+			m_object[idx] = static_cast<char>(idx * 7 + idx / 251);
+		}
+		m_primary.putObject("/origin/object", m_object);
+		m_mirror.putObject("/origin/object", m_object);
+	}
+
+	std::string read(HTTPMirrorSet &mirrors, off_t offset, size_t size,
+					 const TransportOptions *transport = nullptr) {
+		HTTPMultiSourceDownload download(mirrors, "object", 64 << 10, m_err);
+		download.SetTransport(transport);
+		std::string buffer(size, '\0');
+		ssize_t rv = download.Read(buffer.data(), offset, size);
+		return rv == static_cast<ssize_t>(size) ? buffer : "";
+	}
+
+	XrdSysLogger m_log;
+	XrdSysError m_err{&m_log, "TestMultiSource"};
+	MockServer m_primary;
+	MockServer m_mirror;
+	std::string m_object = std::string(1 << 20, '\0');
+};
+
+TEST_F(TestMultiSource, SplitsAcrossMirrors) {
+	HTTPMirrorSet mirrors(
+		{m_primary.url() + "/origin", m_mirror.url() + "/origin"});
+	ASSERT_EQ(read(mirrors, 0, m_object.size()), m_object);
+	ASSERT_GT(m_primary.requests(), 0u);
+	ASSERT_GT(m_mirror.requests(), 0u);
+	ASSERT_EQ(read(mirrors, 12345, 300000), m_object.substr(12345, 300000));
+}
+
+TEST_F(TestMultiSource, FailsOver) {
+	// Every response from the mirror is cut off mid-body.
+	FaultProfile faults;
+	faults.reset_rate = 1;
+	m_mirror.setFaults(faults);
+	HTTPMirrorSet mirrors(
+		{m_primary.url() + "/origin", m_mirror.url() + "/origin"});
+	ASSERT_EQ(read(mirrors, 0, m_object.size()), m_object);
+	ASSERT_GT(m_mirror.requests(), 0u);
+
+	// With no working source the read fails.
+	m_primary.setFaults(faults);
+	HTTPMultiSourceDownload download(mirrors, "object", 64 << 10, m_err);
+	std::string buffer(m_object.size(), '\0');
+	ASSERT_EQ(download.Read(buffer.data(), 0, buffer.size()), -EIO);
+}
+
+TEST_F(TestMultiSource, PrimaryOverUnixSocket) {
+	char dir[] = "/tmp/http-gtest-XXXXXX";
+	ASSERT_NE(mkdtemp(dir), nullptr);
+	std::string socket = std::string(dir) + "/origin.sock";
+	std::string err;
+	ASSERT_TRUE(m_primary.ListenUnix(socket, err)) << err;
+	// The primary's name does not resolve; only the socket reaches it.
+	TransportOptions transport;
+	transport.unix_socket = socket;
+	HTTPMirrorSet mirrors(
+		{"http://origin.invalid/origin", m_mirror.url() + "/origin"});
+	std::string contents = read(mirrors, 0, m_object.size(), &transport);
+	uint64_t mirrorRequests = m_mirror.requests();
+	m_primary.Stop();
+	rmdir(dir);
+	ASSERT_EQ(contents, m_object);
+	ASSERT_EQ(m_primary.lastHost(), "origin.invalid");
+	ASSERT_GT(mirrorRequests, 0u);
+}
+
+// Timing breakdowns of requests to a slow mirror.
+using TestTiming = TestMultiSource;
+
+TEST_F(TestTiming, RecordsPhases) {
+	FaultProfile faults;
+	faults.latency_median_ms = 20;
+	m_primary.setFaults(faults);
+	HTTPDownload download(m_primary.url() + "/origin", "object", m_err);
+	ASSERT_TRUE(download.SendRequest(0, 4096));
+	ASSERT_EQ(download.getResultString(), m_object.substr(0, 4096));
+
+	// The phases are cumulative, and the server's delay lands before the
+	// first byte.
+	const auto &timing = download.getTiming();
+	ASSERT_GE(timing.connect, timing.dns);
+	ASSERT_GE(timing.ttfb, timing.connect);
+	ASSERT_GE(timing.ttfb, 20000);
+	ASSERT_GE(timing.total, timing.ttfb);
+	ASSERT_EQ(timing.tls, 0);
+	ASSERT_GE(timing.queue, 0);
+	ASSERT_GE(timing.copy, 0);
+}
+
+TEST_F(TestTiming, SlowLogPerExport) {
+	FaultProfile faults;
+	faults.latency_median_ms = 5;
+	m_primary.setFaults(faults);
+	TransportOptions strict, lax;
+	std::string err;
+	ASSERT_TRUE(strict.Set("slow_request_threshold", "1ms", err)) << err;
+	ASSERT_TRUE(lax.Set("slow_request_threshold", "1h", err)) << err;
+	ASSERT_FALSE(lax.Set("slow_request_threshold", "soon", err));
+
+	auto logged = [&](const TransportOptions &transport) {
+		HTTPDownload download(m_primary.url() + "/origin", "object", m_err);
+		download.SetTransport(&transport);
+		testing::internal::CaptureStderr();
+		bool ok = download.SendRequest(0, 4096);
+		std::string log = testing::internal::GetCapturedStderr();
+		EXPECT_TRUE(ok);
+		return log.find("SlowRequest GET") != std::string::npos;
+	};
+	ASSERT_TRUE(logged(strict));
+	ASSERT_FALSE(logged(lax));
+}
+
+TEST(TestAccessLog, WritesRecords) {
+	XrdSysLogger log;
+	XrdSysError err(&log, "TestAccessLog");
+	char path[] = "/tmp/xrdhttp_access_log_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	auto &alog = AccessLog::Instance();
+	ASSERT_TRUE(alog.Start(path, err));
+	ASSERT_FALSE(alog.Start(std::string(path) + ".other", err));
+	auto start = std::chrono::steady_clock::now();
+	alog.Record(AccessOp::Read, "/foo/bar", 4096, 100, 100, start);
+	std::thread([&] {
+		alog.Record(AccessOp::Close, "/foo/bar", 0, 0, 0, start);
+	}).join();
+	alog.Flush();
+
+	std::ifstream in(path, std::ios::binary);
+	std::string contents((std::istreambuf_iterator<char>(in)),
+						 std::istreambuf_iterator<char>());
+	unlink(path);
+	ASSERT_EQ(contents.size(), 16 + 2 * sizeof(AccessRecord));
+	ASSERT_EQ(contents.substr(0, 8), "XRDHTAL1");
+	uint32_t recordSize;
+	memcpy(&recordSize, contents.data() + 8, sizeof(recordSize));
+	ASSERT_EQ(recordSize, sizeof(AccessRecord));
+
+	AccessRecord rec;
+	memcpy(&rec, contents.data() + 16, sizeof(rec));
+	ASSERT_EQ(rec.op, static_cast<uint8_t>(AccessOp::Read));
+	ASSERT_EQ(rec.offset, 4096);
+	ASSERT_EQ(rec.length, 100u);
+	ASSERT_EQ(std::string(rec.path, rec.path_len), "/foo/bar");
+	ASSERT_EQ(rec.path_hash, AccessLog::HashPath("/foo/bar"));
+	memcpy(&rec, contents.data() + 16 + sizeof(rec), sizeof(rec));
+	ASSERT_EQ(rec.op, static_cast<uint8_t>(AccessOp::Close));
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
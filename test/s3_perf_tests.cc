@@ -0,0 +1,263 @@
+/***************************************************************
+ *
+ * Copyright (C) 2024, Pelican Project, Morgridge Institute for Research
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************/
+
+// Structural performance tests: run the S3 plugin against the mock server
+// and check how many backend requests and connections, allocations and
+// copied bytes each operation costs.  Unlike timings these do not depend on
+// the machine, so they can fail CI.  The limits are the costs recorded
+// when each test was written, with a little slack where the count depends
+// on how the kernel splits up a response; lower them when an optimization
+// improves a number, so it cannot silently regress.
+
+#include "../bench/Bench.hh"
+#include "../bench/MockServer.hh"
+#include "../src/S3FileSystem.hh"
+
+#include <XrdOuc/XrdOucEnv.hh>
+#include <XrdSys/XrdSysLogger.hh>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Allocations and memcpy calls made by the thread running a test while it
+// is counting.  The mock server's threads never count.
+thread_local bool t_counting = false;
+thread_local uint64_t t_allocations = 0;
+thread_local uint64_t t_copied = 0;
+
+class Counting {
+  public:
+	Counting() {
+		t_allocations = 0;
+		t_copied = 0;
+		t_counting = true;
+	}
+	~Counting() { t_counting = false; }
+
+	uint64_t allocations() const { return t_allocations; }
+	uint64_t copied() const { return t_copied; }
+};
+
+void *countedAlloc(size_t size) {
+	if (t_counting) {
+		t_allocations++;
+	}
+	if (void *ptr = malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+} // namespace
+
+// Count every C++ allocation; the plugin's buffers, strings and maps all go
+// through these.
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+// Count the bytes copied by memcpy, whether called from the plugin, from
+// libstdc++ (growing and copying strings) or from libcurl, all of which
+// resolve memcpy to this definition.  memmove is a valid memcpy and, unlike
+// a copy loop, cannot be turned back into a call to memcpy by the compiler.
+extern "C" void *memcpy(void *dst, const void *src, size_t size) noexcept {
+	if (t_counting) {
+		t_copied += size;
+	}
+	return memmove(dst, src, size);
+}
+
+namespace {
+
+// Recorded costs; see the comment at the top of the file.
+const uint64_t g_open_requests = 1;		  // HEAD
+const uint64_t g_read_requests = 1;		  // GET per Read
+const uint64_t g_fstat_requests = 1;	  // HEAD
+const uint64_t g_stat_requests = 2;		  // HEAD to open, HEAD to Fstat
+const uint64_t g_connections_per_req = 1; // no reuse yet
+// C++ allocations only; libcurl's mallocs are not counted.
+const uint64_t g_allocations_per_read = 36;
+const uint64_t g_allocations_per_presigned_read = 24;
+// Appending to the result string, growing it, and copying it out.
+const double g_copies_per_byte_read = 4.1;
+
+const size_t g_object_size = 8 << 20;
+const size_t g_block_size = 1 << 20;
+
+class S3PerfTest : public ::testing::Test {
+  protected:
+	void SetUp() override {
+		signal(SIGPIPE, SIG_IGN);
+		std::string err;
+		ASSERT_TRUE(m_server.Start(false, err)) << err;
+		m_server.putObject(benchBackendPath("s3", "object"),
+						   std::string(g_object_size, 'x'));
+
+		char dir[] = "/tmp/s3-perf-gtest-XXXXXX";
+		ASSERT_NE(mkdtemp(dir), nullptr);
+		m_dir = dir;
+		m_cfgfile = m_dir + "/s3.cfg";
+		std::ofstream cfg(m_cfgfile);
+		ASSERT_TRUE(benchWriteConfig(cfg, m_server.url(), m_dir, m_opts));
+		cfg.close();
+		m_fs.reset(new S3FileSystem(&m_logger, m_cfgfile.c_str(), nullptr));
+	}
+
+	void TearDown() override {
+		m_fs.reset();
+		m_server.Stop();
+		for (const char *name : {"s3.cfg", "access_key", "secret_key"}) {
+			unlink((m_dir + "/" + name).c_str());
+		}
+		rmdir(m_dir.c_str());
+	}
+
+	std::unique_ptr<XrdOssDF> openObject() {
+		std::unique_ptr<XrdOssDF> file(m_fs->newFile("perf"));
+		std::string path = std::string(g_bench_prefix) + "/object";
+		EXPECT_EQ(file->Open(path.c_str(), 0, 0600, m_env), 0);
+		return file;
+	}
+
+	BenchOptions m_opts;
+	MockServer m_server;
+	XrdSysLogger m_logger;
+	XrdOucEnv m_env;
+	std::unique_ptr<S3FileSystem> m_fs;
+	std::string m_dir;
+	std::string m_cfgfile;
+};
+
+TEST_F(S3PerfTest, RequestsPerOperation) {
+	uint64_t before = m_server.requests();
+	auto file = openObject();
+	EXPECT_LE(m_server.requests() - before, g_open_requests);
+
+	std::vector<char> buffer(g_block_size);
+	before = m_server.requests();
+	for (size_t offset = 0; offset < g_object_size; offset += g_block_size) {
+		ASSERT_EQ(file->Read(buffer.data(), offset, buffer.size()),
+				  static_cast<ssize_t>(buffer.size()));
+	}
+	EXPECT_LE(m_server.requests() - before,
+			  g_read_requests * (g_object_size / g_block_size));
+
+	struct stat st;
+	before = m_server.requests();
+	ASSERT_EQ(file->Fstat(&st), 0);
+	EXPECT_EQ(static_cast<size_t>(st.st_size), g_object_size);
+	EXPECT_LE(m_server.requests() - before, g_fstat_requests);
+
+	before = m_server.requests();
+	EXPECT_EQ(file->Close(), 0);
+	EXPECT_EQ(m_server.requests(), before);
+
+	before = m_server.requests();
+	std::string path = std::string(g_bench_prefix) + "/object";
+	ASSERT_EQ(m_fs->Stat(path.c_str(), &st, 0, &m_env), 0);
+	EXPECT_LE(m_server.requests() - before, g_stat_requests);
+}
+
+TEST_F(S3PerfTest, ConnectionsPerRequest) {
+	auto file = openObject();
+	std::vector<char> buffer(g_block_size);
+	uint64_t requests = m_server.requests();
+	uint64_t connections = m_server.connections();
+	for (int idx = 0; idx < 16; idx++) {
+		ASSERT_EQ(file->Read(buffer.data(), 0, buffer.size()),
+				  static_cast<ssize_t>(buffer.size()));
+	}
+	requests = m_server.requests() - requests;
+	connections = m_server.connections() - connections;
+	EXPECT_EQ(requests, 16u);
+	EXPECT_LE(connections, requests * g_connections_per_req);
+}
+
+TEST_F(S3PerfTest, AllocationsAndCopiesPerRead) {
+	auto file = openObject();
+	std::vector<char> buffer(g_block_size);
+	const int reads = 8;
+	uint64_t allocations, copied;
+	{
+		Counting counting;
+		for (int idx = 0; idx < reads; idx++) {
+			ASSERT_EQ(file->Read(buffer.data(), idx * g_block_size,
+								 buffer.size()),
+					  static_cast<ssize_t>(buffer.size()));
+		}
+		allocations = counting.allocations();
+		copied = counting.copied();
+	}
+	double copiesPerByte = double(copied) / (reads * g_block_size);
+	RecordProperty("allocations_per_read", allocations / reads);
+	RecordProperty("copied_bytes_per_read", copied / reads);
+	EXPECT_LE(allocations / reads, g_allocations_per_read);
+	EXPECT_LE(copiesPerByte, g_copies_per_byte_read);
+	// Every byte is at least delivered into the caller's buffer.
+	EXPECT_GE(copiesPerByte, 1.0);
+}
+
+// Reads through cached pre-signed URLs.
+class S3PresignPerfTest : public S3PerfTest {
+  protected:
+	S3PresignPerfTest() { m_opts.presign = 900; }
+};
+
+TEST_F(S3PresignPerfTest, AllocationsPerPresignedRead) {
+	auto file = openObject();
+	std::vector<char> buffer(g_block_size);
+	// The first read generates the URL.
+	ASSERT_EQ(file->Read(buffer.data(), 0, buffer.size()),
+			  static_cast<ssize_t>(buffer.size()));
+	const int reads = 8;
+	uint64_t requests = m_server.requests();
+	uint64_t allocations;
+	{
+		Counting counting;
+		for (int idx = 0; idx < reads; idx++) {
+			ASSERT_EQ(file->Read(buffer.data(), idx * g_block_size,
+								 buffer.size()),
+					  static_cast<ssize_t>(buffer.size()));
+		}
+		allocations = counting.allocations();
+	}
+	EXPECT_EQ(m_server.requests() - requests, static_cast<uint64_t>(reads));
+	RecordProperty("allocations_per_read", allocations / reads);
+	EXPECT_LE(allocations / reads, g_allocations_per_presigned_read);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}